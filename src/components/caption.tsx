@@ -1,14 +1,7 @@
 /** @jsxImportSource @emotion/react */
 import { css } from '@emotion/react'
-import React, {
-  RefObject,
-  useCallback,
-  useEffect,
-  useRef,
-  useState
-} from 'react'
-import { WasmModule } from '../lib/wasmmodule'
-import { CanvasProvider } from 'aribb24.js'
+import React, { RefObject, useCallback, useEffect } from 'react'
+import { CaptionDrcs, CaptionPage, CaptionRun, WasmModule } from '../lib/wasmmodule'
 import { Service } from 'mirakurun/api'
 
 type Props = {
@@ -18,6 +11,95 @@ type Props = {
   width?: number
   height?: number
   service: Service | undefined
+  // 映像に重ねて描く設定になっているか
+  overlay?: boolean
+}
+
+// 0xRRGGBBAA
+const colorToCss = (rgba: number) =>
+  `rgba(${(rgba >>> 24) & 0xff}, ${(rgba >>> 16) & 0xff}, ${(rgba >>> 8) & 0xff}, ${
+    (rgba & 0xff) / 0xff
+  })`
+
+const drawDrcs = (
+  context: CanvasRenderingContext2D,
+  run: CaptionRun,
+  drcs: CaptionDrcs,
+  x: number,
+  y: number
+) => {
+  const image = new ImageData(drcs.width, drcs.height)
+  for (let i = 0; i < drcs.alpha.length; i++) {
+    image.data[i * 4] = (run.foreground >>> 24) & 0xff
+    image.data[i * 4 + 1] = (run.foreground >>> 16) & 0xff
+    image.data[i * 4 + 2] = (run.foreground >>> 8) & 0xff
+    image.data[i * 4 + 3] = drcs.alpha[i]
+  }
+  const pattern = document.createElement('canvas')
+  pattern.width = drcs.width
+  pattern.height = drcs.height
+  pattern.getContext('2d')?.putImageData(image, 0, 0)
+  context.drawImage(pattern, x, y, run.charWidth, run.charHeight)
+}
+
+const renderCaptionPage = (context: CanvasRenderingContext2D, page: CaptionPage) => {
+  const canvas = context.canvas
+  context.clearRect(0, 0, canvas.width, canvas.height)
+  if (page.runs.length === 0) return
+
+  // 表示面の縦横比を保ってcanvasの中央に置く
+  const scale = Math.min(canvas.width / page.planeWidth, canvas.height / page.planeHeight)
+  context.save()
+  context.translate(
+    (canvas.width - page.planeWidth * scale) / 2,
+    (canvas.height - page.planeHeight * scale) / 2
+  )
+  context.scale(scale, scale)
+  context.textAlign = 'center'
+  context.textBaseline = 'middle'
+  context.lineJoin = 'round'
+  for (const run of page.runs) {
+    if ((run.background & 0xff) !== 0) {
+      context.fillStyle = colorToCss(run.background)
+      context.fillRect(run.x, run.y, run.cellWidth * run.length, run.cellHeight)
+    }
+    // 字間・行間は文字の前後に半分ずつ入る
+    const centerY = run.y + run.cellHeight / 2
+    if (run.drcs >= 0) {
+      const centerX = run.x + run.cellWidth / 2
+      drawDrcs(
+        context,
+        run,
+        page.drcs[run.drcs],
+        centerX - run.charWidth / 2,
+        centerY - run.charHeight / 2
+      )
+    } else {
+      context.font = `${run.charHeight}px sans-serif`
+      context.fillStyle = colorToCss(run.foreground)
+      context.strokeStyle = run.outline !== 0 ? colorToCss(run.outline) : 'black'
+      context.lineWidth = run.charHeight / 8
+      Array.from(run.text).forEach((ch, i) => {
+        context.save()
+        context.translate(run.x + run.cellWidth * (i + 0.5), centerY)
+        // 中サイズなどは横に縮める
+        context.scale(run.charWidth / run.charHeight, 1)
+        context.strokeText(ch, 0, 0)
+        context.fillText(ch, 0, 0)
+        context.restore()
+      })
+    }
+    if (run.underline) {
+      context.fillStyle = colorToCss(run.foreground)
+      context.fillRect(
+        run.x,
+        centerY + run.charHeight / 2,
+        run.cellWidth * run.length,
+        Math.max(1, run.charHeight / 18)
+      )
+    }
+  }
+  context.restore()
 }
 
 const Caption: React.FC<Props> = ({
@@ -25,62 +107,27 @@ const Caption: React.FC<Props> = ({
   wasmModule,
   width,
   height,
-  service
+  service,
+  overlay
 }) => {
-  // const canvasRef = useRef<HTMLCanvasElement>(null)
-  // const [currentSubtitle, setCurrentSubtitle] = useState<number>()
-  const [renderTimeoutId, setRenderTimeoutId] = useState(
-    setTimeout(() => {}, 0)
-  )
-  const [clearTimeoutId, setClearTimeoutId] = useState(setTimeout(() => {}, 0))
-
-  const captionCallback = useCallback(
-    (pts: number, ptsTime: number, captionData: Uint8Array) => {
-      const data = captionData.slice()
-      const canvas = canvasRef.current
-      if (!canvas) return
-      const context = canvas.getContext('2d')
-      if (!context) return
-
-      // if (!aribSubtitleData) {
-      //   context.clearRect(0, 0, canvas.width, canvas.height)
-      //   setDisplayingAribSubtitleData(null)
-      //   return
-      // }
-
-      const provider = new CanvasProvider(data, ptsTime)
-      const estimate = provider.render()
-      if (!estimate) return
-      // const font = setting.font || SUBTITLE_DEFAULT_FONT
-      // const font = `"Rounded M+ 1m for ARIB"`
-      const renderId = setTimeout(() => {
-        const result = provider.render({
-          canvas,
-          useStroke: true,
-          keepAspectRatio: true,
-          // normalFont: font,
-          // gaijiFont: font,
-          drcsReplacement: true
-        })
-        if (estimate.endTime === Number.POSITIVE_INFINITY) return
-        const clearId = setTimeout(() => {
-          // console.log('end timeout', now, currentSubtitle)
-          // if (currentSubtitle !== now) return
-          context.clearRect(0, 0, canvas.width, canvas.height)
-          // setCurrentSubtitle(undefined)
-        }, (estimate.endTime - estimate.startTime) * 1000)
-        setClearTimeoutId(clearId)
-      }, estimate.startTime * 1000)
-      setRenderTimeoutId(renderId)
-    },
-    []
-  )
+  // 表示する時刻が来たページがまとめて届く。
+  // 各ページは画面全体の状態なので最後のページだけ描けばよい
+  const captionCallback = useCallback((pages: Array<CaptionPage>) => {
+    const page = pages[pages.length - 1]
+    if (!page) return
+    const canvas = canvasRef.current
+    if (!canvas) return
+    const context = canvas.getContext('2d')
+    if (!context) return
+    renderCaptionPage(context, page)
+  }, [])
 
   useEffect(() => {
     if (!wasmModule) return
     wasmModule.setCaptionCallback(captionCallback)
   }, [wasmModule])
 
+  // 映像に重ねる設定に切り替えたときも、前に描いた字幕が残らないよう消す
   useEffect(() => {
     if (!service) return
     if (!canvasRef.current) return
@@ -88,9 +135,7 @@ const Caption: React.FC<Props> = ({
     const context = canvas.getContext('2d')
     if (!context) return
     context.clearRect(0, 0, canvas.width, canvas.height)
-    clearTimeout(renderTimeoutId)
-    clearTimeout(clearTimeoutId)
-  }, [service])
+  }, [service, overlay])
 
   return (
     <canvas
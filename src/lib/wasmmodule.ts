@@ -1,27 +1,151 @@
+// 字幕の同じ行・同じ書式で並んだ文字。1文字ずつ幅cellWidthの区画に置く
+export declare interface CaptionRun {
+  // DRCSの場合は空
+  text: string
+  // CaptionPage.drcsの番号(DRCSでなければ-1)
+  drcs: number
+  length: number
+  // 先頭の文字の区画の左上(表示面の座標)
+  x: number
+  y: number
+  cellWidth: number
+  cellHeight: number
+  charWidth: number
+  charHeight: number
+  // 0xRRGGBBAA。縁取りが無ければoutlineは0
+  foreground: number
+  background: number
+  outline: number
+  underline: boolean
+}
+
+export declare interface CaptionDrcs {
+  width: number
+  height: number
+  // 1画素1バイトの不透明度。次のコールバックまで有効
+  alpha: Uint8Array
+}
+
+export declare interface CaptionPage {
+  // 0x80: 字幕, 0x81: 文字スーパー
+  dataIdentifier: number
+  pts: number
+  planeWidth: number
+  planeHeight: number
+  // 空なら字幕を消す
+  runs: Array<CaptionRun>
+  drcs: Array<CaptionDrcs>
+}
+
 export declare interface StatsData {
   time: number
   VideoFrameQueueSize: number
   AudioFrameQueueSize: number
   SDLQueuedAudioSize: number
   InputBufferSize: number
+  CaptionDataQueueSize?: number
+  AudioWorkletBufferSize?: number
+  // trueならYadifMs/RenderMsはGPUタイムスタンプ、falseならCPU側の計測値
+  GpuTimestamps?: boolean
+  UploadMs?: number
+  YadifMs?: number
+  RenderMs?: number
+  PresentMs?: number
+  // 映像1パケットあたりのデコード時間と、適用中の画質の段階
+  VideoDecodeMs?: number
+  QualityTier?: number
+  // 映像の表示の基準 0: 未定, 1: 音声, 2: 壁時計(音声が無い・止まっている)
+  ClockSource?: number
+  DisplayRefreshHz?: number
+  ContentFps?: number
+  // 表示間隔がvsync 1,2,3,4,5,6回以上だった回数
+  PresentIntervalHistogram?: Array<number>
+  // 直近1秒間のフレーム数(/秒)
+  DecodedFps?: number
+  PresentedFps?: number
+  DroppedLateFps?: number
+  SkippedFps?: number
+  RepeatedFps?: number
+  // 境界 -50,-20,-10,-5,5,10,20,50 ms で区切った9ビンの度数分布
+  AvOffsetHistogram?: Array<number>
+  PresentJitterHistogram?: Array<number>
+  // 録画ファイル再生時のみ。同時接続数、1リクエストのバイト数、合計スループット、RTT
+  DownloadConnections?: number
+  DownloadChunkSize?: number
+  DownloadMbps?: number
+  DownloadRttMs?: number
+  // 失敗した範囲を取り直した回数、失敗したリクエストの数、ファイルの大きさ(MB)
+  DownloadRetries?: number
+  DownloadFailures?: number
+  DownloadFileSize?: number
+  DownloadComplete?: boolean
+  GopIndexSize?: number
+}
+
+export declare interface RecordingTime {
+  position: number
+  duration: number
+  // 早送り・巻き戻しの倍率。通常の再生なら0
+  rate: number
+}
+
+// 起動時の負荷測定の結果と、そこから選んだ設定
+export declare interface CapabilityProbeResult {
+  videoDecodeMs: number
+  rendererFrameMs: number
+  softwareRenderer: boolean
+  audioMsPerSecond: number
+  contentFps: number
+  hardwareThreads: number
+  qualityTier: number
+  decodeThreads: number
+  deinterlace: boolean
+  videoQueueDepth: number
 }
 
 export declare interface WasmModule extends EmscriptenModule {
   getExceptionMsg(ex: number): string
   setLogLevelDebug(): void
   setLogLevelInfo(): void
+  // パケット・フレームごとのデバッグ出力。setLogLevelDebug/Infoでも切り替わる
+  setTraceEnabled(enabled: boolean): void
   showVersionInfo(): void
-  setCaptionCallback(
-    callback: (pts: number, ptsTime: number, captionData: Uint8Array) => void
-  ): void
+  // 表示する時刻が来たページを表示順にまとめて渡す
+  setCaptionCallback(callback: (pages: Array<CaptionPage>) => void): void
+  // WebGPUで描画している間は字幕をコールバックに渡さず、映像に重ねて描く
+  setCaptionOverlay(enabled: boolean): void
   setStatsCallback(
     callback: ((statsDataList: Array<StatsData>) => void) | null
   ): void
   playFile(url: string): void
+  // 録画ファイルの先頭からの秒数の位置(の手前のキーフレーム)から再生し直す
+  seek(seconds: number): void
+  // 録画ファイルの再生位置と長さ(秒)。分からなければNaNと0
+  getRecordingTime(): RecordingTime
+  // ダウンロード済みの範囲ならその場でキーフレームに移ってtrueを返す(ドラッグ中の表示用)
+  scrub(seconds: number): boolean
+  // 前(-1)・次(1)のキーフレームに移る
+  stepKeyframe(direction: number): boolean
+  // キーフレームだけで早送り(2, 4, 8, 16)・巻き戻し(負の値)する。0で通常の再生に戻る
+  setTrickPlayRate(rate: number): void
+  // シーク用の索引(位置・PTS・キーフレーム)の保存と復元
+  exportGopIndex(): Float64Array
+  importGopIndex(data: Float64Array): void
   getNextInputBuffer(size: number): Uint8Array
   commitInputData(size: number): void
   reset(): void
   setAudioGain(volume: number): void
   setDualMonoMode(mode: number): void
+  setScaleFilter(filter: number): void
+  setChromaPacking(enabled: boolean): void
+  // 0: 通常, 1: 省電力, 2: 1/2解像度, 3: 1/4解像度
+  setQualityTier(tier: number): void
+  setDecodeThreads(threads: number): void
+  setVideoQueueDepth(depth: number): void
+  startCapabilityProbe(callback: (result: CapabilityProbeResult) => void): void
+  setRendererCheck(enabled: boolean): void
+  setDeinterlace(enabled: boolean): void
+  // 0で無効。WebGPUで描画している場合だけ効く
+  setSharpness(strength: number): void
 }
 export declare var Module: WasmModule
@@ -4,7 +4,7 @@ import { NextPage } from 'next'
 import dynamic from 'next/dynamic'
 import Script from 'next/script'
 import { EventHandler, useCallback, useEffect, useRef, useState } from 'react'
-import { useAsync, useKey, useLocalStorage } from 'react-use'
+import { useAsync, useInterval, useKey, useLocalStorage } from 'react-use'
 import {
   Box,
   Button,
@@ -24,7 +24,7 @@ import {
 import { VolumeMute, VolumeUp } from '@mui/icons-material'
 import { CartesianGrid, LineChart, XAxis, YAxis, Line, Legend } from 'recharts'
 import Head from 'next/head'
-import { WasmModule, StatsData } from '../lib/wasmmodule'
+import { WasmModule, StatsData, CapabilityProbeResult, RecordingTime } from '../lib/wasmmodule'
 import dayjs from 'dayjs'
 
 import { Program, Service } from 'mirakurun/api'
@@ -41,11 +41,41 @@ declare interface EpgRecordedFile {
 
 let initialized = false;
 
+// 録画ファイルごとのシーク用の索引。localStorageを使いすぎないよう新しいものだけ残す
+const GOP_INDEX_KEY_PREFIX = 'tsplayerGopIndex:'
+const MAX_SAVED_GOP_INDEXES = 3
+
+const loadGopIndex = (fileId: number) => {
+  const saved = localStorage.getItem(GOP_INDEX_KEY_PREFIX + fileId)
+  if (!saved) return undefined
+  const bytes = Uint8Array.from(atob(saved), c => c.charCodeAt(0))
+  return new Float64Array(bytes.buffer)
+}
+
+const saveGopIndex = (fileId: number, data: Float64Array) => {
+  const bytes = new Uint8Array(data.buffer)
+  let binary = ''
+  for (let i = 0; i < bytes.length; i += 0x8000) {
+    binary += String.fromCharCode(...bytes.subarray(i, i + 0x8000))
+  }
+  // 保存した順の一覧を別に持ち、古いものから消す
+  const key = GOP_INDEX_KEY_PREFIX + fileId
+  const order: Array<string> = JSON.parse(localStorage.getItem('tsplayerGopIndexOrder') || '[]')
+  const kept = order.filter(k => k !== key)
+  while (kept.length >= MAX_SAVED_GOP_INDEXES) {
+    localStorage.removeItem(kept.shift()!)
+  }
+  kept.push(key)
+  localStorage.setItem('tsplayerGopIndexOrder', JSON.stringify(kept))
+  localStorage.setItem(key, btoa(binary))
+}
+
 const Page: NextPage = () => {
   const router = useRouter()
   const { debug } = router.query
 
   const [debugLog, setDebugLog] = useState<boolean>(false)
+  const [rendererCheck, setRendererCheck] = useState<boolean>(false)
 
   const [drawer, setDrawer] = useState<boolean>(true)
   const [touched, setTouched] = useState<boolean>(false)
@@ -70,11 +100,28 @@ const Page: NextPage = () => {
   const [epgRecordedFiles, setEpgRecordedFiles] = useState<Array<EpgRecordedFile>>()
   const [activeRecordedFileId, setActiveRecordedFileId] = useState<number>()
   const [playMode, setPlayMode] = useState<string>('live')
+  const [recordingTime, setRecordingTime] = useState<RecordingTime>()
+  const [persistGopIndex, setPersistGopIndex] = useLocalStorage<boolean>(
+    'tsplayerPersistGopIndex',
+    false
+  )
+  const lastScrubRef = useRef<number>(0)
+  // シークバーをドラッグしている間の位置
+  const [seekingPosition, setSeekingPosition] = useState<number>()
   const [dualMonoMode, setDualMonoMode] = useLocalStorage<number>('tsplayerDualMonoMode', 0)
+  const [scaleFilter, setScaleFilter] = useLocalStorage<number>('tsplayerScaleFilter', 1)
+  const [chromaPacking, setChromaPacking] = useLocalStorage<boolean>('tsplayerChromaPacking', false)
+  const [deinterlace, setDeinterlace] = useLocalStorage<boolean>('tsplayerDeinterlace', true)
+  const [sharpness, setSharpness] = useLocalStorage<number>('tsplayerSharpness', 0)
+  const [qualityTier, setQualityTier] = useLocalStorage<number>('tsplayerQualityTier', 0)
+  const [capabilityProbe, setCapabilityProbe, removeCapabilityProbe] =
+    useLocalStorage<CapabilityProbeResult>('tsplayerCapabilityProbe')
   const [volume, setVolume] = useLocalStorage<number>('tsplayerVolume', 1.0)
   const [mute, setMute] = useLocalStorage<boolean>('tsplayerMute', false)
 
   const [stopFunc, setStopFunc] = useState(() => () => {})
+  // 索引を保存する先。activeRecordedFileIdは再生を始める前に次のファイルに変わる
+  const playingFileIdRef = useRef<number>()
   const [chartData, setChartData] = useState<Array<StatsData>>([
     {
       time: 0,
@@ -103,13 +150,29 @@ const Page: NextPage = () => {
     ;(async () => {
       console.log("async", wasmMod, initialized)
 
-      const adapter = await (navigator as any).gpu.requestAdapter()
-      const device = await adapter.requestDevice()
+      // OffscreenCanvasが使える場合は表示用のワーカーが自前でdeviceを取り直すので、
+      // これはメインスレッドで描画する場合だけ使われる
+      // WebGPUが使えない環境ではdeviceを渡さず、CPUでの描画にフォールバックする
+      let device = undefined
+      try {
+        const adapter = await (navigator as any).gpu?.requestAdapter()
+        if (adapter) {
+          // 描画パスごとのGPU時間計測に使う。無い環境ではCPU側の計測にフォールバックする
+          const requiredFeatures = adapter.features.has('timestamp-query') ? ['timestamp-query'] : []
+          device = await adapter.requestDevice({ requiredFeatures })
+        }
+      } catch (e) {
+        console.error('WebGPU not available', e)
+      }
+      // wasm側のmarkStartup()と同じ接頭辞で起動のタイムラインに並べる
+      performance.mark('ts-live:webgpu-device-ready')
+      // ?software でWebGPUが使える環境でもCPUで描画する(比較・デバッグ用)
+      const forceSoftwareRenderer = new URLSearchParams(window.location.search).has('software')
       const script = document.createElement('script')
       script.onload = () => {
         console.log("onload")
         ;(window as any)
-          .createWasmModule({ preinitializedWebGPUDevice: device })
+          .createWasmModule({ preinitializedWebGPUDevice: device, forceSoftwareRenderer })
           .then((m: WasmModule) => {
             console.log('then', m)
             console.log("setWasmMod")
@@ -128,6 +191,36 @@ const Page: NextPage = () => {
     wasmMod.setDualMonoMode(dualMonoMode)
   }, [wasmMod, dualMonoMode])
 
+  useEffect(() => {
+    if (!wasmMod) return
+    if (scaleFilter === undefined) return
+    wasmMod.setScaleFilter(scaleFilter)
+  }, [wasmMod, scaleFilter])
+
+  useEffect(() => {
+    if (!wasmMod) return
+    if (chromaPacking === undefined) return
+    wasmMod.setChromaPacking(chromaPacking)
+  }, [wasmMod, chromaPacking])
+
+  useEffect(() => {
+    if (!wasmMod) return
+    if (deinterlace === undefined) return
+    wasmMod.setDeinterlace(deinterlace)
+  }, [wasmMod, deinterlace])
+
+  useEffect(() => {
+    if (!wasmMod) return
+    if (sharpness === undefined) return
+    wasmMod.setSharpness(sharpness)
+  }, [wasmMod, sharpness])
+
+  useEffect(() => {
+    if (!wasmMod) return
+    if (qualityTier === undefined) return
+    wasmMod.setQualityTier(qualityTier)
+  }, [wasmMod, qualityTier])
+
   useEffect(() => {
     if (!wasmMod) return
     if (debugLog === undefined) return
@@ -138,6 +231,35 @@ const Page: NextPage = () => {
     }
   }, [wasmMod, debugLog])
 
+  useEffect(() => {
+    if (!wasmMod) return
+    wasmMod.setRendererCheck(rendererCheck)
+  }, [wasmMod, rendererCheck])
+
+  // 表示する間は映像に重ねて描く(WebGPUでない場合はCaptionのcanvasに描く)
+  useEffect(() => {
+    if (!wasmMod) return
+    wasmMod.setCaptionOverlay(!!showCaption)
+  }, [wasmMod, showCaption])
+
+  // 初回だけ再生中の負荷を測って設定を選ぶ。結果は保存して次回以降はそれを使う
+  useEffect(() => {
+    if (!wasmMod) return
+    if (capabilityProbe) {
+      wasmMod.setDecodeThreads(capabilityProbe.decodeThreads)
+      wasmMod.setVideoQueueDepth(capabilityProbe.videoQueueDepth)
+      return
+    }
+    // 測定は一番重い設定で行うので表示も合わせておく
+    setQualityTier(0)
+    setDeinterlace(true)
+    wasmMod.startCapabilityProbe(result => {
+      setCapabilityProbe(result)
+      setQualityTier(result.qualityTier)
+      setDeinterlace(result.deinterlace)
+    })
+  }, [wasmMod, capabilityProbe])
+
   // const canvasProviderState = useAsync(async () => {
   //   const CanvasProvider = await import('aribb24.js').then(
   //     mod => mod.CanvasProvider
@@ -368,10 +490,16 @@ const Page: NextPage = () => {
           })
       } else if (playMode === 'file') {
         setStopFunc(() => () => {
+          playingFileIdRef.current = undefined
           Module.reset()
         })
         const url = `${epgStationServer}/api/videos/${activeRecordedFileId}`
         Module.playFile(url)
+        playingFileIdRef.current = activeRecordedFileId
+        if (persistGopIndex && activeRecordedFileId !== undefined) {
+          const saved = loadGopIndex(activeRecordedFileId)
+          if (saved) Module.importGopIndex(saved)
+        }
       }
     }, 500)
   }, [
@@ -382,8 +510,65 @@ const Page: NextPage = () => {
     activeRecordedFileId,
     playMode,
     wasmMod,
+    persistGopIndex,
   ])
 
+  useInterval(
+    () => {
+      if (wasmMod) setRecordingTime(wasmMod.getRecordingTime())
+    },
+    playMode === 'file' ? (recordingTime?.rate ? 250 : 1000) : null
+  )
+
+  const seekBy = useCallback(
+    (seconds: number) => {
+      if (!wasmMod || !recordingTime || isNaN(recordingTime.position)) return
+      wasmMod.seek(Math.max(0, recordingTime.position + seconds))
+    },
+    [wasmMod, recordingTime]
+  )
+  useKey('ArrowLeft', () => playMode === 'file' && seekBy(-10), {}, [playMode, seekBy])
+  useKey('ArrowRight', () => playMode === 'file' && seekBy(30), {}, [playMode, seekBy])
+  // 同じ向きなら倍率を上げ、逆向きなら下げて通常の再生まで戻す
+  const stepTrickPlayRate = useCallback(
+    (direction: number) => {
+      if (!wasmMod || !recordingTime) return
+      const rate = recordingTime.rate
+      const next =
+        rate === 0
+          ? 2 * direction
+          : Math.sign(rate) === direction
+          ? Math.min(Math.abs(rate) * 2, 16) * direction
+          : Math.abs(rate) > 2
+          ? rate / 2
+          : 0
+      wasmMod.setTrickPlayRate(next)
+      setRecordingTime({ ...recordingTime, rate: next })
+    },
+    [wasmMod, recordingTime]
+  )
+  useKey('[', () => playMode === 'file' && stepTrickPlayRate(-1), {}, [playMode, stepTrickPlayRate])
+  useKey(']', () => playMode === 'file' && stepTrickPlayRate(1), {}, [playMode, stepTrickPlayRate])
+  useKey(',', () => playMode === 'file' && wasmMod?.stepKeyframe(-1), {}, [playMode, wasmMod])
+  useKey('.', () => playMode === 'file' && wasmMod?.stepKeyframe(1), {}, [playMode, wasmMod])
+
+  useInterval(
+    () => {
+      const fileId = playingFileIdRef.current
+      if (!wasmMod || fileId === undefined) return
+      // [版, 範囲の数, 範囲..., 記録の数, 記録...]。空なら保存済みのものを残す
+      const data = wasmMod.exportGopIndex()
+      if (data[2 + data[1] * 2] > 0) saveGopIndex(fileId, data)
+    },
+    playMode === 'file' && persistGopIndex ? 10000 : null
+  )
+
+  const formatTime = (seconds: number) => {
+    const s = Math.floor(seconds)
+    const pad = (n: number) => String(n).padStart(2, '0')
+    return `${Math.floor(s / 3600)}:${pad(Math.floor(s / 60) % 60)}:${pad(s % 60)}`
+  }
+
   useKey(
     'F2',
     () => {
@@ -397,7 +582,11 @@ const Page: NextPage = () => {
       const ctx = canvas.getContext('2d')!
       ctx.drawImage(video, 0, 0)
       if (showCaption) {
-        ctx.drawImage(caption, 0, 0)
+        // 映像はcanvas内で16:9にレターボックスされている
+        const scale = Math.min(canvas.width / caption.width, canvas.height / caption.height)
+        const w = caption.width * scale
+        const h = caption.height * scale
+        ctx.drawImage(caption, (canvas.width - w) / 2, (canvas.height - h) / 2, w, h)
       }
       const a = document.createElement('a')
       a.href = canvas.toDataURL('image/png')
@@ -604,6 +793,110 @@ const Page: NextPage = () => {
               <MenuItem value={1}>副</MenuItem>
             </Select>
           </FormControl>
+          <FormControl
+            fullWidth
+            css={css`
+              margin-top: 24px;
+              width: 100%;
+            `}
+          >
+            <InputLabel id="scalefilter-label">拡大縮小フィルタ</InputLabel>
+            <Select
+              css={css`
+                width: 100%;
+              `}
+              label="拡大縮小フィルタ"
+              labelId="scalefilter-label"
+              value={scaleFilter}
+              onChange={ev => {
+                if (ev.target.value !== null && typeof ev.target.value === 'number') {
+                  setScaleFilter(ev.target.value)
+                }
+              }}
+            >
+              <MenuItem value={0}>バイリニア</MenuItem>
+              <MenuItem value={1}>バイキュービック</MenuItem>
+            </Select>
+          </FormControl>
+          <FormControl
+            fullWidth
+            css={css`
+              margin-top: 24px;
+              width: 100%;
+            `}
+          >
+            <InputLabel id="sharpness-label">シャープネス</InputLabel>
+            <Select
+              css={css`
+                width: 100%;
+              `}
+              label="シャープネス"
+              labelId="sharpness-label"
+              value={sharpness}
+              onChange={ev => {
+                if (ev.target.value !== null && typeof ev.target.value === 'number') {
+                  setSharpness(ev.target.value)
+                }
+              }}
+            >
+              <MenuItem value={0}>なし</MenuItem>
+              <MenuItem value={0.25}>弱</MenuItem>
+              <MenuItem value={0.5}>強</MenuItem>
+            </Select>
+          </FormControl>
+          <FormControl
+            fullWidth
+            css={css`
+              margin-top: 24px;
+              width: 100%;
+            `}
+          >
+            <InputLabel id="qualitytier-label">デコード品質</InputLabel>
+            <Select
+              css={css`
+                width: 100%;
+              `}
+              label="デコード品質"
+              labelId="qualitytier-label"
+              value={qualityTier}
+              onChange={ev => {
+                if (ev.target.value !== null && typeof ev.target.value === 'number') {
+                  setQualityTier(ev.target.value)
+                }
+              }}
+            >
+              <MenuItem value={0}>通常</MenuItem>
+              <MenuItem value={1}>省電力</MenuItem>
+              <MenuItem value={2}>1/2解像度</MenuItem>
+              <MenuItem value={3}>1/4解像度</MenuItem>
+            </Select>
+          </FormControl>
+          <Stack
+            direction="row"
+            alignItems="center"
+            justifyContent="space-between"
+            css={css`
+              margin-top: 8px;
+              font-size: 12px;
+            `}
+          >
+            <div>
+              {capabilityProbe
+                ? `自動判定: デコード ${capabilityProbe.videoDecodeMs.toFixed(1)}ms / ` +
+                  `描画 ${capabilityProbe.rendererFrameMs.toFixed(1)}ms` +
+                  (capabilityProbe.softwareRenderer ? '(CPU)' : '') +
+                  ` / スレッド ${capabilityProbe.decodeThreads}`
+                : '自動判定: 測定中'}
+            </div>
+            <Button
+              size="small"
+              onClick={() => {
+                removeCapabilityProbe()
+              }}
+            >
+              再判定
+            </Button>
+          </Stack>
           <FormGroup>
             <FormControlLabel
               control={
@@ -616,6 +909,28 @@ const Page: NextPage = () => {
               }
               label="字幕を表示する"
             ></FormControlLabel>
+            <FormControlLabel
+              control={
+                <Checkbox
+                  checked={deinterlace}
+                  onChange={ev => {
+                    setDeinterlace(ev.target.checked)
+                  }}
+                ></Checkbox>
+              }
+              label="インターレースを解除する"
+            ></FormControlLabel>
+            <FormControlLabel
+              control={
+                <Checkbox
+                  checked={chromaPacking}
+                  onChange={ev => {
+                    setChromaPacking(ev.target.checked)
+                  }}
+                ></Checkbox>
+              }
+              label="色差プレーンをまとめて転送する(NV12)"
+            ></FormControlLabel>
           </FormGroup>
           {debug ? (
             <div>
@@ -698,6 +1013,63 @@ const Page: NextPage = () => {
                   </Select>
                 </FormControl>
               </FormGroup>
+              {playMode === 'file' && recordingTime && recordingTime.duration > 0 && (
+                <FormGroup>
+                  <FormControl
+                    fullWidth
+                    css={css`
+                      margin-top: 24px;
+                      width: 100%;
+                    `}
+                  >
+                    <Slider
+                      aria-label="再生位置"
+                      min={0}
+                      max={recordingTime.duration}
+                      step={1}
+                      value={
+                        seekingPosition ??
+                        (isNaN(recordingTime.position) ? 0 : recordingTime.position)
+                      }
+                      valueLabelDisplay="auto"
+                      valueLabelFormat={formatTime}
+                      onChange={(ev, val) => {
+                        if (typeof val !== 'number') return
+                        setSeekingPosition(val)
+                        // ダウンロード済みの範囲なら、ドラッグ中もその位置の映像を出す
+                        const now = performance.now()
+                        if (now - lastScrubRef.current > 300) {
+                          lastScrubRef.current = now
+                          wasmMod?.scrub(val)
+                        }
+                      }}
+                      onChangeCommitted={(ev, val) => {
+                        if (typeof val === 'number') wasmMod?.seek(val)
+                        setSeekingPosition(undefined)
+                      }}
+                    />
+                    <Stack spacing={1} direction="row" alignItems="center">
+                      <Button size="small" variant="outlined" onClick={() => stepTrickPlayRate(-1)}>
+                        ◀◀
+                      </Button>
+                      <Button
+                        size="small"
+                        variant={recordingTime.rate === 0 ? 'contained' : 'outlined'}
+                        onClick={() => {
+                          wasmMod?.setTrickPlayRate(0)
+                          setRecordingTime({ ...recordingTime, rate: 0 })
+                        }}
+                      >
+                        ▶
+                      </Button>
+                      <Button size="small" variant="outlined" onClick={() => stepTrickPlayRate(1)}>
+                        ▶▶
+                      </Button>
+                      <div>{recordingTime.rate !== 0 && `${recordingTime.rate}倍速`}</div>
+                    </Stack>
+                  </FormControl>
+                </FormGroup>
+              )}
               <FormGroup>
                 <FormControlLabel
                   control={
@@ -716,6 +1088,19 @@ const Page: NextPage = () => {
                   label="統計グラフを表示する"
                 ></FormControlLabel>
               </FormGroup>
+              <FormGroup>
+                <FormControlLabel
+                  control={
+                    <Checkbox
+                      checked={persistGopIndex}
+                      onChange={ev => {
+                        setPersistGopIndex(ev.target.checked)
+                      }}
+                    ></Checkbox>
+                  }
+                  label="録画ファイルのシーク用の索引を保存する"
+                ></FormControlLabel>
+              </FormGroup>
               <FormGroup>
                 <FormControlLabel
                   control={
@@ -728,6 +1113,17 @@ const Page: NextPage = () => {
                   }
                   label="デバッグログを出力する"
                 ></FormControlLabel>
+                <FormControlLabel
+                  control={
+                    <Checkbox
+                      checked={rendererCheck}
+                      onChange={ev => {
+                        setRendererCheck(ev.target.checked)
+                      }}
+                    ></Checkbox>
+                  }
+                  label="WebGPUの描画結果をCPU描画と比較する"
+                ></FormControlLabel>
               </FormGroup>
             </div>
           ) : (
@@ -747,8 +1143,8 @@ const Page: NextPage = () => {
             position: absolute;
             top: 50%;
             left: 50%;
-            max-width: 100%;
-            max-height: 100%;
+            width: 100%;
+            height: 100%;
             z-index: 1;
           `}
           id="video"
@@ -766,6 +1162,7 @@ const Page: NextPage = () => {
         <div hidden={!showCaption}>
           <Caption
             service={activeService}
+            overlay={!!showCaption}
             wasmModule={wasmMod!}
             canvasRef={captionCanvasRef}
             width={1920}
@@ -877,6 +1274,98 @@ const Page: NextPage = () => {
                 dot={false}
               />
             </LineChart>
+            <LineChart width={550} height={250} data={showCharts ? chartData : []}>
+              <CartesianGrid strokeDasharray={'3 3'} />
+              <XAxis dataKey="time" />
+              <YAxis />
+              <Legend />
+              <Line
+                type="linear"
+                dataKey="UploadMs"
+                name="Upload (ms)"
+                stroke="#8884d8"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="YadifMs"
+                name="Yadif (ms)"
+                stroke="#82ca9d"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="RenderMs"
+                name="Render (ms)"
+                stroke="#ca829d"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="PresentMs"
+                name="Present (ms)"
+                stroke="#caca82"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="VideoDecodeMs"
+                name="Decode (ms)"
+                stroke="#82caca"
+                isAnimationActive={false}
+                dot={false}
+              />
+            </LineChart>
+            <LineChart width={550} height={250} data={showCharts ? chartData : []}>
+              <CartesianGrid strokeDasharray={'3 3'} />
+              <XAxis dataKey="time" />
+              <YAxis />
+              <Legend />
+              <Line
+                type="linear"
+                dataKey="DecodedFps"
+                name="Decoded (fps)"
+                stroke="#8884d8"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="PresentedFps"
+                name="Presented (fps)"
+                stroke="#82ca9d"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="DroppedLateFps"
+                name="Dropped late (fps)"
+                stroke="#ca829d"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="SkippedFps"
+                name="Skipped (fps)"
+                stroke="#caca82"
+                isAnimationActive={false}
+                dot={false}
+              />
+              <Line
+                type="linear"
+                dataKey="RepeatedFps"
+                name="Repeated (fps)"
+                stroke="#82caca"
+                isAnimationActive={false}
+                dot={false}
+              />
+            </LineChart>
           </div>
         ) : (
           <></>
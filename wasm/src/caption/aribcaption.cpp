@@ -0,0 +1,1037 @@
+#include <algorithm>
+#include <array>
+#include <iconv.h>
+#include <map>
+#include <spdlog/spdlog.h>
+
+#include "aribcaption.hpp"
+
+// 字幕・文字スーパーのdata_identifier
+const uint8_t DATA_IDENTIFIER_CAPTION = 0x80;
+const uint8_t DATA_IDENTIFIER_SUPERIMPOSE = 0x81;
+
+// データユニットの種類
+const uint8_t DATA_UNIT_STATEMENT_BODY = 0x20;
+const uint8_t DATA_UNIT_DRCS_1BYTE = 0x30;
+const uint8_t DATA_UNIT_DRCS_2BYTE = 0x31;
+
+// 表せない文字(追加記号など)の代わりに出す「〓」
+const char *GETA_MARK = "〓";
+
+// 文字集合。エスケープシーケンスの終端符号から決まる
+enum CharsetType {
+  CHARSET_KANJI,
+  CHARSET_ALNUM,
+  CHARSET_HIRAGANA,
+  CHARSET_KATAKANA,
+  CHARSET_JISX0201_KATAKANA,
+  // JIS X 0213の第2面と追加記号。対応表を持たないので〓で表す
+  CHARSET_ADDITIONAL_SYMBOLS,
+  CHARSET_MOSAIC,
+  CHARSET_DRCS,
+  CHARSET_MACRO,
+  CHARSET_UNKNOWN,
+};
+
+struct Charset {
+  CharsetType type = CHARSET_UNKNOWN;
+  int bytes = 1;
+  // DRCS-0(2バイト)〜DRCS-15
+  int drcsSet = 0;
+};
+
+// 既定のマクロ(0x60〜0x6F)。G0〜G3の指示とGL/GRの呼び出しの組
+const std::array<std::vector<uint8_t>, 16> DEFAULT_MACROS = {{
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x4A, 0x1B, 0x2A, 0x30, 0x1B, 0x2B, 0x20,
+     0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x31, 0x1B, 0x2A, 0x30, 0x1B, 0x2B, 0x20,
+     0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x20, 0x41, 0x1B, 0x2A, 0x30, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x32, 0x1B, 0x29, 0x34, 0x1B, 0x2A, 0x35, 0x1B, 0x2B, 0x20,
+     0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x32, 0x1B, 0x29, 0x33, 0x1B, 0x2A, 0x35, 0x1B, 0x2B, 0x20,
+     0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x32, 0x1B, 0x29, 0x20, 0x41, 0x1B, 0x2A, 0x35, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x20, 0x41, 0x1B, 0x29, 0x20, 0x42, 0x1B, 0x2A, 0x20, 0x43,
+     0x1B, 0x2B, 0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x20, 0x44, 0x1B, 0x29, 0x20, 0x45, 0x1B, 0x2A, 0x20, 0x46,
+     0x1B, 0x2B, 0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x20, 0x47, 0x1B, 0x29, 0x20, 0x48, 0x1B, 0x2A, 0x20, 0x49,
+     0x1B, 0x2B, 0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x20, 0x4A, 0x1B, 0x29, 0x20, 0x4B, 0x1B, 0x2A, 0x20, 0x4C,
+     0x1B, 0x2B, 0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x20, 0x4D, 0x1B, 0x29, 0x20, 0x4E, 0x1B, 0x2A, 0x20, 0x4F,
+     0x1B, 0x2B, 0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x20, 0x42, 0x1B, 0x2A, 0x30, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x20, 0x43, 0x1B, 0x2A, 0x30, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x24, 0x42, 0x1B, 0x29, 0x20, 0x44, 0x1B, 0x2A, 0x30, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x31, 0x1B, 0x29, 0x30, 0x1B, 0x2A, 0x4A, 0x1B, 0x2B, 0x20,
+     0x70, 0x0F, 0x1B, 0x7D},
+    {0x1B, 0x28, 0x4A, 0x1B, 0x29, 0x32, 0x1B, 0x2A, 0x20, 0x41, 0x1B, 0x2B,
+     0x20, 0x70, 0x0F, 0x1B, 0x7D},
+}};
+
+// マクロの中でマクロを呼ぶ深さの上限
+const int MAX_MACRO_DEPTH = 4;
+
+// 960x540の表示面での文字の大きさと字間・行間の既定値
+const int DEFAULT_CHAR_SIZE = 36;
+const int DEFAULT_H_SPACING = 4;
+const int DEFAULT_V_SPACING = 24;
+
+// 128色のカラーマップ(0xRRGGBBAA)。
+// 0-7: 最大輝度の8色、8: 透明、9-15: 半輝度の7色、
+// 16-64: R/G/Bが0,85,170,255の組のうち残りの色、65-127: 1-63の半透明
+static std::array<uint32_t, 128> makeClut() {
+  std::array<uint32_t, 128> clut = {};
+  auto rgba = [](int r, int g, int b, int a) {
+    return static_cast<uint32_t>(r) << 24 | static_cast<uint32_t>(g) << 16 |
+           static_cast<uint32_t>(b) << 8 | static_cast<uint32_t>(a);
+  };
+  for (int i = 0; i < 8; i++) {
+    clut[i] = rgba(i & 1 ? 255 : 0, i & 2 ? 255 : 0, i & 4 ? 255 : 0, 255);
+  }
+  clut[8] = 0;
+  for (int i = 1; i < 8; i++) {
+    clut[8 + i] =
+        rgba(i & 1 ? 170 : 0, i & 2 ? 170 : 0, i & 4 ? 170 : 0, 255);
+  }
+  int index = 16;
+  auto isPrimary = [](int r, int g, int b, int level) {
+    return (r == 0 || r == level) && (g == 0 || g == level) &&
+           (b == 0 || b == level);
+  };
+  for (int r = 0; r < 256; r += 85) {
+    for (int g = 0; g < 256; g += 85) {
+      for (int b = 0; b < 256; b += 85) {
+        if (isPrimary(r, g, b, 255) || isPrimary(r, g, b, 170)) {
+          continue;
+        }
+        clut[index++] = rgba(r, g, b, 255);
+      }
+    }
+  }
+  for (int i = 65; i < 128; i++) {
+    clut[i] = (clut[i - 64] & 0xFFFFFF00) | 128;
+  }
+  return clut;
+}
+
+static uint32_t clutColor(int index) {
+  static const std::array<uint32_t, 128> clut = makeClut();
+  return clut[std::clamp(index, 0, 127)];
+}
+
+struct CaptionState {
+  iconv_t eucjp = reinterpret_cast<iconv_t>(-1);
+  // 字幕管理データのFormatから決まる表示面
+  int defaultPlaneWidth = 960;
+  int defaultPlaneHeight = 540;
+  // 受け取ったDRCSのパターン。キーは(DRCSの集合 << 16 | 文字符号)
+  std::map<int, CaptionDrcs> drcs;
+
+  // 符号の指示・呼び出し
+  std::array<Charset, 4> g;
+  int gl = 0;
+  int gr = 2;
+  int singleShift = -1;
+
+  // 書式
+  int planeWidth = 960;
+  int planeHeight = 540;
+  int areaX = 0;
+  int areaY = 0;
+  int areaWidth = 960;
+  int areaHeight = 540;
+  int charWidth = DEFAULT_CHAR_SIZE;
+  int charHeight = DEFAULT_CHAR_SIZE;
+  int hSpacing = DEFAULT_H_SPACING;
+  int vSpacing = DEFAULT_V_SPACING;
+  double scaleX = 1.0;
+  double scaleY = 1.0;
+  int palette = 0;
+  uint32_t foreground = 0;
+  uint32_t background = 0;
+  uint32_t outline = 0;
+  bool underline = false;
+  // 次の文字を繰り返す回数(0なら行末まで)
+  int repeat = 1;
+
+  // 動作位置。文字の区画の左下を指す
+  bool penValid = false;
+  int penX = 0;
+  int penY = 0;
+
+  // 画面。DRCSの文字はrun.drcsにDRCSのキーを入れておく
+  std::vector<CaptionRun> runs;
+  bool dirty = false;
+  // 文の先頭からTIMEで待った秒数
+  double offset = 0.0;
+  // 解釈中の文の出力先
+  std::vector<CaptionPage> *pages = nullptr;
+  int dataIdentifier = 0;
+  int64_t pts = 0;
+};
+
+static CaptionState state;
+
+struct ByteReader {
+  const uint8_t *data;
+  size_t size;
+  size_t pos = 0;
+
+  bool empty() const { return pos >= size; }
+  uint8_t next() { return pos < size ? data[pos++] : 0; }
+};
+
+static void appendUtf8(std::string &out, uint32_t codePoint) {
+  if (codePoint < 0x80) {
+    out += static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    out += static_cast<char>(0xC0 | (codePoint >> 6));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else {
+    out += static_cast<char>(0xE0 | (codePoint >> 12));
+    out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  }
+}
+
+static Charset charsetFromTerminator(uint8_t terminator, bool twoByte,
+                                     bool drcs) {
+  Charset charset;
+  if (drcs) {
+    if (terminator == 0x70) {
+      charset.type = CHARSET_MACRO;
+    } else if (terminator >= 0x40 && terminator <= 0x4F) {
+      charset.type = CHARSET_DRCS;
+      charset.drcsSet = terminator - 0x40;
+      charset.bytes = charset.drcsSet == 0 ? 2 : 1;
+    }
+    return charset;
+  }
+  if (twoByte) {
+    charset.bytes = 2;
+    switch (terminator) {
+    case 0x42:
+    case 0x39:
+      charset.type = CHARSET_KANJI;
+      break;
+    case 0x3A:
+    case 0x3B:
+      charset.type = CHARSET_ADDITIONAL_SYMBOLS;
+      break;
+    }
+    return charset;
+  }
+  switch (terminator) {
+  case 0x4A:
+  case 0x36:
+    charset.type = CHARSET_ALNUM;
+    break;
+  case 0x30:
+  case 0x37:
+    charset.type = CHARSET_HIRAGANA;
+    break;
+  case 0x31:
+  case 0x38:
+    charset.type = CHARSET_KATAKANA;
+    break;
+  case 0x49:
+    charset.type = CHARSET_JISX0201_KATAKANA;
+    break;
+  case 0x32:
+  case 0x33:
+  case 0x34:
+  case 0x35:
+    charset.type = CHARSET_MOSAIC;
+    break;
+  }
+  return charset;
+}
+
+static void resetCodeSets() {
+  state.g[0] = charsetFromTerminator(0x42, true, false);
+  state.g[1] = charsetFromTerminator(0x4A, false, false);
+  state.g[2] = charsetFromTerminator(0x30, false, false);
+  state.g[3] = charsetFromTerminator(0x70, false, true);
+  state.gl = 0;
+  state.gr = 2;
+  state.singleShift = -1;
+}
+
+static void resetStyle() {
+  state.scaleX = 1.0;
+  state.scaleY = 1.0;
+  state.palette = 0;
+  state.foreground = clutColor(7);
+  state.background = clutColor(8);
+  state.outline = 0;
+  state.underline = false;
+  state.repeat = 1;
+}
+
+// 表示面に合わせて表示領域・文字の大きさを既定に戻す
+static void resetLayout(int planeWidth, int planeHeight) {
+  state.planeWidth = planeWidth;
+  state.planeHeight = planeHeight;
+  state.areaX = 0;
+  state.areaY = 0;
+  state.areaWidth = planeWidth;
+  state.areaHeight = planeHeight;
+  int scale = std::max(1, planeWidth / 960);
+  state.charWidth = DEFAULT_CHAR_SIZE * scale;
+  state.charHeight = DEFAULT_CHAR_SIZE * scale;
+  state.hSpacing = DEFAULT_H_SPACING * scale;
+  state.vSpacing = DEFAULT_V_SPACING * scale;
+  state.penValid = false;
+}
+
+static int cellWidth() {
+  return std::max(
+      1, static_cast<int>((state.charWidth + state.hSpacing) * state.scaleX));
+}
+
+static int cellHeight() {
+  return std::max(
+      1, static_cast<int>((state.charHeight + state.vSpacing) * state.scaleY));
+}
+
+static void ensurePen() {
+  if (!state.penValid) {
+    state.penX = state.areaX;
+    state.penY = state.areaY + cellHeight();
+    state.penValid = true;
+  }
+}
+
+static void moveDown() {
+  ensurePen();
+  state.penY += cellHeight();
+  if (state.penY > state.areaY + state.areaHeight) {
+    state.penY = state.areaY + cellHeight();
+  }
+}
+
+static void moveUp() {
+  ensurePen();
+  state.penY -= cellHeight();
+  if (state.penY < state.areaY + cellHeight()) {
+    state.penY = state.areaY + state.areaHeight / cellHeight() * cellHeight();
+  }
+}
+
+static void moveForward() {
+  ensurePen();
+  state.penX += cellWidth();
+  if (state.penX + cellWidth() > state.areaX + state.areaWidth) {
+    state.penX = state.areaX;
+    moveDown();
+  }
+}
+
+static void moveBackward() {
+  ensurePen();
+  state.penX -= cellWidth();
+  if (state.penX < state.areaX) {
+    state.penX =
+        state.areaX + (state.areaWidth / cellWidth() - 1) * cellWidth();
+    moveUp();
+  }
+}
+
+static void moveToLineStart() {
+  ensurePen();
+  state.penX = state.areaX;
+  moveDown();
+}
+
+static void clearScreen() {
+  state.runs.clear();
+  state.dirty = true;
+}
+
+static bool sameStyle(const CaptionRun &run) {
+  return run.cellWidth == cellWidth() && run.cellHeight == cellHeight() &&
+         run.foreground == state.foreground &&
+         run.background == state.background &&
+         run.outline == state.outline && run.underline == state.underline;
+}
+
+// 動作位置に1文字置いて進める。drcsKeyが負ならtextを置く
+static void putCharOnce(const std::string &text, int drcsKey) {
+  ensurePen();
+  int x = state.penX;
+  int y = state.penY - cellHeight();
+  if (drcsKey < 0 && !state.runs.empty()) {
+    CaptionRun &last = state.runs.back();
+    if (last.drcs < 0 && last.y == y &&
+        last.x + last.length * last.cellWidth == x && sameStyle(last)) {
+      last.text += text;
+      last.length++;
+      moveForward();
+      state.dirty = true;
+      return;
+    }
+  }
+  CaptionRun run;
+  run.text = drcsKey < 0 ? text : std::string();
+  run.drcs = drcsKey;
+  run.length = 1;
+  run.x = x;
+  run.y = y;
+  run.cellWidth = cellWidth();
+  run.cellHeight = cellHeight();
+  run.charWidth = static_cast<int>(state.charWidth * state.scaleX);
+  run.charHeight = static_cast<int>(state.charHeight * state.scaleY);
+  run.foreground = state.foreground;
+  run.background = state.background;
+  run.outline = state.outline;
+  run.underline = state.underline;
+  state.runs.push_back(std::move(run));
+  moveForward();
+  state.dirty = true;
+}
+
+static void putChar(const std::string &text, int drcsKey) {
+  int repeat = state.repeat;
+  state.repeat = 1;
+  if (repeat > 0) {
+    for (int i = 0; i < repeat; i++) {
+      putCharOnce(text, drcsKey);
+    }
+    return;
+  }
+  // 0は行末まで繰り返す
+  ensurePen();
+  int y = state.penY;
+  do {
+    putCharOnce(text, drcsKey);
+  } while (state.penY == y && state.penX != state.areaX);
+}
+
+// 中サイズ・小サイズでは半角、それ以外は全角の空白
+static void putSpace() {
+  putChar(state.scaleX < 1.0 ? " " : "　", -1);
+}
+
+static std::string convertKanji(uint8_t c1, uint8_t c2) {
+  // 90区以降は追加記号
+  if (c1 >= 0x7A || state.eucjp == reinterpret_cast<iconv_t>(-1)) {
+    return GETA_MARK;
+  }
+  char in[2] = {static_cast<char>(c1 | 0x80), static_cast<char>(c2 | 0x80)};
+  char out[8];
+  char *inPtr = in;
+  char *outPtr = out;
+  size_t inLeft = sizeof(in);
+  size_t outLeft = sizeof(out);
+  if (iconv(state.eucjp, &inPtr, &inLeft, &outPtr, &outLeft) ==
+      static_cast<size_t>(-1)) {
+    return GETA_MARK;
+  }
+  return std::string(out, sizeof(out) - outLeft);
+}
+
+// 平仮名・片仮名の集合の末尾にある記号
+static uint32_t kanaSymbol(uint8_t c, bool katakana) {
+  switch (c) {
+  case 0x77:
+    return katakana ? 0x30FD : 0x309D;
+  case 0x78:
+    return katakana ? 0x30FE : 0x309E;
+  case 0x79:
+    return 0x30FC;
+  case 0x7A:
+    return 0x3002;
+  case 0x7B:
+    return 0x300C;
+  case 0x7C:
+    return 0x300D;
+  case 0x7D:
+    return 0x3001;
+  case 0x7E:
+    return 0x30FB;
+  }
+  return 0x3000;
+}
+
+static void decodeStatementBytes(ByteReader &reader, int macroDepth);
+
+static void putGraphic(const Charset &charset, uint8_t c1, ByteReader &reader,
+                       int macroDepth) {
+  uint8_t c2 = charset.bytes == 2 ? reader.next() & 0x7F : 0;
+  std::string text;
+  switch (charset.type) {
+  case CHARSET_KANJI:
+    putChar(convertKanji(c1, c2), -1);
+    break;
+  case CHARSET_ADDITIONAL_SYMBOLS:
+    putChar(GETA_MARK, -1);
+    break;
+  case CHARSET_ALNUM:
+    // ¥と‾以外はASCIIと同じ
+    if (state.scaleX < 1.0) {
+      appendUtf8(text, c1 == 0x5C ? 0xA5 : c1 == 0x7E ? 0x203E : c1);
+    } else {
+      appendUtf8(text, c1 == 0x5C   ? 0xFFE5
+                       : c1 == 0x7E ? 0xFFE3
+                                    : 0xFF01 + (c1 - 0x21));
+    }
+    putChar(text, -1);
+    break;
+  case CHARSET_HIRAGANA:
+    appendUtf8(text, c1 <= 0x73 ? 0x3041 + (c1 - 0x21) : kanaSymbol(c1, false));
+    putChar(text, -1);
+    break;
+  case CHARSET_KATAKANA:
+    appendUtf8(text, c1 <= 0x76 ? 0x30A1 + (c1 - 0x21) : kanaSymbol(c1, true));
+    putChar(text, -1);
+    break;
+  case CHARSET_JISX0201_KATAKANA:
+    appendUtf8(text, c1 <= 0x5F ? 0xFF61 + (c1 - 0x21) : 0x3000);
+    putChar(text, -1);
+    break;
+  case CHARSET_DRCS: {
+    int code = charset.bytes == 2 ? (c1 << 8 | c2) : c1;
+    putChar(std::string(), charset.drcsSet << 16 | code);
+    break;
+  }
+  case CHARSET_MACRO:
+    if (c1 >= 0x60 && c1 <= 0x6F && macroDepth < MAX_MACRO_DEPTH) {
+      const std::vector<uint8_t> &macro = DEFAULT_MACROS[c1 - 0x60];
+      ByteReader macroReader = {macro.data(), macro.size()};
+      decodeStatementBytes(macroReader, macroDepth + 1);
+    }
+    break;
+  case CHARSET_MOSAIC:
+  case CHARSET_UNKNOWN:
+    moveForward();
+    break;
+  }
+}
+
+static void designate(ByteReader &reader) {
+  uint8_t b1 = reader.next();
+  switch (b1) {
+  case 0x6E:
+    state.gl = 2;
+    return;
+  case 0x6F:
+    state.gl = 3;
+    return;
+  case 0x7E:
+    state.gr = 1;
+    return;
+  case 0x7D:
+    state.gr = 2;
+    return;
+  case 0x7C:
+    state.gr = 3;
+    return;
+  }
+  bool twoByte = b1 == 0x24;
+  uint8_t b2 = twoByte ? reader.next() : b1;
+  int index = 0;
+  if (b2 >= 0x28 && b2 <= 0x2B) {
+    index = b2 - 0x28;
+    b2 = reader.next();
+  } else if (!twoByte) {
+    return;
+  }
+  bool drcs = b2 == 0x20;
+  uint8_t terminator = drcs ? reader.next() : b2;
+  state.g[index] = charsetFromTerminator(terminator, twoByte, drcs);
+}
+
+// 文を表示面の状態にしてページにする
+static void emitPage() {
+  CaptionPage page;
+  page.dataIdentifier = state.dataIdentifier;
+  page.pts = state.pts;
+  page.offset = state.offset;
+  page.planeWidth = state.planeWidth;
+  page.planeHeight = state.planeHeight;
+  std::map<int, int> drcsIndex;
+  for (const CaptionRun &run : state.runs) {
+    CaptionRun out = run;
+    if (run.drcs >= 0) {
+      auto it = state.drcs.find(run.drcs);
+      if (it == state.drcs.end()) {
+        // 未受信のDRCSは〓にする
+        out.drcs = -1;
+        out.text = GETA_MARK;
+      } else {
+        auto [indexIt, inserted] = drcsIndex.emplace(
+            run.drcs, static_cast<int>(page.drcs.size()));
+        if (inserted) {
+          page.drcs.push_back(it->second);
+        }
+        out.drcs = indexIt->second;
+      }
+    }
+    page.runs.push_back(std::move(out));
+  }
+  state.pages->push_back(std::move(page));
+  state.dirty = false;
+}
+
+static uint32_t colorFromOrnament(int value) {
+  // 上2桁がパレット、下2桁がその中の番号
+  return clutColor(value / 100 * 16 + value % 100);
+}
+
+static void setWritingFormat(int format) {
+  switch (format) {
+  case 5:
+  case 6:
+    resetLayout(1920, 1080);
+    break;
+  case 7:
+  case 8:
+    resetLayout(960, 540);
+    break;
+  case 9:
+  case 10:
+    resetLayout(720, 480);
+    break;
+  default:
+    resetLayout(state.defaultPlaneWidth, state.defaultPlaneHeight);
+    break;
+  }
+}
+
+static void controlSequence(ByteReader &reader) {
+  std::vector<int> params;
+  int value = 0;
+  bool hasValue = false;
+  uint8_t terminator = 0;
+  while (!reader.empty()) {
+    uint8_t c = reader.next();
+    if (c >= 0x30 && c <= 0x39) {
+      value = value * 10 + (c - 0x30);
+      hasValue = true;
+    } else if (c == 0x3B || c == 0x20) {
+      if (hasValue) {
+        params.push_back(value);
+      }
+      value = 0;
+      hasValue = false;
+      if (c == 0x20) {
+        terminator = reader.next();
+        break;
+      }
+    }
+  }
+  auto param = [&](size_t i) { return i < params.size() ? params[i] : 0; };
+  switch (terminator) {
+  case 0x53: // SWF
+    setWritingFormat(param(0));
+    break;
+  case 0x56: // SDF
+    state.areaWidth = param(0);
+    state.areaHeight = param(1);
+    state.penValid = false;
+    break;
+  case 0x5F: // SDP
+    state.areaX = param(0);
+    state.areaY = param(1);
+    state.penValid = false;
+    break;
+  case 0x57: // SSM
+    state.charWidth = param(0);
+    state.charHeight = param(1);
+    break;
+  case 0x58: // SHS
+    state.hSpacing = param(0);
+    break;
+  case 0x59: // SVS
+    state.vSpacing = param(0);
+    break;
+  case 0x61: // ACPS
+    state.penX = param(0);
+    state.penY = param(1);
+    state.penValid = true;
+    break;
+  case 0x63: // ORN
+    state.outline = param(0) == 1 ? colorFromOrnament(param(1)) : 0;
+    break;
+  default:
+    spdlog::debug("caption: ignored CSI final:{:02x}", terminator);
+    break;
+  }
+}
+
+static void decodeStatementBytes(ByteReader &reader, int macroDepth) {
+  while (!reader.empty()) {
+    uint8_t c = reader.next();
+    if (c >= 0x21 && c <= 0x7E) {
+      int index = state.singleShift >= 0 ? state.singleShift : state.gl;
+      state.singleShift = -1;
+      putGraphic(state.g[index], c, reader, macroDepth);
+      continue;
+    }
+    if (c >= 0xA1 && c <= 0xFE) {
+      putGraphic(state.g[state.gr], c & 0x7F, reader, macroDepth);
+      continue;
+    }
+    switch (c) {
+    case 0x20: // SP
+    case 0x7F: // DEL
+      putSpace();
+      break;
+    case 0x08: // APB
+      moveBackward();
+      break;
+    case 0x09: // APF
+      moveForward();
+      break;
+    case 0x0A: // APD
+      moveDown();
+      break;
+    case 0x0B: // APU
+      moveUp();
+      break;
+    case 0x0C: // CS
+      clearScreen();
+      break;
+    case 0x0D: // APR
+      moveToLineStart();
+      break;
+    case 0x0E: // LS1
+      state.gl = 1;
+      break;
+    case 0x0F: // LS0
+      state.gl = 0;
+      break;
+    case 0x16: { // PAPF
+      int count = reader.next() & 0x3F;
+      for (int i = 0; i < count; i++) {
+        moveForward();
+      }
+      break;
+    }
+    case 0x19: // SS2
+      state.singleShift = 2;
+      break;
+    case 0x1D: // SS3
+      state.singleShift = 3;
+      break;
+    case 0x1B: // ESC
+      designate(reader);
+      break;
+    case 0x1C: { // APS
+      int row = reader.next() & 0x3F;
+      int column = reader.next() & 0x3F;
+      state.penX = state.areaX + column * cellWidth();
+      state.penY = state.areaY + (row + 1) * cellHeight();
+      state.penValid = true;
+      break;
+    }
+    case 0x80: // BKF〜WHF
+    case 0x81:
+    case 0x82:
+    case 0x83:
+    case 0x84:
+    case 0x85:
+    case 0x86:
+    case 0x87:
+      state.foreground = clutColor(state.palette * 16 + (c - 0x80));
+      break;
+    case 0x88: // SSZ
+      state.scaleX = state.scaleY = 0.5;
+      break;
+    case 0x89: // MSZ
+      state.scaleX = 0.5;
+      state.scaleY = 1.0;
+      break;
+    case 0x8A: // NSZ
+      state.scaleX = state.scaleY = 1.0;
+      break;
+    case 0x8B: { // SZX
+      uint8_t p = reader.next();
+      state.scaleX = p == 0x44 || p == 0x45 ? 2.0 : p == 0x60 ? 0.25 : 1.0;
+      state.scaleY = p == 0x41 || p == 0x45 ? 2.0 : p == 0x60 ? 0.25 : 1.0;
+      break;
+    }
+    case 0x90: { // COL
+      uint8_t p = reader.next();
+      if (p == 0x20) {
+        state.palette = reader.next() & 0x0F;
+      } else if ((p & 0xF0) == 0x40) {
+        state.foreground = clutColor(state.palette * 16 + (p & 0x0F));
+      } else if ((p & 0xF0) == 0x50) {
+        state.background = clutColor(state.palette * 16 + (p & 0x0F));
+      }
+      break;
+    }
+    case 0x92: // CDC
+      if (reader.next() == 0x20) {
+        reader.next();
+      }
+      break;
+    case 0x91: // FLC
+    case 0x93: // POL
+    case 0x94: // WMM
+    case 0x97: // HLC
+      reader.next();
+      break;
+    case 0x95: { // MACRO(定義は使わないので読み飛ばす)
+      reader.next();
+      while (!reader.empty()) {
+        if (reader.next() == 0x95 && reader.next() == 0x4F) {
+          break;
+        }
+      }
+      break;
+    }
+    case 0x98: // RPC
+      state.repeat = reader.next() & 0x3F;
+      break;
+    case 0x99: // SPL
+      state.underline = false;
+      break;
+    case 0x9A: // STL
+      state.underline = true;
+      break;
+    case 0x9B: // CSI
+      controlSequence(reader);
+      break;
+    case 0x9D: { // TIME
+      uint8_t p = reader.next();
+      uint8_t wait = reader.next();
+      // 待つ前に、そこまでの内容を1ページとして出す
+      if (p == 0x20) {
+        if (state.dirty) {
+          emitPage();
+        }
+        state.offset += (wait & 0x3F) / 10.0;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+static void decodeStatementBody(const uint8_t *data, size_t size,
+                                int dataIdentifier, int64_t pts,
+                                std::vector<CaptionPage> &pages) {
+  resetCodeSets();
+  resetStyle();
+  state.pages = &pages;
+  state.dataIdentifier = dataIdentifier;
+  state.pts = pts;
+  ByteReader reader = {data, size};
+  decodeStatementBytes(reader, 0);
+  if (state.dirty) {
+    emitPage();
+  }
+  state.pages = nullptr;
+}
+
+static void decodeDrcs(const uint8_t *data, size_t size, bool twoByte) {
+  ByteReader reader = {data, size};
+  int numberOfCode = reader.next();
+  for (int i = 0; i < numberOfCode && !reader.empty(); i++) {
+    int characterCode = reader.next() << 8;
+    characterCode |= reader.next();
+    int numberOfFont = reader.next();
+    int key = twoByte ? characterCode & 0x7F7F
+                      : ((characterCode >> 8) - 0x40) << 16 |
+                            (characterCode & 0x7F);
+    for (int j = 0; j < numberOfFont && !reader.empty(); j++) {
+      int mode = reader.next() & 0x0F;
+      if (mode > 1) {
+        // 幾何図形は対応しない
+        reader.next();
+        reader.next();
+        int length = reader.next() << 8;
+        length |= reader.next();
+        reader.pos += length;
+        continue;
+      }
+      int depth = reader.next();
+      int width = reader.next();
+      int height = reader.next();
+      int levels = mode == 0 ? 2 : depth + 2;
+      int bits = 1;
+      while ((1 << bits) < levels) {
+        bits++;
+      }
+      size_t bytes = (static_cast<size_t>(width) * height * bits + 7) / 8;
+      if (reader.pos + bytes > reader.size) {
+        return;
+      }
+      CaptionDrcs drcs;
+      drcs.width = width;
+      drcs.height = height;
+      drcs.alpha.resize(static_cast<size_t>(width) * height);
+      const uint8_t *pattern = data + reader.pos;
+      for (size_t p = 0; p < drcs.alpha.size(); p++) {
+        int value = 0;
+        for (int b = 0; b < bits; b++) {
+          size_t bit = p * bits + b;
+          value = value << 1 | ((pattern[bit / 8] >> (7 - bit % 8)) & 1);
+        }
+        drcs.alpha[p] =
+            static_cast<uint8_t>(std::min(value, levels - 1) * 255 /
+                                 (levels - 1));
+      }
+      reader.pos += bytes;
+      // 複数の階調がある場合は最初のものを使う
+      if (j == 0) {
+        state.drcs[key] = std::move(drcs);
+      }
+    }
+  }
+}
+
+// データユニットの並びを処理する
+static void decodeDataUnits(const uint8_t *data, size_t size,
+                            int dataIdentifier, int64_t pts,
+                            std::vector<CaptionPage> &pages) {
+  size_t pos = 0;
+  while (pos + 5 <= size) {
+    if (data[pos] != 0x1F) {
+      break;
+    }
+    uint8_t parameter = data[pos + 1];
+    size_t unitSize = data[pos + 2] << 16 | data[pos + 3] << 8 | data[pos + 4];
+    pos += 5;
+    if (pos + unitSize > size) {
+      break;
+    }
+    switch (parameter) {
+    case DATA_UNIT_STATEMENT_BODY:
+      decodeStatementBody(data + pos, unitSize, dataIdentifier, pts, pages);
+      break;
+    case DATA_UNIT_DRCS_1BYTE:
+      decodeDrcs(data + pos, unitSize, false);
+      break;
+    case DATA_UNIT_DRCS_2BYTE:
+      decodeDrcs(data + pos, unitSize, true);
+      break;
+    default:
+      spdlog::debug("caption: ignored data unit:{:02x}", parameter);
+      break;
+    }
+    pos += unitSize;
+  }
+}
+
+static bool decodeManagement(const uint8_t *data, size_t size,
+                             int dataIdentifier, int64_t pts,
+                             std::vector<CaptionPage> &pages) {
+  ByteReader reader = {data, size};
+  int tmd = reader.next() >> 6;
+  if (tmd == 0x02) {
+    reader.pos += 5;
+  }
+  int numLanguages = reader.next();
+  for (int i = 0; i < numLanguages && !reader.empty(); i++) {
+    int dmf = reader.next() & 0x0F;
+    if (dmf >= 0x0C && dmf <= 0x0E) {
+      reader.next();
+    }
+    reader.pos += 3;
+    uint8_t format = reader.next();
+    // 第1言語の表示書式だけを使う
+    if (i == 0) {
+      if ((format >> 2 & 0x03) != 0) {
+        spdlog::debug("caption: unsupported TCS");
+        return false;
+      }
+      int width = (format >> 4) < 2 ? 960 : 720;
+      int height = (format >> 4) < 2 ? 540 : 480;
+      if (width != state.defaultPlaneWidth ||
+          height != state.defaultPlaneHeight) {
+        state.defaultPlaneWidth = width;
+        state.defaultPlaneHeight = height;
+        resetLayout(width, height);
+      }
+    }
+  }
+  size_t loopLength = reader.next() << 16;
+  loopLength |= reader.next() << 8;
+  loopLength |= reader.next();
+  if (reader.pos + loopLength > size) {
+    return false;
+  }
+  decodeDataUnits(data + reader.pos, loopLength, dataIdentifier, pts, pages);
+  return true;
+}
+
+static bool decodeStatement(const uint8_t *data, size_t size,
+                            int dataIdentifier, int64_t pts,
+                            std::vector<CaptionPage> &pages) {
+  ByteReader reader = {data, size};
+  int tmd = reader.next() >> 6;
+  if (tmd == 0x01 || tmd == 0x02) {
+    reader.pos += 5;
+  }
+  size_t loopLength = reader.next() << 16;
+  loopLength |= reader.next() << 8;
+  loopLength |= reader.next();
+  if (reader.pos + loopLength > size) {
+    return false;
+  }
+  state.offset = 0.0;
+  decodeDataUnits(data + reader.pos, loopLength, dataIdentifier, pts, pages);
+  return true;
+}
+
+void resetCaptionDecoder() {
+  if (state.eucjp == reinterpret_cast<iconv_t>(-1)) {
+    state.eucjp = iconv_open("UTF-8", "EUC-JP");
+    if (state.eucjp == reinterpret_cast<iconv_t>(-1)) {
+      spdlog::error("iconv_open(EUC-JP) failed");
+    }
+  }
+  state.defaultPlaneWidth = 960;
+  state.defaultPlaneHeight = 540;
+  state.drcs.clear();
+  state.runs.clear();
+  state.dirty = false;
+  state.offset = 0.0;
+  resetCodeSets();
+  resetStyle();
+  resetLayout(state.defaultPlaneWidth, state.defaultPlaneHeight);
+}
+
+bool decodeCaptionPes(const uint8_t *data, size_t size, int64_t pts,
+                      std::vector<CaptionPage> &pages) {
+  if (size < 3) {
+    return false;
+  }
+  uint8_t dataIdentifier = data[0];
+  if (dataIdentifier != DATA_IDENTIFIER_CAPTION &&
+      dataIdentifier != DATA_IDENTIFIER_SUPERIMPOSE) {
+    return false;
+  }
+  size_t pos = 3 + (data[2] & 0x0F);
+  // data_group: id(6) version(2), link_number, last_link_number, size(16)
+  if (pos + 5 > size) {
+    return false;
+  }
+  int groupId = (data[pos] >> 2) & 0x0F;
+  size_t groupSize = data[pos + 3] << 8 | data[pos + 4];
+  pos += 5;
+  if (pos + groupSize > size) {
+    return false;
+  }
+  if (groupId == 0) {
+    return decodeManagement(data + pos, groupSize, dataIdentifier, pts, pages);
+  }
+  // 第1言語の字幕文だけを扱う
+  if (groupId != 1) {
+    return true;
+  }
+  return decodeStatement(data + pos, groupSize, dataIdentifier, pts, pages);
+}
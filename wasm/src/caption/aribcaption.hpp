@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ARIB STD-B24の字幕・文字スーパーのPESを解釈して、そのまま描ける
+// ページ(文字の配置・色・DRCSのビットマップ)にする。
+// 画面の状態は文をまたいで持ち越すので、デコーダのスレッドから順に渡す
+
+// DRCS(外字)のパターン。alphaは1画素1バイト(0-255)
+struct CaptionDrcs {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> alpha;
+};
+
+// 同じ行・同じ書式で並んだ文字。1文字ずつ幅cellWidthの区画に置く
+struct CaptionRun {
+  // UTF-8。DRCSの場合は空
+  std::string text;
+  // CaptionPage::drcsの番号(DRCSでなければ-1)
+  int drcs = -1;
+  // 文字数(DRCSの場合は1)
+  int length = 0;
+  // 先頭の文字の区画の左上(表示面の座標)
+  int x = 0;
+  int y = 0;
+  // 1文字分の区画(字間・行間を含む)と文字そのものの大きさ
+  int cellWidth = 0;
+  int cellHeight = 0;
+  int charWidth = 0;
+  int charHeight = 0;
+  // RGBA(0xRRGGBBAA)。縁取りが無ければoutlineは0
+  uint32_t foreground = 0;
+  uint32_t background = 0;
+  uint32_t outline = 0;
+  bool underline = false;
+};
+
+struct CaptionPage {
+  // 0x80: 字幕, 0x81: 文字スーパー
+  int dataIdentifier = 0;
+  // PESのPTS(ストリームのtime_base)と、そこから表示するまでの秒数(TIME)
+  int64_t pts = 0;
+  double offset = 0.0;
+  // 表示面の大きさ。runsの座標はこの中で表す
+  int planeWidth = 0;
+  int planeHeight = 0;
+  // 空なら字幕を消す
+  std::vector<CaptionRun> runs;
+  std::vector<CaptionDrcs> drcs;
+};
+
+void resetCaptionDecoder();
+// PESのペイロード(data_identifierから)を解釈し、出来たページを追加する。
+// 解釈できなかった場合はfalseを返す
+bool decodeCaptionPes(const uint8_t *data, size_t size, int64_t pts,
+                      std::vector<CaptionPage> &pages);
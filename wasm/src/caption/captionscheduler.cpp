@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <spdlog/spdlog.h>
+
+#include "captionscheduler.hpp"
+
+// これより大きく再生位置が飛んだら、持っているページを捨てる
+const double CAPTION_CLOCK_JUMP_SEC = 1.0;
+
+struct CaptionSchedulerState {
+  CaptionQueue queue;
+  // 使っていないバッファと、前回JSに渡したバッファ
+  std::vector<std::vector<uint8_t>> freeBuffers;
+  std::vector<std::vector<uint8_t>> deliveredBuffers;
+};
+
+static CaptionSchedulerState state;
+
+void scheduleCaptionPage(CaptionQueue &queue, TimedCaptionPage &&page) {
+  // 同じ時刻のページは来た順に並べる
+  auto it = std::upper_bound(
+      queue.pending.begin(), queue.pending.end(), page.time,
+      [](double time, const TimedCaptionPage &p) { return time < p.time; });
+  queue.pending.insert(it, std::move(page));
+}
+
+// 表示中の字幕を消すための空のページを、すぐに渡すように入れる
+static void invalidatePending(CaptionQueue &queue) {
+  queue.pending.clear();
+  TimedCaptionPage blank = {-INFINITY, CaptionPage()};
+  queue.pending.push_back(std::move(blank));
+}
+
+void updateCaptionQueueClock(CaptionQueue &queue, double clockOffset) {
+  double previous = queue.clockOffset;
+  queue.clockOffset = clockOffset;
+  if (std::isnan(previous) || std::isnan(clockOffset)) {
+    return;
+  }
+  if (std::abs(clockOffset - previous) > CAPTION_CLOCK_JUMP_SEC) {
+    spdlog::info("caption clock jumped {:.3f}s, drop {} pending pages",
+                 clockOffset - previous, queue.pending.size());
+    invalidatePending(queue);
+  }
+}
+
+void takeDueCaptionPages(CaptionQueue &queue, double playTime,
+                         std::vector<TimedCaptionPage> &pages) {
+  while (!queue.pending.empty() && queue.pending.front().time <= playTime) {
+    pages.push_back(std::move(queue.pending.front()));
+    queue.pending.pop_front();
+  }
+}
+
+void clearCaptionQueue(CaptionQueue &queue) {
+  queue.clockOffset = NAN;
+  invalidatePending(queue);
+}
+
+void scheduleCaptionPage(TimedCaptionPage &&page) {
+  scheduleCaptionPage(state.queue, std::move(page));
+}
+
+void updateCaptionSchedulerClock(double clockOffset) {
+  updateCaptionQueueClock(state.queue, clockOffset);
+}
+
+void takeDueCaptionPages(double playTime,
+                         std::vector<TimedCaptionPage> &pages) {
+  takeDueCaptionPages(state.queue, playTime, pages);
+}
+
+void clearCaptionScheduler() {
+  //
+  clearCaptionQueue(state.queue);
+}
+
+size_t getScheduledCaptionCount() {
+  //
+  return state.queue.pending.size();
+}
+
+void beginCaptionDelivery() {
+  for (auto &buffer : state.deliveredBuffers) {
+    state.freeBuffers.push_back(std::move(buffer));
+  }
+  state.deliveredBuffers.clear();
+}
+
+uint8_t *allocateCaptionBuffer(size_t size) {
+  // 足りる中で一番小さいもの、無ければ一番大きいものを広げて使う
+  auto best = state.freeBuffers.end();
+  for (auto it = state.freeBuffers.begin(); it != state.freeBuffers.end();
+       ++it) {
+    if (best == state.freeBuffers.end()) {
+      best = it;
+      continue;
+    }
+    bool fits = it->capacity() >= size;
+    bool bestFits = best->capacity() >= size;
+    if ((fits && (!bestFits || it->capacity() < best->capacity())) ||
+        (!fits && !bestFits && it->capacity() > best->capacity())) {
+      best = it;
+    }
+  }
+  std::vector<uint8_t> buffer;
+  if (best != state.freeBuffers.end()) {
+    buffer = std::move(*best);
+    state.freeBuffers.erase(best);
+  }
+  buffer.resize(size);
+  // 中身のメモリは動かないので、vectorごと移してもポインタは使える
+  uint8_t *data = buffer.data();
+  state.deliveredBuffers.push_back(std::move(buffer));
+  return data;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "aribcaption.hpp"
+
+// 字幕のページを表示する再生位置まで持っておき、来た分をまとめて渡す。
+// CaptionQueueを引数に取らないものはJSに渡す分で、メインスレッドからだけ使う
+
+// 表示する再生位置(秒)を付けたページ
+struct TimedCaptionPage {
+  double time;
+  CaptionPage page;
+};
+
+// 表示待ちのページ。使うスレッドごとに持つ
+struct CaptionQueue {
+  // timeの昇順
+  std::deque<TimedCaptionPage> pending;
+  double clockOffset = NAN;
+};
+
+void scheduleCaptionPage(CaptionQueue &queue, TimedCaptionPage &&page);
+// 再生位置と壁時計の差(NaNなら時計が無い)を毎回渡す。
+// 差が飛んだら持っているページは別の時間軸のものなので捨て、
+// 表示中の字幕を消すための空のページを代わりに入れる
+void updateCaptionQueueClock(CaptionQueue &queue, double clockOffset);
+// 再生位置がplayTimeまでに来たページを表示順にpagesへ移す
+void takeDueCaptionPages(CaptionQueue &queue, double playTime,
+                         std::vector<TimedCaptionPage> &pages);
+// reset()のように時間軸が変わる場合に、持っているページを捨てる
+void clearCaptionQueue(CaptionQueue &queue);
+
+void scheduleCaptionPage(TimedCaptionPage &&page);
+void updateCaptionSchedulerClock(double clockOffset);
+void takeDueCaptionPages(double playTime, std::vector<TimedCaptionPage> &pages);
+void clearCaptionScheduler();
+size_t getScheduledCaptionCount();
+
+// JSに渡すDRCSのビットマップを置くバッファ。JSのビューが指しているので、
+// 渡したバッファは次に渡すまで再利用しない。
+// beginCaptionDeliveryで前回渡したバッファをプールに戻してから確保する
+void beginCaptionDelivery();
+uint8_t *allocateCaptionBuffer(size_t size);
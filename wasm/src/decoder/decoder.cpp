@@ -1,16 +1,33 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <deque>
 #include <emscripten/bind.h>
 #include <emscripten/emscripten.h>
-#include <emscripten/fetch.h>
 #include <emscripten/val.h>
 #include <mutex>
 #include <spdlog/spdlog.h>
 #include <thread>
 
 #include "../audio/audioworklet.hpp"
+#include "../caption/aribcaption.hpp"
+#include "../caption/captionscheduler.hpp"
+#include "../util/playbackstats.hpp"
+#include "../util/rollingwindow.hpp"
+#include "../util/startup.hpp"
+#include "../util/trace.hpp"
+#include "../video/framescheduler.hpp"
+#include "../video/masterclock.hpp"
+#include "../video/renderer.hpp"
 #include "../video/webgpu.hpp"
+#include "downloader.hpp"
+#include "framepool.hpp"
+#include "gopindex.hpp"
+#include "probe.hpp"
+#include "seeker.hpp"
+#include "trickplay.hpp"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -39,6 +56,17 @@ std::chrono::system_clock::time_point startTime;
 
 bool resetedDecoder = false;
 std::uint8_t inputBuffer[MAX_INPUT_BUFFER];
+// 録画ファイルを最後まで受け取った(inputBufferMtxで守る)
+bool inputEnded = false;
+// デコード中(シークできる状態)か
+std::atomic<bool> decodePhase = false;
+// メインスレッドでシーク先が決まったら入れ、デコーダスレッドが
+// 溜まっているデータを捨てたらseekRestartOffsetに移す
+std::atomic<int64_t> pendingSeekOffset = -1;
+std::atomic<int64_t> seekRestartOffset = -1;
+// シークで捨てたら増やす。映像・音声のデコーダは、パケットと一緒に
+// 受け取った値が変わっていたら自分のスレッドでデコーダを空にする
+int decoderFlushGeneration = 0;
 std::mutex inputBufferMtx;
 std::condition_variable waitCv;
 
@@ -50,7 +78,9 @@ AVCodecContext *videoCodecContext = nullptr;
 AVCodecContext *audioCodecContext = nullptr;
 
 std::deque<AVFrame *> videoFrameQueue, audioFrameQueue;
-std::deque<std::pair<int64_t, std::vector<uint8_t>>> captionDataQueue;
+// 字幕はデコーダのスレッドで解釈し、表示する再生位置を付けたページにして
+// メインスレッド(JSに渡す)か描画スレッド(映像に重ねる)に渡す
+std::deque<TimedCaptionPage> captionPageQueue, captionOverlayQueue;
 std::mutex videoFrameMtx, audioFrameMtx, captionDataMtx;
 bool videoFrameFound = false;
 
@@ -65,24 +95,30 @@ AVStream *captionStream = nullptr;
 int64_t initPts = -1;
 
 emscripten::val captionCallback = emscripten::val::null();
-
-std::string playFileUrl;
-std::thread downloaderThread;
-
-bool resetedDownloader = false;
+std::atomic<bool> captionOverlay = false;
+// reset()で捨てたページが表示に残らないよう、受け取る側のスレッドで消させる
+std::atomic<bool> captionOverlayResetPending = false;
+std::atomic<bool> captionSchedulerResetPending = false;
+bool captionOverlayShown = false;
+// 映像に重ねる字幕を表示する時刻順に並べたもの(描画スレッドだけが触る)と、
+// 統計のためのその数
+CaptionQueue captionOverlaySchedule;
+std::atomic<size_t> captionOverlayCount = 0;
 
 std::vector<emscripten::val> statsBuffer;
 
 emscripten::val statsCallback = emscripten::val::null();
 
-const size_t donwloadRangeSize = 2 * 1024 * 1024;
-size_t downloadCount = 0;
-
 // Callback register
 void setCaptionCallback(emscripten::val callback) {
   captionCallback = callback;
 }
 
+void setCaptionOverlay(bool enabled) {
+  //
+  captionOverlay = enabled;
+}
+
 void setStatsCallback(emscripten::val callback) {
   //
   statsCallback = callback;
@@ -96,8 +132,214 @@ void setDualMonoMode(int mode) {
   dualMonoMode = (DualMonoMode)mode;
 }
 
+// 音声デコーダを開けなかった場合は音声パケットをキューに入れない
+std::atomic<bool> audioDecoderFailed = false;
+
+// U/VプレーンをNV12形式に詰め直してからキューに入れるか
+std::atomic<bool> chromaPacking = false;
+
+void setChromaPacking(bool enabled) {
+  //
+  chromaPacking = enabled;
+}
+
+// デコードの画質の段階。マルチビューやPiP、バッテリー駆動時に負荷を下げる
+enum QualityTier {
+  QUALITY_FULL = 0,
+  // Bフレームの逆DCTを省く(解像度はそのまま)
+  QUALITY_FAST = 1,
+  // lowresで1/2、1/4の解像度にデコードする
+  QUALITY_HALF = 2,
+  QUALITY_QUARTER = 3,
+  QUALITY_TIER_COUNT = 4,
+};
+
+// 組み込んでいる映像デコーダはMPEG-2だけで、ループフィルタが無いので
+// skip_loop_filterは使わない
+struct QualityTierParams {
+  int lowres;
+  AVDiscard skipIdct;
+};
+
+const QualityTierParams QUALITY_TIER_PARAMS[QUALITY_TIER_COUNT] = {
+    {0, AVDISCARD_DEFAULT},
+    {0, AVDISCARD_NONREF},
+    {1, AVDISCARD_DEFAULT},
+    {2, AVDISCARD_DEFAULT},
+};
+
+// UIから要求された段階と、デコーダに実際に適用されている段階。
+// lowresはコーデックを開いた後には変えられないので、次のキーフレームで
+// デコーダを開き直して切り替える
+std::atomic<int> requestedQualityTier = QUALITY_FULL;
+std::atomic<int> activeQualityTier = QUALITY_FULL;
+
+void setQualityTier(int tier) {
+  if (tier < 0 || tier >= QUALITY_TIER_COUNT) {
+    return;
+  }
+  requestedQualityTier = tier;
+}
+
+// 映像1パケットあたりのデコード時間(ms)。段階ごとの負荷の比較用
+std::mutex videoDecodeTimingMtx;
+RollingWindow<120> videoDecodeMs;
+
+// 映像デコーダのスライス並列のスレッド数。
+// 変更は段階の切り替えと同じく次のキーフレームでデコーダを開き直して適用する
+std::atomic<int> decodeThreads = 1;
+std::atomic<int> activeDecodeThreads = 1;
+
+void setDecodeThreads(int threads) {
+  //
+  decodeThreads = std::clamp(threads, 1, 8);
+}
+
+// デコード済みの映像フレームを先読みしておく数
+std::atomic<int> videoQueueDepth = 30;
+
+void setVideoQueueDepth(int depth) {
+  //
+  videoQueueDepth = std::clamp(depth, 10, 120);
+}
+
+// タブが隠れている間は映像をキーフレームだけデコードし、描画もしない。
+// 音声はそのまま再生を続ける
+std::atomic<bool> backgroundMode = false;
+// 映像デコーダに適用済みかどうか(映像デコーダのスレッドだけが触る)
+bool videoBackground = false;
+// 表示に戻った直後の1枚目。隠れている間に残しておいた最新のキーフレームで、
+// 次のフレームがまだ無ければ表示時刻を過ぎていてもすぐに出る
+std::atomic<bool> videoResyncPending = false;
+
+// 早送り・巻き戻しの間は、キーフレームだけを入力に書き込んで映像だけデコードし、
+// 時計に合わせずに届いた順に表示する
+std::atomic<bool> trickPlayMode = false;
+// 映像デコーダに適用済みかどうか(映像デコーダのスレッドだけが触る)。
+// 切り替えは必ずシークと同じく入力を空にしてから行う
+bool videoTrickPlay = false;
+
+static AVDiscard videoSkipFrame() {
+  return videoBackground || videoTrickPlay ? AVDISCARD_NONKEY
+                                           : AVDISCARD_DEFAULT;
+}
+
+void setBackgroundMode(bool enabled) {
+  if (backgroundMode.exchange(enabled) == enabled) {
+    return;
+  }
+  spdlog::info("background mode: {}", enabled);
+  if (!enabled) {
+    videoResyncPending = true;
+  }
+}
+
+// 起動時の負荷測定。再生が始まってから暖機した後の一定時間を測る
+enum CapabilityProbeState {
+  PROBE_IDLE,
+  PROBE_WAITING,
+  PROBE_WARMUP,
+  PROBE_MEASURING,
+};
+
+const double PROBE_WARMUP_MS = 2000.0;
+const double PROBE_MEASURE_MS = 5000.0;
+
+CapabilityProbeState probeState = PROBE_IDLE;
+double probeStateStart = 0.0;
+emscripten::val probeCallback = emscripten::val::null();
+// 音声の変換にかかった時間と変換したサンプル数(48kHz)
+double audioProcessMs = 0.0;
+int64_t audioProcessSamples = 0;
+
+void startCapabilityProbe(emscripten::val callback) {
+  probeCallback = callback;
+  // 一番重い設定で測る
+  setQualityTier(QUALITY_FULL);
+  setDeinterlace(true);
+  decodeThreads = 1;
+  probeState = PROBE_WAITING;
+  spdlog::info("capability probe requested");
+}
+
+static void finishCapabilityProbe() {
+  CapabilityMeasurement m;
+  {
+    std::lock_guard<std::mutex> lock(videoDecodeTimingMtx);
+    m.videoDecodeMs = videoDecodeMs.mean();
+  }
+  m.rendererFrameMs = getRendererFrameMs();
+  m.softwareRenderer = isSoftwareRenderer();
+  m.audioMsPerSecond =
+      audioProcessSamples ? audioProcessMs / audioProcessSamples * 48000 : 0.0;
+  m.contentFps = getFrameSchedulerStats().contentFps;
+  m.hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+  CapabilitySettings settings = chooseCapabilitySettings(m);
+
+  setQualityTier(settings.qualityTier);
+  setDeinterlace(settings.deinterlace);
+  setDecodeThreads(settings.decodeThreads);
+  setVideoQueueDepth(settings.videoQueueDepth);
+
+  if (!probeCallback.isNull()) {
+    auto result = emscripten::val::object();
+    result.set("videoDecodeMs", m.videoDecodeMs);
+    result.set("rendererFrameMs", m.rendererFrameMs);
+    result.set("softwareRenderer", m.softwareRenderer);
+    result.set("audioMsPerSecond", m.audioMsPerSecond);
+    result.set("contentFps", m.contentFps);
+    result.set("hardwareThreads", m.hardwareThreads);
+    result.set("qualityTier", settings.qualityTier);
+    result.set("decodeThreads", settings.decodeThreads);
+    result.set("deinterlace", settings.deinterlace);
+    result.set("videoQueueDepth", settings.videoQueueDepth);
+    probeCallback(result);
+  }
+  probeCallback = emscripten::val::null();
+}
+
+static void updateCapabilityProbe() {
+  double now = emscripten_get_now();
+  switch (probeState) {
+  case PROBE_IDLE:
+    break;
+  case PROBE_WAITING:
+    if (backgroundMode) {
+      break;
+    }
+    // 最初のフレームが出て、FULLで開き直された後から数える
+    if (hasPresentedFrame() && activeQualityTier == QUALITY_FULL &&
+        activeDecodeThreads == 1) {
+      probeState = PROBE_WARMUP;
+      probeStateStart = now;
+    }
+    break;
+  case PROBE_WARMUP:
+  case PROBE_MEASURING:
+    // 隠れている間は描画しないので測り直す
+    if (backgroundMode) {
+      probeState = PROBE_WAITING;
+      break;
+    }
+    if (probeState == PROBE_WARMUP &&
+        now - probeStateStart >= PROBE_WARMUP_MS) {
+      audioProcessMs = 0.0;
+      audioProcessSamples = 0;
+      probeState = PROBE_MEASURING;
+      probeStateStart = now;
+    } else if (probeState == PROBE_MEASURING &&
+               now - probeStateStart >= PROBE_MEASURE_MS) {
+      probeState = PROBE_IDLE;
+      finishCapabilityProbe();
+    }
+    break;
+  }
+}
+
 // Buffer control
-emscripten::val getNextInputBuffer(size_t nextSize) {
+// 入力バッファの書き込み位置にnextSizeバイトの空きを作って返す。
+// 足りなければnullptr。書き込んだらcommitInputDataを呼ぶ
+static uint8_t *reserveInputData(size_t nextSize) {
   std::lock_guard<std::mutex> lock(inputBufferMtx);
   if (inputBufferWriteIndex + nextSize >= MAX_INPUT_BUFFER &&
       inputBufferReadIndex > 0) {
@@ -107,23 +349,33 @@ emscripten::val getNextInputBuffer(size_t nextSize) {
     inputBufferWriteIndex = remainSize;
   }
   if (inputBufferWriteIndex + nextSize >= MAX_INPUT_BUFFER) {
+    return nullptr;
+  }
+  return &inputBuffer[inputBufferWriteIndex];
+}
+
+emscripten::val getNextInputBuffer(size_t nextSize) {
+  uint8_t *buffer = reserveInputData(nextSize);
+  if (!buffer) {
     spdlog::error("Buffer overflow");
     return emscripten::val::null();
   }
-  auto retVal = emscripten::val(emscripten::typed_memory_view<uint8_t>(
-      nextSize, &inputBuffer[inputBufferWriteIndex]));
-  waitCv.notify_all();
-  return retVal;
+  return emscripten::val(
+      emscripten::typed_memory_view<uint8_t>(nextSize, buffer));
 }
 
 int read_packet(void *opaque, uint8_t *buf, int bufSize) {
   std::unique_lock<std::mutex> lock(inputBufferMtx);
   waitCv.wait(lock, [&] {
     return inputBufferWriteIndex - inputBufferReadIndex >= bufSize ||
-           resetedDecoder;
+           inputEnded || resetedDecoder || pendingSeekOffset >= 0;
   });
   if (resetedDecoder) {
-    spdlog::debug("resetedDecoder detected in read_packet");
+    TRACE("resetedDecoder detected in read_packet");
+    return -1;
+  }
+  if (pendingSeekOffset >= 0) {
+    TRACE("seek detected in read_packet");
     return -1;
   }
 
@@ -150,9 +402,11 @@ int read_packet(void *opaque, uint8_t *buf, int bufSize) {
   }
 
   // servicefilterに1パケット（188バイト）だけ入れたからといって、
-  // 出てくるのは1パケットとは限らない。色々追加される可能性がある
+  // 出てくるのは1パケットとは限らない。色々追加される可能性がある。
+  // 終わりまで受け取っていたら最後のパケットまで入れる
   while (!servicefilterRemain &&
-         inputBufferReadIndex + 188 < inputBufferWriteIndex) {
+         (inputEnded ? inputBufferReadIndex + 188 <= inputBufferWriteIndex
+                     : inputBufferReadIndex + 188 < inputBufferWriteIndex)) {
     servicefilter.AddPacket(&inputBuffer[inputBufferReadIndex]);
     inputBufferReadIndex += 188;
     const auto &packets = servicefilter.GetPackets();
@@ -172,6 +426,10 @@ int read_packet(void *opaque, uint8_t *buf, int bufSize) {
   }
 
   waitCv.notify_all();
+  // 終わりまで受け取っていたら、残りを返しきったところでEOF
+  if (copySize == 0 && inputEnded) {
+    return AVERROR_EOF;
+  }
   return copySize;
 }
 
@@ -179,88 +437,310 @@ void commitInputData(size_t nextSize) {
   std::lock_guard<std::mutex> lock(inputBufferMtx);
   inputBufferWriteIndex += nextSize;
   waitCv.notify_all();
-  spdlog::debug("commit {} bytes", nextSize);
+  TRACE("commit {} bytes", nextSize);
 }
 
-// reset
-void resetInternal() {
-  downloadCount = 0;
-  playFileUrl = std::string("");
+static size_t getBufferedInputSize() {
+  std::lock_guard<std::mutex> lock(inputBufferMtx);
+  return inputBufferWriteIndex - inputBufferReadIndex;
+}
+
+// これ以上入力が来ない。read_packetは残りを返した後EOFを返す
+static void endInputData() {
+  std::lock_guard<std::mutex> lock(inputBufferMtx);
+  inputEnded = true;
+  waitCv.notify_all();
+}
 
-  spdlog::info("downloaderThread joinable: {}", downloaderThread.joinable());
-  if (downloaderThread.joinable()) {
-    spdlog::info("join to downloader thread");
-    downloaderThread.join();
-    spdlog::info("done.");
+static void clearVideoFrameQueue() {
+  std::lock_guard<std::mutex> lock(videoFrameMtx);
+  while (!videoFrameQueue.empty()) {
+    auto frame = videoFrameQueue.front();
+    videoFrameQueue.pop_front();
+    av_frame_free(&frame);
   }
-  {
-    std::lock_guard<std::mutex> lock(inputBufferMtx);
-    inputBufferReadIndex = 0;
-    inputBufferWriteIndex = 0;
-    servicefilter.ClearPackets();
-    servicefilterRemain = 0;
+}
+
+static void clearAudioFrameQueue() {
+  std::lock_guard<std::mutex> lock(audioFrameMtx);
+  while (!audioFrameQueue.empty()) {
+    auto frame = audioFrameQueue.front();
+    audioFrameQueue.pop_front();
+    av_frame_free(&frame);
   }
+}
+
+static void clearInputBuffer() {
+  std::lock_guard<std::mutex> lock(inputBufferMtx);
+  inputBufferReadIndex = 0;
+  inputBufferWriteIndex = 0;
+  inputEnded = false;
+  servicefilter.ClearPackets();
+  servicefilterRemain = 0;
+}
+
+// デマックス後のパケットから表示待ちの字幕までを捨てる
+// nextGenerationならdecoderFlushGenerationも増やす
+static void clearDecodeQueues(bool nextGeneration = false) {
   {
-    std::lock_guard<std::mutex> lock(videoPacketMtx);
+    // パケットを取り出すのと同じロックの中で世代を増やしてキューを空にし、
+    // 古いパケットを新しい世代として受け取らないようにする
+    std::scoped_lock lock(videoPacketMtx, audioPacketMtx);
+    if (nextGeneration) {
+      decoderFlushGeneration++;
+    }
     while (!videoPacketQueue.empty()) {
       auto ppacket = videoPacketQueue.front();
       videoPacketQueue.pop_front();
       av_packet_free(&ppacket);
     }
-  }
-  {
-    std::lock_guard<std::mutex> lock(audioPacketMtx);
     while (!audioPacketQueue.empty()) {
       auto ppacket = audioPacketQueue.front();
       audioPacketQueue.pop_front();
       av_packet_free(&ppacket);
     }
   }
+  clearVideoFrameQueue();
+  clearAudioFrameQueue();
   {
-    std::lock_guard<std::mutex> lock(videoFrameMtx);
-    while (!videoFrameQueue.empty()) {
-      auto frame = videoFrameQueue.front();
-      videoFrameQueue.pop_front();
-      av_frame_free(&frame);
-    }
-  }
-  {
-    std::lock_guard<std::mutex> lock(audioFrameMtx);
-    while (!audioFrameQueue.empty()) {
-      auto frame = audioFrameQueue.front();
-      audioFrameQueue.pop_front();
-      av_frame_free(&frame);
-    }
+    std::lock_guard<std::mutex> lock(captionDataMtx);
+    captionPageQueue.clear();
+    captionOverlayQueue.clear();
   }
+  captionOverlayResetPending = true;
+  captionSchedulerResetPending = true;
+}
+
+// reset
+void resetInternal() {
+  stopDownloader();
+  decodePhase = false;
+  pendingSeekOffset = -1;
+  seekRestartOffset = -1;
+  clearInputBuffer();
+  clearDecodeQueues();
   videoStream = nullptr;
   audioStreamList.clear();
   captionStream = nullptr;
   videoFrameFound = false;
+  audioDecoderFailed = false;
+  resetMasterClock();
+  resetFrameScheduler();
+  resetPlaybackStats();
+  // 測定中にチャンネルが変わったら次の再生で測り直す
+  if (probeState != PROBE_IDLE) {
+    probeState = PROBE_WAITING;
+  }
+}
+
+// 早送り・巻き戻しをやめる。通常の再生に戻すには続けてシークする
+static void endTrickPlay() {
+  trickPlayMode = false;
+  stopTrickPlay();
 }
 
 void reset() {
   spdlog::debug("reset()");
   resetedDecoder = true;
-  resetedDownloader = true;
+  endTrickPlay();
+  resetSeeker();
+  resetGopIndex();
   resetInternal();
 }
 
-void videoDecoderThreadFunc(bool &terminateFlag) {
-  // find decoder
-  const AVCodec *videoCodec =
-      avcodec_find_decoder(videoStream->codecpar->codec_id);
-  if (videoCodec == nullptr) {
-    spdlog::error("No supported decoder for Video ...");
+// シークで読み込み位置が飛ぶので、スレッドやストリームの情報はそのままで
+// 溜まっているデータとデマックス・デコードの途中の状態を捨てる。
+// デコーダスレッドから呼ぶ
+static void flushForSeek(AVFormatContext *formatContext) {
+  clearInputBuffer();
+  AVIOContext *pb = formatContext->pb;
+  pb->buf_ptr = pb->buf_end = pb->buffer;
+  pb->eof_reached = 0;
+  pb->error = 0;
+  avformat_flush(formatContext);
+  clearDecodeQueues(true);
+  videoFrameFound = false;
+  resetMasterClock();
+  resetFrameScheduler();
+}
+
+// デコーダスレッドに溜まっているデータを捨てさせ、offsetから読み直す
+static void seekToOffset(size_t offset) {
+  stopDownloader();
+  std::lock_guard<std::mutex> lock(inputBufferMtx);
+  pendingSeekOffset = static_cast<int64_t>(offset);
+  waitCv.notify_all();
+}
+
+static double getCurrentRecordingPosition() {
+  if (isTrickPlaying()) {
+    return getTrickPlayPosition();
+  }
+  double nowSec = emscripten_get_now() / 1000.0;
+  return getRecordingPosition(nowSec + getMasterClockOffset(nowSec));
+}
+
+void seek(double seconds) {
+  if (!decodePhase || getRecordingDuration() <= 0.0) {
+    spdlog::warn("seek({:.1f}): not seekable", seconds);
+    return;
+  }
+  endTrickPlay();
+  findSeekOffset(seconds, seekToOffset);
+}
+
+bool scrub(double seconds) {
+  GopIndexEntry entry;
+  if (!decodePhase || !findGopIndexKeyframe(seconds, entry)) {
+    return false;
+  }
+  endTrickPlay();
+  seekToOffset(entry.offset);
+  return true;
+}
+
+bool stepKeyframe(int direction) {
+  double position = getCurrentRecordingPosition();
+  GopIndexEntry entry;
+  // 今表示しているGOPの先頭より1つ前に戻れるよう少し手前から探す
+  double from = direction < 0 ? position - 0.2 : position + 0.2;
+  if (!decodePhase || std::isnan(position) ||
+      !findAdjacentKeyframe(from, direction, entry)) {
+    return false;
+  }
+  endTrickPlay();
+  seekToOffset(entry.offset);
+  return true;
+}
+
+void setTrickPlayRate(int rate) {
+  if (rate == getTrickPlayRate() || (rate == 0 && !isTrickPlaying())) {
     return;
+  }
+  if (!decodePhase || getRecordingDuration() <= 0.0) {
+    spdlog::warn("setTrickPlayRate({}): not seekable", rate);
+    return;
+  }
+  if (rate == 0) {
+    // 最後に出したキーフレームから通常の再生に戻る
+    double position = getTrickPlayPosition();
+    size_t offset;
+    bool shown = getTrickPlayOffset(offset);
+    endTrickPlay();
+    if (shown) {
+      seekToOffset(offset);
+    } else {
+      findSeekOffset(position, seekToOffset);
+    }
+    return;
+  }
+  if (!isTrickPlayRate(rate)) {
+    spdlog::warn("setTrickPlayRate({}): unsupported rate", rate);
+    return;
+  }
+  if (isTrickPlaying()) {
+    changeTrickPlayRate(rate);
+    return;
+  }
+  double position = getCurrentRecordingPosition();
+  if (std::isnan(position)) {
+    return;
+  }
+  // 通常のダウンロードを止めて入力を空にさせ、空になったら
+  // decoderMainloopから書き込み始める。読み直す位置はtrickplay側で決める
+  trickPlayMode = true;
+  startTrickPlay(rate, position,
+                 {getBufferedInputSize, reserveInputData, commitInputData});
+  seekToOffset(0);
+}
+
+emscripten::val getRecordingTime() {
+  auto data = emscripten::val::object();
+  data.set("position", getCurrentRecordingPosition());
+  data.set("duration", getRecordingDuration());
+  data.set("rate", getTrickPlayRate());
+  return data;
+}
+
+static void traceVideoFrame(AVFrame *frame) {
+  const AVPixFmtDescriptor *desc =
+      av_pix_fmt_desc_get((AVPixelFormat)(frame->format));
+  int bufferSize = av_image_get_buffer_size((AVPixelFormat)frame->format,
+                                            frame->width, frame->height, 1);
+  spdlog::debug("VideoFrame: {}x{}x{} pixfmt:{} key:{} interlace:{} "
+                "tff:{} codecContext->field_order:?? pts:{} "
+                "stream.timebase:{} bufferSize:{}",
+                frame->width, frame->height, frame->ch_layout.nb_channels,
+                frame->format, frame->flags & AV_FRAME_FLAG_KEY,
+                frame->flags & AV_FRAME_FLAG_INTERLACED,
+                frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST, frame->pts,
+                av_q2d(videoStream->time_base), bufferSize);
+  if (desc == nullptr) {
+    spdlog::debug("desc is NULL");
   } else {
-    spdlog::debug("Video Decoder created.");
+    spdlog::debug(
+        "desc name:{} nb_components:{} comp[0].plane:{} .offet:{} "
+        "comp[1].plane:{} .offset:{} comp[2].plane:{} .offset:{}",
+        desc->name, desc->nb_components, desc->comp[0].plane,
+        desc->comp[0].offset, desc->comp[1].plane, desc->comp[1].offset,
+        desc->comp[2].plane, desc->comp[2].offset);
+  }
+  // 独自のget_buffer2では全プレーンをbuf[0]に確保するのでbuf[1..]は無い
+  spdlog::debug("buf[0]size:{} linesize:{}/{}/{} buffer_size:{}",
+                frame->buf[0]->size, frame->linesize[0], frame->linesize[1],
+                frame->linesize[2], bufferSize);
+}
+
+// デコード済みのフレームをすべて取り出してキューに入れる
+static void receiveVideoFrames(AVFrame *frame) {
+  while (avcodec_receive_frame(videoCodecContext, frame) == 0) {
+    countPlaybackFrame(FRAMES_DECODED);
+    markStartup("first-video-frame-decoded");
+    if (TRACE_ENABLED()) {
+      traceVideoFrame(frame);
+    }
+    if (initPts < 0) {
+      initPts = frame->pts;
+    }
+    frame->time_base.den = videoStream->time_base.den;
+    frame->time_base.num = videoStream->time_base.num;
+
+    // 詰め直しに失敗した場合はそのままのフレームを使う
+    AVFrame *cloneFrame = nullptr;
+    if (chromaPacking) {
+      cloneFrame = av_frame_alloc();
+      if (packVideoFrameChroma(videoCodecContext, frame, cloneFrame) < 0) {
+        av_frame_free(&cloneFrame);
+      }
+    }
+    if (cloneFrame == nullptr) {
+      cloneFrame = av_frame_clone(frame);
+    }
+    {
+      std::lock_guard<std::mutex> lock(videoFrameMtx);
+      videoFrameFound = true;
+
+      // 隠れている間は表示されないので、戻った時に出す最新の1枚だけ残す
+      if (videoBackground) {
+        while (!videoFrameQueue.empty()) {
+          AVFrame *old = videoFrameQueue.front();
+          videoFrameQueue.pop_front();
+          av_frame_free(&old);
+          countPlaybackFrame(FRAMES_SKIPPED);
+        }
+      }
+      videoFrameQueue.push_back(cloneFrame);
+    }
   }
+}
 
+// 画質の段階に合わせた設定でデコーダを開く
+static bool openVideoCodec(const AVCodec *videoCodec, int tier) {
   // Codec Context
   videoCodecContext = avcodec_alloc_context3(videoCodec);
   if (videoCodecContext == nullptr) {
     spdlog::error("avcodec_alloc_context3 for video failed");
-    return;
+    return false;
   } else {
     spdlog::debug("avcodec_alloc_context3 for video success.");
   }
@@ -268,18 +748,118 @@ void videoDecoderThreadFunc(bool &terminateFlag) {
   if (avcodec_parameters_to_context(videoCodecContext, videoStream->codecpar) <
       0) {
     spdlog::error("avcodec_parameters_to_context failed");
-    return;
+    return false;
   }
+  const QualityTierParams &params = QUALITY_TIER_PARAMS[tier];
+  videoCodecContext->lowres = std::min(params.lowres, videoCodec->max_lowres);
+  videoCodecContext->skip_idct = params.skipIdct;
+  videoCodecContext->skip_frame = videoSkipFrame();
+  // フレーム並列は遅延が増えるのでスライス並列だけ使う
+  activeDecodeThreads = decodeThreads;
+  videoCodecContext->thread_count = activeDecodeThreads;
+  videoCodecContext->thread_type = FF_THREAD_SLICE;
+  setupVideoBufferPool(videoCodecContext);
   if (avcodec_open2(videoCodecContext, videoCodec, nullptr) != 0) {
     spdlog::error("avcodec_open2 failed");
+    return false;
+  }
+  activeQualityTier = tier;
+  spdlog::info("video decoder opened: quality tier {} lowres {} threads {}",
+               tier, videoCodecContext->lowres, activeDecodeThreads.load());
+  return true;
+}
+
+static void closeVideoCodec() {
+  spdlog::debug("freeing videoCodecContext");
+  releaseVideoBufferPool(videoCodecContext);
+  avcodec_free_context(&videoCodecContext);
+}
+
+// 要求された画質の段階に切り替える。skip_*は開いたまま変えられるが、
+// lowresやスレッド数が変わる場合はキーフレームを待ち、残りのフレームを
+// 出し切ってからデコーダを開き直す。切り替え後のフレームは小さくなり、
+// 描画側はフレームの大きさごとにテクスチャを用意するのでそのまま表示できる
+static bool switchQualityTier(const AVCodec *videoCodec, AVPacket &packet,
+                              AVFrame *frame) {
+  int tier = requestedQualityTier;
+  bool threadsChanged = decodeThreads != activeDecodeThreads;
+  if (tier == activeQualityTier && !threadsChanged) {
+    return true;
+  }
+  const QualityTierParams &params = QUALITY_TIER_PARAMS[tier];
+  if (!threadsChanged && std::min(params.lowres, videoCodec->max_lowres) ==
+                             videoCodecContext->lowres) {
+    videoCodecContext->skip_idct = params.skipIdct;
+    activeQualityTier = tier;
+    spdlog::info("video quality tier: {}", tier);
+    return true;
+  }
+  if (!(packet.flags & AV_PKT_FLAG_KEY)) {
+    return true;
+  }
+  avcodec_send_packet(videoCodecContext, nullptr);
+  receiveVideoFrames(frame);
+  closeVideoCodec();
+  return openVideoCodec(videoCodec, tier);
+}
+
+// タブの表示・非表示に合わせてデコードするフレームを切り替える。
+// 戻る時はキーフレーム以外の参照が抜けているので、デコーダを空にして
+// 次のキーフレームまでパケットを捨てる。falseを返したパケットはデコードしない
+static bool switchBackgroundMode(AVPacket &packet, bool &waitKeyframe) {
+  bool background = backgroundMode;
+  if (background != videoBackground) {
+    videoBackground = background;
+    if (background) {
+      videoCodecContext->skip_frame = AVDISCARD_NONKEY;
+      {
+        std::lock_guard<std::mutex> lock(videoFrameMtx);
+        while (videoFrameQueue.size() > 1) {
+          AVFrame *old = videoFrameQueue.front();
+          videoFrameQueue.pop_front();
+          av_frame_free(&old);
+          countPlaybackFrame(FRAMES_SKIPPED);
+        }
+      }
+      trimVideoBufferPool(videoCodecContext);
+    } else {
+      avcodec_flush_buffers(videoCodecContext);
+      videoCodecContext->skip_frame = videoSkipFrame();
+      waitKeyframe = true;
+    }
+  }
+  if (waitKeyframe) {
+    if (!(packet.flags & AV_PKT_FLAG_KEY)) {
+      return false;
+    }
+    waitKeyframe = false;
+  }
+  return true;
+}
+
+void videoDecoderThreadFunc(bool &terminateFlag) {
+  // find decoder
+  const AVCodec *videoCodec =
+      avcodec_find_decoder(videoStream->codecpar->codec_id);
+  if (videoCodec == nullptr) {
+    spdlog::error("No supported decoder for Video ...");
+    return;
+  } else {
+    spdlog::debug("Video Decoder created.");
+  }
+
+  if (!openVideoCodec(videoCodec, requestedQualityTier)) {
     return;
   }
   spdlog::debug("avcodec for video open success.");
 
   AVFrame *frame = av_frame_alloc();
+  bool waitKeyframe = false;
+  int flushGeneration = decoderFlushGeneration;
 
   while (!terminateFlag) {
     AVPacket *ppacket;
+    int packetGeneration;
     {
       std::unique_lock<std::mutex> lock(videoPacketMtx);
       videoPacketCv.wait(
@@ -289,76 +869,71 @@ void videoDecoderThreadFunc(bool &terminateFlag) {
       }
       ppacket = videoPacketQueue.front();
       videoPacketQueue.pop_front();
+      packetGeneration = decoderFlushGeneration;
     }
     AVPacket &packet = *ppacket;
 
+    // シークした。デコード中だった古いフレームも捨て、キーフレームから始める
+    if (packetGeneration != flushGeneration) {
+      flushGeneration = packetGeneration;
+      avcodec_flush_buffers(videoCodecContext);
+      clearVideoFrameQueue();
+      waitKeyframe = true;
+      videoTrickPlay = trickPlayMode;
+      videoCodecContext->skip_frame = videoSkipFrame();
+    }
+
+    // 入力の終わり。並べ替え待ちで残っているフレームを出し切る
+    if (packet.size == 0) {
+      avcodec_send_packet(videoCodecContext, nullptr);
+      receiveVideoFrames(frame);
+      av_packet_free(&ppacket);
+      continue;
+    }
+
+    if (!switchQualityTier(videoCodec, packet, frame)) {
+      av_packet_free(&ppacket);
+      break;
+    }
+    if (!switchBackgroundMode(packet, waitKeyframe)) {
+      av_packet_free(&ppacket);
+      continue;
+    }
+
+    double decodeStart = emscripten_get_now();
     int ret = avcodec_send_packet(videoCodecContext, &packet);
     if (ret != 0) {
       spdlog::error("avcodec_send_packet(video) failed: {} {}", ret,
                     av_err2str(ret));
       // return;
     }
-    while (avcodec_receive_frame(videoCodecContext, frame) == 0) {
-      const AVPixFmtDescriptor *desc =
-          av_pix_fmt_desc_get((AVPixelFormat)(frame->format));
-      int bufferSize = av_image_get_buffer_size((AVPixelFormat)frame->format,
-                                                frame->width, frame->height, 1);
-      spdlog::debug("VideoFrame: {}x{}x{} pixfmt:{} key:{} interlace:{} "
-                    "tff:{} codecContext->field_order:?? pts:{} "
-                    "stream.timebase:{} bufferSize:{}",
-                    frame->width, frame->height, frame->ch_layout.nb_channels,
-                    frame->format, frame->flags & AV_FRAME_FLAG_KEY,
-                    frame->flags & AV_FRAME_FLAG_INTERLACED,
-                    frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST, frame->pts,
-                    av_q2d(videoStream->time_base), bufferSize);
-      if (desc == nullptr) {
-        spdlog::debug("desc is NULL");
-      } else {
-        spdlog::debug(
-            "desc name:{} nb_components:{} comp[0].plane:{} .offet:{} "
-            "comp[1].plane:{} .offset:{} comp[2].plane:{} .offset:{}",
-            desc->name, desc->nb_components, desc->comp[0].plane,
-            desc->comp[0].offset, desc->comp[1].plane, desc->comp[1].offset,
-            desc->comp[2].plane, desc->comp[2].offset);
-      }
-      spdlog::debug(
-          "buf[0]size:{} buf[1].size:{} buf[2].size:{} buffer_size:{}",
-          frame->buf[0]->size, frame->buf[1]->size, frame->buf[2]->size,
-          bufferSize);
-      if (initPts < 0) {
-        initPts = frame->pts;
-      }
-      frame->time_base.den = videoStream->time_base.den;
-      frame->time_base.num = videoStream->time_base.num;
-
-      AVFrame *cloneFrame = av_frame_clone(frame);
-      {
-        std::lock_guard<std::mutex> lock(videoFrameMtx);
-        videoFrameFound = true;
-
-        videoFrameQueue.push_back(cloneFrame);
-      }
+    receiveVideoFrames(frame);
+    {
+      std::lock_guard<std::mutex> lock(videoDecodeTimingMtx);
+      videoDecodeMs.push(emscripten_get_now() - decodeStart);
     }
     av_packet_free(&ppacket);
   }
 
-  spdlog::debug("freeing videoCodecContext");
-  avcodec_free_context(&videoCodecContext);
+  av_frame_free(&frame);
+  if (videoCodecContext) {
+    closeVideoCodec();
+  }
 }
 
-void audioDecoderThreadFunc(bool &terminateFlag) {
+static bool openAudioCodec() {
   const AVCodec *audioCodec =
       avcodec_find_decoder(audioStreamList[0]->codecpar->codec_id);
   if (audioCodec == nullptr) {
     spdlog::error("No supported decoder for Audio ...");
-    return;
+    return false;
   } else {
     spdlog::debug("Audio Decoder created.");
   }
   audioCodecContext = avcodec_alloc_context3(audioCodec);
   if (audioCodecContext == nullptr) {
     spdlog::error("avcodec_alloc_context3 for audio failed");
-    return;
+    return false;
   } else {
     spdlog::debug("avcodec_alloc_context3 for audio success.");
   }
@@ -366,22 +941,40 @@ void audioDecoderThreadFunc(bool &terminateFlag) {
   if (avcodec_parameters_to_context(audioCodecContext,
                                     audioStreamList[0]->codecpar) < 0) {
     spdlog::error("avcodec_parameters_to_context failed");
-    return;
+    return false;
   }
 
   if (avcodec_open2(audioCodecContext, audioCodec, nullptr) != 0) {
     spdlog::error("avcodec_open2 failed");
-    return;
+    return false;
   }
   spdlog::debug("avcodec for audio open success.");
+  return true;
+}
+
+void audioDecoderThreadFunc(bool &terminateFlag) {
+  // 開けなければ音声無しとして映像だけ再生を続ける
+  if (!openAudioCodec()) {
+    audioDecoderFailed = true;
+    avcodec_free_context(&audioCodecContext);
+    std::lock_guard<std::mutex> lock(audioPacketMtx);
+    while (!audioPacketQueue.empty()) {
+      AVPacket *ppacket = audioPacketQueue.front();
+      audioPacketQueue.pop_front();
+      av_packet_free(&ppacket);
+    }
+    return;
+  }
 
   // 巻き戻す
   // inputBufferReadIndex = 0;
 
   AVFrame *frame = av_frame_alloc();
+  int flushGeneration = decoderFlushGeneration;
 
   while (!terminateFlag) {
     AVPacket *ppacket;
+    int packetGeneration;
     {
       std::unique_lock<std::mutex> lock(audioPacketMtx);
       audioPacketCv.wait(
@@ -391,9 +984,17 @@ void audioDecoderThreadFunc(bool &terminateFlag) {
       }
       ppacket = audioPacketQueue.front();
       audioPacketQueue.pop_front();
+      packetGeneration = decoderFlushGeneration;
     }
     AVPacket &packet = *ppacket;
 
+    if (packetGeneration != flushGeneration) {
+      flushGeneration = packetGeneration;
+      avcodec_flush_buffers(audioCodecContext);
+      clearAudioFrameQueue();
+    }
+
+    // 空のパケットは入力の終わりで、残りのフレームを出し切らせる
     int ret = avcodec_send_packet(audioCodecContext, &packet);
     if (ret != 0) {
       spdlog::error("avcodec_send_packet(audio) failed: {} {}", ret,
@@ -401,13 +1002,12 @@ void audioDecoderThreadFunc(bool &terminateFlag) {
       // return;
     }
     while (avcodec_receive_frame(audioCodecContext, frame) == 0) {
-      spdlog::debug("AudioFrame: format:{} pts:{} frame timebase:{} stream "
-                    "timebase:{} buf[0].size:{} buf[1].size:{} nb_samples:{} "
-                    "ch:{}",
-                    frame->format, frame->pts, av_q2d(frame->time_base),
-                    av_q2d(audioStreamList[0]->time_base), frame->buf[0]->size,
-                    frame->buf[1]->size, frame->nb_samples,
-                    frame->ch_layout.nb_channels);
+      TRACE("AudioFrame: format:{} pts:{} frame timebase:{} stream "
+            "timebase:{} buf[0].size:{} buf[1].size:{} nb_samples:{} ch:{}",
+            frame->format, frame->pts, av_q2d(frame->time_base),
+            av_q2d(audioStreamList[0]->time_base), frame->buf[0]->size,
+            frame->buf[1] ? frame->buf[1]->size : 0, frame->nb_samples,
+            frame->ch_layout.nb_channels);
       if (initPts < 0) {
         initPts = frame->pts;
       }
@@ -428,6 +1028,7 @@ void audioDecoderThreadFunc(bool &terminateFlag) {
 void decoderThreadFunc() {
   spdlog::info("Decoder Thread started.");
   resetInternal();
+  resetCaptionDecoder();
   AVFormatContext *formatContext = nullptr;
   AVIOContext *avioContext = nullptr;
   uint8_t *ibuf = nullptr;
@@ -498,9 +1099,9 @@ void decoderThreadFunc() {
       spdlog::error("No video stream ...");
       return;
     }
+    // 音声が無くても映像は時計を映像側で進めて再生する
     if (audioStreamList.empty()) {
-      spdlog::error("No audio stream ...");
-      return;
+      spdlog::warn("No audio stream, video runs on the wall clock");
     }
     spdlog::info("Found video stream index:{} codec:{} dim:{}x{} "
                  "colorspace:{} colorrange:{} delay:{}",
@@ -530,12 +1131,25 @@ void decoderThreadFunc() {
   bool audioTerminateFlag = false;
   std::thread videoDecoderThread =
       std::thread([&]() { videoDecoderThreadFunc(videoTerminateFlag); });
-  std::thread audioDecoderThread =
-      std::thread([&]() { audioDecoderThreadFunc(audioTerminateFlag); });
+  std::thread audioDecoderThread;
+  if (!audioStreamList.empty()) {
+    audioDecoderThread =
+        std::thread([&]() { audioDecoderThreadFunc(audioTerminateFlag); });
+  }
 
   // decode phase
+  bool endOfInput = false;
+  decodePhase = true;
   while (!resetedDecoder) {
-    if (videoFrameQueue.size() > 30 || videoPacketQueue.size() > 10) {
+    // 入力を空にしてから、メインスレッドにシーク先からダウンロードし直させる
+    if (pendingSeekOffset >= 0) {
+      flushForSeek(formatContext);
+      seekRestartOffset = pendingSeekOffset.exchange(-1);
+      endOfInput = false;
+      continue;
+    }
+    if (videoFrameQueue.size() > static_cast<size_t>(videoQueueDepth) ||
+        videoPacketQueue.size() > 10) {
       std::this_thread::sleep_for(std::chrono::milliseconds(30));
       continue;
     }
@@ -547,6 +1161,28 @@ void decoderThreadFunc() {
     int videoCount = 0;
     int audioCount = 0;
     int ret = av_read_frame(formatContext, ppacket);
+    if (ret == AVERROR_EOF) {
+      // 録画ファイルの終わり。reset()されるまで待つ
+      if (!endOfInput) {
+        spdlog::info("av_read_frame: end of input");
+        endOfInput = true;
+        // 空のパケットを送り、デコーダに残っている最後のフレームを出させる。
+        // この後はシークでデコーダが空にされるまで何も送らない
+        {
+          std::lock_guard<std::mutex> lock(videoPacketMtx);
+          videoPacketQueue.push_back(av_packet_alloc());
+          videoPacketCv.notify_all();
+        }
+        if (!audioStreamList.empty() && !audioDecoderFailed) {
+          std::lock_guard<std::mutex> lock(audioPacketMtx);
+          audioPacketQueue.push_back(av_packet_alloc());
+          audioPacketCv.notify_all();
+        }
+      }
+      av_packet_free(&ppacket);
+      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+      continue;
+    }
     if (ret != 0) {
       spdlog::info("av_read_frame: {} {}", ret, av_err2str(ret));
       continue;
@@ -559,7 +1195,12 @@ void decoderThreadFunc() {
         videoPacketCv.notify_all();
       }
     }
-    if (audioStreamList.size() > 0 &&
+    // 早送り・巻き戻しの間は音声と字幕は捨てる
+    if (trickPlayMode) {
+      av_packet_free(&ppacket);
+      continue;
+    }
+    if (audioStreamList.size() > 0 && !audioDecoderFailed &&
         (ppacket->stream_index ==
          audioStreamList[(int)dualMonoMode % audioStreamList.size()]->index)) {
       AVPacket *clonePacket = av_packet_clone(ppacket);
@@ -569,25 +1210,24 @@ void decoderThreadFunc() {
         audioPacketCv.notify_all();
       }
     }
-    if (ppacket->stream_index == captionStream->index) {
-      char buffer[ppacket->size + 2];
-      memcpy(buffer, ppacket->data, ppacket->size);
-      buffer[ppacket->size + 1] = '\0';
-      std::string str = fmt::format("{:02X}", ppacket->data[0]);
-      for (int i = 1; i < ppacket->size; i++) {
-        str += fmt::format(" {:02x}", ppacket->data[i]);
+    if (captionStream && ppacket->stream_index == captionStream->index) {
+      TRACE("CaptionPacket received. size: {}", ppacket->size);
+      // 表示しない場合も画面の状態やDRCSを持ち越すために解釈はしておく
+      std::vector<CaptionPage> pages;
+      if (!decodeCaptionPes(ppacket->data, ppacket->size, ppacket->pts,
+                            pages)) {
+        TRACE("caption PES decode failed");
       }
-      spdlog::debug("CaptionPacket received. size: {} data: [{}]",
-                    ppacket->size, str);
-      if (!captionCallback.isNull()) {
-        std::vector<uint8_t> buffer(ppacket->size);
-        memcpy(&buffer[0], ppacket->data, ppacket->size);
-        {
-          std::lock_guard<std::mutex> lock(captionDataMtx);
-          int64_t pts = ppacket->pts;
-          captionDataQueue.push_back(
-              std::make_pair<int64_t, std::vector<uint8_t>>(std::move(pts),
-                                                            std::move(buffer)));
+      // WebGPUで描画している間は映像に重ね、それ以外はJSに渡す
+      bool overlay = captionOverlay && supportsCaptionOverlay();
+      if ((overlay || !captionCallback.isNull()) && !pages.empty()) {
+        std::lock_guard<std::mutex> lock(captionDataMtx);
+        for (auto &page : pages) {
+          // TODO: クロック一回転したときの処理
+          double time =
+              page.pts * av_q2d(captionStream->time_base) + page.offset;
+          (overlay ? captionOverlayQueue : captionPageQueue)
+              .push_back({time, std::move(page)});
         }
       }
     }
@@ -608,8 +1248,10 @@ void decoderThreadFunc() {
   }
   spdlog::debug("join to videoDecoderThread");
   videoDecoderThread.join();
-  spdlog::debug("join to audioDecoderThread");
-  audioDecoderThread.join();
+  if (audioDecoderThread.joinable()) {
+    spdlog::debug("join to audioDecoderThread");
+    audioDecoderThread.join();
+  }
 
   spdlog::debug("freeing avio_context");
   avio_context_free(&avioContext);
@@ -644,13 +1286,269 @@ int swrOutputSize = 0;
 int channel_layout = 0;
 int sample_rate = 0;
 
+// 次のvsyncの再生位置までに表示されるはずのページのうち最後のものを、
+// これから描くフレームに重ねる。JSに渡す字幕と同じく、時計が飛んだら
+// 持っているページは捨てる
+static void updateCaptionOverlay(double mediaTimeAtVsync, double clockOffset) {
+  if (captionOverlayResetPending.exchange(false) ||
+      (!captionOverlay && captionOverlayShown)) {
+    clearCaptionQueue(captionOverlaySchedule);
+  }
+  {
+    std::lock_guard<std::mutex> lock(captionDataMtx);
+    if (!captionOverlay) {
+      captionOverlayQueue.clear();
+    }
+    while (!captionOverlayQueue.empty()) {
+      scheduleCaptionPage(captionOverlaySchedule,
+                          std::move(captionOverlayQueue.front()));
+      captionOverlayQueue.pop_front();
+    }
+  }
+  updateCaptionQueueClock(captionOverlaySchedule, clockOffset);
+  std::vector<TimedCaptionPage> due;
+  takeDueCaptionPages(captionOverlaySchedule, mediaTimeAtVsync, due);
+  captionOverlayCount = captionOverlaySchedule.pending.size();
+  if (!due.empty()) {
+    const CaptionPage &page = due.back().page;
+    setRendererCaptionPage(page);
+    captionOverlayShown = !page.runs.empty();
+  }
+}
+
+// 早送り・巻き戻しの間はPTSが飛ぶので時計は使わず、
+// デコードできた一番新しいキーフレームをすぐに出す
+static void presentTrickPlayFrame(double nowMs) {
+  updateCaptionOverlay(-INFINITY, NAN);
+  if (!isRendererReady()) {
+    return;
+  }
+  AVFrame *currentFrame = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(videoFrameMtx);
+    while (!videoFrameQueue.empty()) {
+      if (currentFrame) {
+        av_frame_free(&currentFrame);
+        countPlaybackFrame(FRAMES_SKIPPED);
+      }
+      currentFrame = videoFrameQueue.front();
+      videoFrameQueue.pop_front();
+    }
+  }
+  if (currentFrame) {
+    drawVideoFrame(currentFrame);
+    onFramePresented(nowMs);
+    countPlaybackFrame(FRAMES_PRESENTED);
+    av_frame_free(&currentFrame);
+  } else if (hasPresentedFrame()) {
+    countPlaybackFrame(FRAMES_REPEATED);
+  }
+}
+
+// 次のvsyncの時点の再生位置に合うVideoFrameを選んで描画する。
+// OffscreenCanvasを使う場合は表示用のスレッドから呼ばれる
+void presentVideoFrame() {
+  // 隠れている間はGPUを使わない
+  if (backgroundMode) {
+    return;
+  }
+  double nowMs = emscripten_get_now();
+  beginFrameSchedulerTick(nowMs);
+
+  // 解像度が変わるフレームがキューに入っていたら、表示されるより前に
+  // テクスチャを用意しておく
+  int nextWidth = 0, nextHeight = 0, nextFormat = 0;
+  {
+    std::lock_guard<std::mutex> lock(videoFrameMtx);
+    if (!videoFrameQueue.empty()) {
+      nextWidth = videoFrameQueue.back()->width;
+      nextHeight = videoFrameQueue.back()->height;
+      nextFormat = videoFrameQueue.back()->format;
+    }
+  }
+  prepareRenderer(nextWidth, nextHeight, nextFormat);
+  if (trickPlayMode) {
+    presentTrickPlayFrame(nowMs);
+    return;
+  }
+
+  double nowSec = nowMs / 1000.0;
+  double clockOffset = getMasterClockOffset(nowSec);
+  if (std::isnan(clockOffset)) {
+    // 音声が来なければ先頭のフレームのPTSから時計を始める
+    double frontPtsTime = NAN;
+    {
+      std::lock_guard<std::mutex> lock(videoFrameMtx);
+      if (!videoFrameQueue.empty()) {
+        AVFrame *frame = videoFrameQueue.front();
+        if (frame->time_base.den != 0 && frame->time_base.num != 0) {
+          frontPtsTime = frame->pts * av_q2d(frame->time_base);
+        }
+      }
+    }
+    if (!std::isnan(frontPtsTime)) {
+      anchorVideoClock(frontPtsTime, nowSec);
+      clockOffset = getMasterClockOffset(nowSec);
+    }
+  }
+  if (std::isnan(clockOffset) || !isRendererReady()) {
+    return;
+  }
+  // 今描いたフレームが実際に表示される、次のvsyncの時点での再生位置
+  double mediaTimeAtVsync =
+      (nowMs + getTimeToNextVsyncMs()) / 1000.0 + clockOffset;
+  updateCaptionOverlay(mediaTimeAtVsync, clockOffset);
+
+  // 表示するフレームはロック中にキューから取り出して、描画中に
+  // reset()で解放されないようにする
+  AVFrame *currentFrame = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(videoFrameMtx);
+    while (!videoFrameQueue.empty()) {
+      AVFrame *frame = videoFrameQueue.front();
+      // time_base が 0/0 な不正フレームが入ってたら捨てる
+      if (frame->time_base.den == 0 || frame->time_base.num == 0) {
+        videoFrameQueue.pop_front();
+        av_frame_free(&frame);
+        countPlaybackFrame(FRAMES_SKIPPED);
+        continue;
+      }
+      // VideoのPTSをクロックから時間に直す
+      // TODO: クロック一回転したときの処理
+      double ptsTime = frame->pts * av_q2d(frame->time_base);
+      double nextPtsTime = NAN;
+      if (videoFrameQueue.size() > 1) {
+        AVFrame *next = videoFrameQueue[1];
+        if (next->time_base.den != 0 && next->time_base.num != 0) {
+          nextPtsTime = next->pts * av_q2d(next->time_base);
+        }
+      }
+      TRACE("VideoFrame@presenter pts:{} next:{} vsync:{}", ptsTime,
+            nextPtsTime, mediaTimeAtVsync);
+
+      // 次のvsyncが表示期間に入るフレームを選ぶ。
+      // それより前のフレームは間に合わなかったので捨てる
+      FrameVerdict verdict =
+          classifyFrame(ptsTime, nextPtsTime, mediaTimeAtVsync);
+      if (verdict == FRAME_LATE) {
+        videoFrameQueue.pop_front();
+        av_frame_free(&frame);
+        countPlaybackFrame(FRAMES_DROPPED_LATE);
+        continue;
+      }
+      if (verdict == FRAME_PRESENT) {
+        videoFrameQueue.pop_front();
+        currentFrame = frame;
+        // 隠れている間に残しておいたフレームは後続が無ければ遅れていても
+        // そのまま出るので、ずれの分布には入れない
+        if (!videoResyncPending.exchange(false)) {
+          recordAvOffset((mediaTimeAtVsync - ptsTime) * 1000.0);
+        }
+      }
+      break;
+    }
+  }
+
+  if (currentFrame) {
+    drawVideoFrame(currentFrame);
+    markStartup("first-frame-presented");
+    onFramePresented(nowMs);
+    countPlaybackFrame(FRAMES_PRESENTED);
+    av_frame_free(&currentFrame);
+  } else if (hasPresentedFrame()) {
+    countPlaybackFrame(FRAMES_REPEATED);
+  }
+}
+
+// DRCSのビットマップはbufferに詰めて、そこを指すビューを渡す
+static emscripten::val captionPageToVal(const CaptionPage &page,
+                                        uint8_t *&buffer) {
+  auto runs = emscripten::val::array();
+  for (size_t i = 0; i < page.runs.size(); i++) {
+    const CaptionRun &run = page.runs[i];
+    auto value = emscripten::val::object();
+    value.set("text", run.text);
+    value.set("drcs", run.drcs);
+    value.set("length", run.length);
+    value.set("x", run.x);
+    value.set("y", run.y);
+    value.set("cellWidth", run.cellWidth);
+    value.set("cellHeight", run.cellHeight);
+    value.set("charWidth", run.charWidth);
+    value.set("charHeight", run.charHeight);
+    value.set("foreground", run.foreground);
+    value.set("background", run.background);
+    value.set("outline", run.outline);
+    value.set("underline", run.underline);
+    runs.set(i, value);
+  }
+  auto drcs = emscripten::val::array();
+  for (size_t i = 0; i < page.drcs.size(); i++) {
+    const CaptionDrcs &pattern = page.drcs[i];
+    auto value = emscripten::val::object();
+    value.set("width", pattern.width);
+    value.set("height", pattern.height);
+    std::copy(pattern.alpha.begin(), pattern.alpha.end(), buffer);
+    value.set("alpha", emscripten::val(emscripten::typed_memory_view<uint8_t>(
+                           pattern.alpha.size(), buffer)));
+    buffer += pattern.alpha.size();
+    drcs.set(i, value);
+  }
+  auto data = emscripten::val::object();
+  data.set("dataIdentifier", page.dataIdentifier);
+  data.set("pts", static_cast<double>(page.pts));
+  data.set("planeWidth", page.planeWidth);
+  data.set("planeHeight", page.planeHeight);
+  data.set("runs", runs);
+  data.set("drcs", drcs);
+  return data;
+}
+
+// 表示する再生位置が来たページを1回のコールバックでまとめて渡す。
+// DRCSのビューは次に渡すまで有効
+static void deliverCaptionPages(double playTime) {
+  std::vector<TimedCaptionPage> due;
+  takeDueCaptionPages(playTime, due);
+  if (due.empty()) {
+    return;
+  }
+  size_t drcsSize = 0;
+  for (const auto &timed : due) {
+    for (const auto &pattern : timed.page.drcs) {
+      drcsSize += pattern.alpha.size();
+    }
+  }
+  beginCaptionDelivery();
+  uint8_t *buffer = allocateCaptionBuffer(drcsSize);
+  auto pages = emscripten::val::array();
+  for (size_t i = 0; i < due.size(); i++) {
+    pages.set(i, captionPageToVal(due[i].page, buffer));
+  }
+  captionCallback(pages);
+}
+
 void decoderMainloop() {
-  spdlog::debug("decoderMainloop videoFrameQueue:{} audioFrameQueue:{} "
-                "videoPacketQueue:{} audioPacketQueue:{}",
-                videoFrameQueue.size(), audioFrameQueue.size(),
-                videoPacketQueue.size(), audioPacketQueue.size());
+  TRACE("decoderMainloop videoFrameQueue:{} audioFrameQueue:{} "
+        "videoPacketQueue:{} audioPacketQueue:{}",
+        videoFrameQueue.size(), audioFrameQueue.size(),
+        videoPacketQueue.size(), audioPacketQueue.size());
+
+  updateCapabilityProbe();
+  int64_t restartOffset = seekRestartOffset.exchange(-1);
+  if (restartOffset >= 0) {
+    if (isTrickPlaying()) {
+      resumeTrickPlay();
+    } else {
+      restartDownloader(static_cast<size_t>(restartOffset));
+    }
+  }
+  // ファイルの端まで着いたら通常の再生に戻る
+  if (!pumpTrickPlay()) {
+    setTrickPlayRate(0);
+  }
+  pumpDownloader();
 
-  if (videoStream && !audioStreamList.empty() && !statsCallback.isNull()) {
+  if (videoStream && !statsCallback.isNull()) {
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now() - startTime);
     auto data = emscripten::val::object();
@@ -661,7 +1559,55 @@ void decoderMainloop() {
     data.set("InputBufferSize",
              (inputBufferWriteIndex - inputBufferReadIndex) / 1000000.0);
     data.set("CaptionDataQueueSize",
-             captionStream ? captionDataQueue.size() : 0);
+             captionStream ? getScheduledCaptionCount() +
+                                 captionOverlayCount.load()
+                           : 0);
+    WebGpuTimings timings = getWebGpuTimings();
+    data.set("GpuTimestamps", timings.gpuTimestamps);
+    data.set("UploadMs", timings.uploadMs);
+    data.set("YadifMs", timings.yadifMs);
+    data.set("RenderMs", timings.renderMs);
+    data.set("PresentMs", timings.presentMs);
+    {
+      std::lock_guard<std::mutex> lock(videoDecodeTimingMtx);
+      data.set("VideoDecodeMs", videoDecodeMs.mean());
+    }
+    data.set("QualityTier", activeQualityTier.load());
+    data.set("ClockSource", static_cast<int>(getClockSource()));
+    DownloaderStats downloaderStats = getDownloaderStats();
+    if (downloaderStats.active) {
+      data.set("DownloadConnections", downloaderStats.connections);
+      data.set("DownloadChunkSize", downloaderStats.chunkSize);
+      data.set("DownloadMbps", downloaderStats.throughputMbps);
+      data.set("DownloadRttMs", downloaderStats.rttMs);
+      data.set("DownloadRetries", downloaderStats.retries);
+      data.set("DownloadFailures", downloaderStats.failures);
+      data.set("DownloadFileSize", downloaderStats.fileSize / 1000000.0);
+      data.set("DownloadComplete", downloaderStats.complete);
+      data.set("GopIndexSize", getGopIndexSize());
+    }
+    FrameSchedulerStats schedulerStats = getFrameSchedulerStats();
+    data.set("DisplayRefreshHz", schedulerStats.displayRefreshHz);
+    data.set("ContentFps", schedulerStats.contentFps);
+    auto histogram = emscripten::val::array();
+    for (int i = 0; i < PRESENT_INTERVAL_BINS; i++) {
+      histogram.set(i, schedulerStats.presentIntervalHistogram[i]);
+    }
+    data.set("PresentIntervalHistogram", histogram);
+    PlaybackStats playbackStats = getPlaybackStats(duration.count());
+    data.set("DecodedFps", playbackStats.perSecond[FRAMES_DECODED]);
+    data.set("PresentedFps", playbackStats.perSecond[FRAMES_PRESENTED]);
+    data.set("DroppedLateFps", playbackStats.perSecond[FRAMES_DROPPED_LATE]);
+    data.set("SkippedFps", playbackStats.perSecond[FRAMES_SKIPPED]);
+    data.set("RepeatedFps", playbackStats.perSecond[FRAMES_REPEATED]);
+    auto avOffset = emscripten::val::array();
+    auto presentJitter = emscripten::val::array();
+    for (int i = 0; i < PLAYBACK_HISTOGRAM_BINS; i++) {
+      avOffset.set(i, playbackStats.avOffsetHistogram[i]);
+      presentJitter.set(i, playbackStats.presentJitterHistogram[i]);
+    }
+    data.set("AvOffsetHistogram", avOffset);
+    data.set("PresentJitterHistogram", presentJitter);
     statsBuffer.push_back(std::move(data));
     if (statsBuffer.size() >= 6) {
       auto statsArray = emscripten::val::array();
@@ -673,21 +1619,6 @@ void decoderMainloop() {
     }
   }
 
-  // time_base が 0/0 な不正フレームが入ってたら捨てる
-  AVFrame *currentFrame = nullptr;
-  {
-    std::lock_guard<std::mutex> lock(videoFrameMtx);
-    while (!videoFrameQueue.empty()) {
-      AVFrame *frame = videoFrameQueue.front();
-      if (frame->time_base.den == 0 || frame->time_base.num == 0) {
-        videoFrameQueue.pop_front();
-        av_frame_free(&frame);
-      } else {
-        currentFrame = frame;
-        break;
-      }
-    }
-  }
   AVFrame *audioFrame = nullptr;
   {
     std::lock_guard<std::mutex> lock(audioFrameMtx);
@@ -703,28 +1634,11 @@ void decoderMainloop() {
     }
   }
 
-  if (currentFrame && audioFrame) {
-    // 次のVideoFrameをまずは見る（条件を満たせばpopする）
-    // AudioFrameは完全に見るだけ
-    // spdlog::info("found Current Frame {}x{} bufferSize:{}",
-    // currentFrame->width,
-    //              currentFrame->height, bufferSize);
-    spdlog::debug(
-        "VideoFrame@mainloop pts:{} time_base:{} {}/{} AudioQueueSize:{}",
-        currentFrame->pts, av_q2d(currentFrame->time_base),
-        currentFrame->time_base.num, currentFrame->time_base.den,
-        audioFrameQueue.size());
-
-    // WindowSize確認＆リサイズ
-    // TODO:
-    // if (ww != videoStream->codecpar->width ||
-    //     wh != videoStream->codecpar->height) {
-    //   set_style(videoStream->codecpar->width);
-    // }
-
-    // VideoとAudioのPTSをクロックから時間に直す
+  // 映像の表示タイミングの基準になる、現在再生している音声のPTSを報告する。
+  // 音声が無い・止まっている場合は時計が映像側で進む
+  double nowSec = emscripten_get_now() / 1000.0;
+  if (audioFrame && audioStreamList[0]->codecpar->sample_rate > 0) {
     // TODO: クロック一回転したときの処理
-    double videoPtsTime = currentFrame->pts * av_q2d(currentFrame->time_base);
     double audioPtsTime = audioFrame->pts * av_q2d(audioFrame->time_base);
 
     // 上記から推定される、現在再生している音声のPTS（時間）
@@ -733,56 +1647,27 @@ void decoderMainloop() {
     double estimatedAudioPlayTime =
         audioPtsTime - (double)bufferedAudioSamples /
                            audioStreamList[0]->codecpar->sample_rate;
-
-    // 1フレーム分くらいはズレてもいいからこれでいいか。フレーム真面目に考えると良くわからない。
-    bool showFlag = estimatedAudioPlayTime > videoPtsTime;
-
-    // リップシンク条件を満たしてたらVideoFrame再生
-    if (showFlag) {
-      {
-        std::lock_guard<std::mutex> lock(videoFrameMtx);
-        videoFrameQueue.pop_front();
-      }
-      double timestamp =
-          currentFrame->pts * av_q2d(currentFrame->time_base) * 1000000;
-
-      drawWebGpu(currentFrame);
-
-      av_frame_free(&currentFrame);
-    }
+    updateAudioClock(estimatedAudioPlayTime, nowSec);
   }
 
-  if (!captionCallback.isNull() && audioFrame) {
-    while (captionDataQueue.size() > 0) {
-      std::pair<int64_t, std::vector<uint8_t>> p;
-      {
-        std::lock_guard<std::mutex> lock(captionDataMtx);
-        p = std::move(captionDataQueue.front());
-        captionDataQueue.pop_front();
-      }
-      double pts = (double)p.first;
-      std::vector<uint8_t> &buffer = p.second;
-      double ptsTime = pts * av_q2d(captionStream->time_base);
-
-      // AudioFrameは完全に見るだけ
-      // VideoとAudioのPTSをクロックから時間に直す
-      // TODO: クロック一回転したときの処理
-      double audioPtsTime = audioFrame->pts * av_q2d(audioFrame->time_base);
-
-      // 上記から推定される、現在再生している音声のPTS（時間）
-      // double estimatedAudioPlayTime =
-      //     audioPtsTime - (double)queuedSize / ctx.openedAudioSpec.freq;
-      // 0除算を避けるためsample_rateがおかしいときはAudioのPTSをそのまま返す
-      int sampleRate = audioStreamList[0]->codecpar->sample_rate;
-      double estimatedAudioPlayTime =
-          sampleRate ? audioPtsTime - (double)bufferedAudioSamples / sampleRate
-                     : audioPtsTime;
-
-      auto data = emscripten::val(
-          emscripten::typed_memory_view<uint8_t>(buffer.size(), &buffer[0]));
-      captionCallback(pts, ptsTime - estimatedAudioPlayTime, data);
+  // 字幕は映像と同じ再生位置で表示する時刻が来るまで持っておく。
+  // 時計が無い間は、字幕を消すためのページだけ渡す
+  double clockOffset = getMasterClockOffset(nowSec);
+  if (captionSchedulerResetPending.exchange(false)) {
+    clearCaptionScheduler();
+  }
+  {
+    std::lock_guard<std::mutex> lock(captionDataMtx);
+    while (!captionPageQueue.empty()) {
+      scheduleCaptionPage(std::move(captionPageQueue.front()));
+      captionPageQueue.pop_front();
     }
   }
+  updateCaptionSchedulerClock(clockOffset);
+  if (!captionCallback.isNull()) {
+    deliverCaptionPages(std::isnan(clockOffset) ? -INFINITY
+                                                : nowSec + clockOffset);
+  }
 
   // AudioFrameはVideoFrame処理でのPTS参照用に1個だけキューに残す
   while (audioFrameQueue.size() > 1) {
@@ -792,10 +1677,11 @@ void decoderMainloop() {
       frame = audioFrameQueue.front();
       audioFrameQueue.pop_front();
     }
-    spdlog::debug("AudioFrame@mainloop pts:{} time_base:{} nb_samples:{} ch:{}",
-                  frame->pts, av_q2d(frame->time_base), frame->nb_samples,
-                  frame->ch_layout.nb_channels);
+    TRACE("AudioFrame@mainloop pts:{} time_base:{} nb_samples:{} ch:{}",
+          frame->pts, av_q2d(frame->time_base), frame->nb_samples,
+          frame->ch_layout.nb_channels);
 
+    double audioStart = emscripten_get_now();
     if (frame->ch_layout.nb_channels != 2) {
       if (!swr || channel_layout != frame->ch_layout.nb_channels ||
           sample_rate != frame->sample_rate) {
@@ -853,65 +1739,21 @@ void decoderMainloop() {
                     reinterpret_cast<float *>(frame->data[1]),
                     frame->nb_samples);
     }
-
-    av_frame_free(&frame);
-  }
-}
-
-void downloadNextRange() {
-  emscripten_fetch_attr_t attr;
-  emscripten_fetch_attr_init(&attr);
-  strcpy(attr.requestMethod, "GET");
-  attr.attributes =
-      EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_SYNCHRONOUS;
-  std::string range = fmt::format("bytes={}-{}", downloadCount,
-                                  downloadCount + donwloadRangeSize - 1);
-  const char *headers[] = {"Range", range.c_str(), NULL};
-  attr.requestHeaders = headers;
-
-  spdlog::debug("request {} Range: {}", playFileUrl, range);
-  emscripten_fetch_t *fetch = emscripten_fetch(&attr, playFileUrl.c_str());
-  if (fetch->status == 206) {
-    spdlog::debug("fetch success size: {}", fetch->numBytes);
-    {
-      std::lock_guard<std::mutex> lock(inputBufferMtx);
-      if (inputBufferWriteIndex + fetch->numBytes >= MAX_INPUT_BUFFER) {
-        size_t remainSize = inputBufferWriteIndex - inputBufferReadIndex;
-        memcpy(&inputBuffer[0], &inputBuffer[inputBufferReadIndex], remainSize);
-        inputBufferReadIndex = 0;
-        inputBufferWriteIndex = remainSize;
-      }
-      memcpy(&inputBuffer[inputBufferWriteIndex], &fetch->data[0],
-             fetch->numBytes);
-      inputBufferWriteIndex += fetch->numBytes;
-      downloadCount += fetch->numBytes;
-      waitCv.notify_all();
+    if (probeState == PROBE_MEASURING && frame->sample_rate > 0) {
+      audioProcessMs += emscripten_get_now() - audioStart;
+      audioProcessSamples += av_rescale(frame->nb_samples, 48000,
+                                        frame->sample_rate);
     }
-  } else {
-    spdlog::error("fetch failed URL: {} status code: {}", playFileUrl,
-                  fetch->status);
-  }
-  emscripten_fetch_close(fetch);
-}
 
-void downloaderThraedFunc() {
-  resetedDownloader = false;
-  while (!resetedDownloader) {
-    size_t remainSize;
-    {
-      std::lock_guard<std::mutex> lock(inputBufferMtx);
-      remainSize = inputBufferWriteIndex - inputBufferReadIndex;
-    }
-    if (remainSize < donwloadRangeSize / 2) {
-      downloadNextRange();
-    } else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
+    av_frame_free(&frame);
   }
 }
 
 void playFile(std::string url) {
   spdlog::info("playFile: {}", url);
-  playFileUrl = url;
-  downloaderThread = std::thread([]() { downloaderThraedFunc(); });
+  resetGopIndex();
+  startDownloader(url,
+                  {getBufferedInputSize, reserveInputData, commitInputData,
+                   endInputData});
+  startSeeker();
 }
@@ -5,11 +5,36 @@ extern std::chrono::system_clock::time_point startTime;
 
 void initDecoder();
 void decoderMainloop();
+void presentVideoFrame();
 
 emscripten::val getNextInputBuffer(size_t nextSize);
 void commitInputData(size_t nextSize);
 void setCaptionCallback(emscripten::val callback);
+// WebGPUで描画している間、字幕をJSに渡さずに映像に重ねて描く
+void setCaptionOverlay(bool enabled);
 void setStatsCallback(emscripten::val callback);
 void reset();
 void playFile(std::string url);
+// 録画ファイルの先頭からseconds秒の位置の手前のキーフレームから再生し直す
+void seek(double seconds);
+// 録画ファイルの再生位置と長さ(秒)、早送り・巻き戻しの倍率。
+// 分からなければNaNと0
+emscripten::val getRecordingTime();
+// 索引済みの範囲ならsecondsの手前のキーフレームに移ってtrue。
+// ダウンロードして探すことはしないので、ドラッグ中に何度呼んでもよい
+bool scrub(double seconds);
+// 索引にある前(direction < 0)・次のキーフレームに移る
+bool stepKeyframe(int direction);
+// 録画ファイルをキーフレームだけで早送り(2, 4, 8, 16)・巻き戻し(負)する。
+// 0で今出ている所から通常の再生に戻る
+void setTrickPlayRate(int rate);
 void setDualMonoMode(int mode);
+void setChromaPacking(bool enabled);
+// 0: 通常, 1: Bフレームの逆DCTを省略, 2: 1/2解像度, 3: 1/4解像度
+void setQualityTier(int tier);
+void setDecodeThreads(int threads);
+void setVideoQueueDepth(int depth);
+// 再生中のストリームで負荷を測り、選んだ設定を適用してからcallbackに渡す
+void startCapabilityProbe(emscripten::val callback);
+// タブが隠れている間は映像をキーフレームだけデコードし、描画もしない
+void setBackgroundMode(bool enabled);
@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <emscripten/emscripten.h>
+#include <emscripten/val.h>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+#include "../util/trace.hpp"
+#include "downloader.hpp"
+#include "gopindex.hpp"
+
+const int MAX_DOWNLOAD_CONNECTIONS = 6;
+const int INITIAL_DOWNLOAD_CONNECTIONS = 2;
+const size_t MIN_CHUNK_SIZE = 256 * 1024;
+const size_t MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+const size_t INITIAL_CHUNK_SIZE = 2 * 1024 * 1024;
+const size_t CHUNK_ALIGNMENT = 64 * 1024;
+// 入力バッファの未読分と、リクエスト中・並べ替え待ちの分の合計の上限
+const size_t DOWNLOAD_READAHEAD = 8 * 1024 * 1024;
+// 1リクエストのうちRTTで待つ時間が1/8程度になる大きさにする
+const double CHUNK_RTT_RATIO = 8.0;
+// 接続数はこの間隔で合計のスループットを比べて増減する
+const double ADAPT_WINDOW_MS = 2000.0;
+// 増やしても減らしても伸びなかったら、しばらくそのままにする
+const int ADAPT_HOLD_WINDOWS = 5;
+const double DEFAULT_RTT_MS = 100.0;
+// 失敗が続くたびに待ち時間を倍にし、この回数続いたら諦める
+const double INITIAL_RETRY_DELAY_MS = 250.0;
+const double MAX_RETRY_DELAY_MS = 8000.0;
+const int MAX_CONSECUTIVE_FAILURES = 10;
+const size_t UNKNOWN_FILE_SIZE = std::numeric_limits<size_t>::max();
+
+struct DownloadChunk {
+  size_t offset;
+  size_t size;
+};
+
+struct DownloadRequest {
+  DownloadChunk chunk;
+  size_t received = 0;
+  // レスポンスが来なかったら0
+  int status = 0;
+  double startMs = 0.0;
+  double firstByteMs = 0.0;
+};
+
+struct DownloaderState {
+  // stopDownloaderはデコーダスレッドからも呼ばれる
+  std::mutex mtx;
+  bool running = false;
+  // ファイルの終わりまで書き込んだか、諦めたか
+  bool ended = false;
+  std::string url;
+  DownloaderSink sink;
+  // 次に新しくリクエストする位置と、入力バッファに書き込み済みの位置
+  size_t nextOffset = 0;
+  size_t writeOffset = 0;
+  // Content-Rangeか、短いレスポンス・416で分かったファイルの大きさ
+  size_t fileSize = UNKNOWN_FILE_SIZE;
+  // 失敗・途中までしか届かなかった範囲。先に取り直す
+  std::deque<DownloadChunk> retryChunks;
+  // writeOffsetより先に届いたデータ(ファイル上の位置が鍵)
+  std::map<size_t, std::vector<uint8_t>> reorderBuffer;
+  // リクエスト中のもの。止めた後に届いたデータはIDが見つからないので捨てる
+  std::map<int, DownloadRequest> requests;
+  int nextRequestId = 1;
+  // readDownloaderRangeで読んでいるもの
+  std::map<int, DownloaderReadCallback> reads;
+
+  int consecutiveFailures = 0;
+  // これより前は失敗した範囲も新しい範囲もリクエストしない
+  double retryAfterMs = 0.0;
+  int retries = 0;
+  int failures = 0;
+
+  int targetConnections = INITIAL_DOWNLOAD_CONNECTIONS;
+  size_t chunkSize = INITIAL_CHUNK_SIZE;
+  bool rttMeasured = false;
+  double rttMs = DEFAULT_RTT_MS;
+  // 1接続あたりの転送速度(bytes/ms)。最初のバイトが届くまでを除いて測る
+  double connectionRate = 0.0;
+
+  double windowStart = 0.0;
+  size_t windowBytes = 0;
+  // 先読みの上限で止めていた場合は回線の速さを測れていない
+  bool windowThrottled = false;
+  double lastThroughput = 0.0;
+  double throughput = 0.0;
+  int adaptStep = 1;
+  int holdWindows = 0;
+};
+
+static DownloaderState state;
+
+// JSのUint8Arrayの先頭sizeバイトをdestにコピーする
+static void copyChunk(const emscripten::val &chunk, uint8_t *dest,
+                      size_t size) {
+  emscripten::val(emscripten::typed_memory_view(size, dest))
+      .call<void>("set", chunk.call<emscripten::val>("subarray", 0, size));
+}
+
+// ヘッダが届いたらdownloaderResponseにContent-Range
+// ("bytes 0-1023/4096"や"bytes */4096")の全体の大きさを渡す。
+// ボディは読めた分から順にdownloaderReceiveへ渡し、全部読むか、
+// 止められたかエラーになったらdownloaderFinishedを呼ぶ
+static void fetchRange(int id, size_t offset, size_t size) {
+  TRACE("request {} Range: bytes={}-{}", state.url, offset,
+        offset + size - 1);
+  // clang-format off
+  EM_ASM({
+    const id = $0;
+    const url = UTF8ToString($1);
+    const offset = $2;
+    const size = $3;
+    const range = 'bytes=' + offset + '-' + (offset + size - 1);
+    fetch(url, { headers: { 'Range': range } })
+      .then(async response => {
+        const contentRange = response.headers.get('Content-Range') || '';
+        const slash = contentRange.lastIndexOf('/');
+        const total =
+            slash >= 0 ? Number(contentRange.substring(slash + 1)) : NaN;
+        if (!Module['downloaderResponse'](id, response.status,
+                                          isNaN(total) ? -1 : total) ||
+            !response.body) {
+          if (response.body) response.body.cancel();
+          return false;
+        }
+        const reader = response.body.getReader();
+        while (true) {
+          const ret = await reader.read();
+          if (ret.done) return true;
+          if (!Module['downloaderReceive'](id, ret.value)) {
+            reader.cancel();
+            return false;
+          }
+        }
+      })
+      .catch(ex => {
+        console.error('downloader fetch error', ex);
+        return false;
+      })
+      .then(completed => Module['downloaderFinished'](id, completed));
+  }, id, state.url.c_str(), static_cast<double>(offset),
+     static_cast<double>(size));
+  // clang-format on
+}
+
+// 先頭から続いている分を入力バッファに書き込む
+static void flushReorderBuffer() {
+  while (!state.reorderBuffer.empty()) {
+    auto it = state.reorderBuffer.begin();
+    if (it->first != state.writeOffset) {
+      return;
+    }
+    uint8_t *dest = state.sink.reserve(it->second.size());
+    if (!dest) {
+      return;
+    }
+    memcpy(dest, it->second.data(), it->second.size());
+    feedGopIndex(it->first, dest, it->second.size());
+    state.sink.commit(it->second.size());
+    state.writeOffset += it->second.size();
+    state.reorderBuffer.erase(it);
+  }
+}
+
+// ファイルの終わりまで書き込んだら入力の終わりを知らせる
+static void finishIfComplete() {
+  if (state.ended || state.writeOffset < state.fileSize) {
+    return;
+  }
+  spdlog::info("download complete: {} bytes", state.fileSize);
+  state.ended = true;
+  state.sink.end();
+}
+
+// 大きさが分かったら、それより先はリクエストしない
+static void setFileSize(size_t fileSize) {
+  if (fileSize >= state.fileSize) {
+    return;
+  }
+  state.fileSize = fileSize;
+  state.nextOffset = std::min(state.nextOffset, fileSize);
+  std::deque<DownloadChunk> retryChunks;
+  for (const auto &chunk : state.retryChunks) {
+    if (chunk.offset < fileSize) {
+      retryChunks.push_back(
+          {chunk.offset, std::min(chunk.size, fileSize - chunk.offset)});
+    }
+  }
+  state.retryChunks = std::move(retryChunks);
+  finishIfComplete();
+}
+
+// 何度やっても成功しない。ここまでで入力を終わりにする
+static void giveUp() {
+  spdlog::error("download failed URL: {} at {} bytes", state.url,
+                state.writeOffset);
+  state.ended = true;
+  state.retryChunks.clear();
+  state.sink.end();
+}
+
+// 失敗した範囲は届いていない所から取り直す。
+// 続けて失敗するほど間を空ける
+static void retryLater(const DownloadChunk &chunk) {
+  state.failures++;
+  state.consecutiveFailures++;
+  if (state.consecutiveFailures >= MAX_CONSECUTIVE_FAILURES) {
+    giveUp();
+    return;
+  }
+  double delayMs =
+      std::min(INITIAL_RETRY_DELAY_MS *
+                   std::pow(2.0, state.consecutiveFailures - 1),
+               MAX_RETRY_DELAY_MS);
+  state.retryAfterMs = emscripten_get_now() + delayMs;
+  state.retryChunks.push_front(chunk);
+  spdlog::warn("download retry offset: {} size: {} in {:.0f}ms",
+               chunk.offset, chunk.size, delayMs);
+}
+
+static bool takeNextChunk(DownloadChunk &chunk) {
+  if (state.ended ||
+      static_cast<int>(state.requests.size()) >= state.targetConnections ||
+      emscripten_get_now() < state.retryAfterMs) {
+    return false;
+  }
+  if (!state.retryChunks.empty()) {
+    chunk = state.retryChunks.front();
+    state.retryChunks.pop_front();
+    state.retries++;
+    return true;
+  }
+  if (state.nextOffset >= state.fileSize) {
+    return false;
+  }
+  size_t pending = state.sink.bufferedSize() +
+                   (state.nextOffset - state.writeOffset);
+  if (pending >= DOWNLOAD_READAHEAD) {
+    state.windowThrottled = true;
+    return false;
+  }
+  chunk = {state.nextOffset,
+           std::min(state.chunkSize, state.fileSize - state.nextOffset)};
+  state.nextOffset += chunk.size;
+  return true;
+}
+
+// 接続数に空きがあれば次の範囲をリクエストする
+static void issueRequests() {
+  DownloadChunk chunk;
+  while (takeNextChunk(chunk)) {
+    int id = state.nextRequestId++;
+    state.requests[id] = {.chunk = chunk, .startMs = emscripten_get_now()};
+    fetchRange(id, chunk.offset, chunk.size);
+  }
+}
+
+static void adaptConnections(double now) {
+  if (state.windowStart == 0.0) {
+    state.windowStart = now;
+    return;
+  }
+  double elapsed = now - state.windowStart;
+  if (elapsed < ADAPT_WINDOW_MS) {
+    return;
+  }
+  state.throughput = state.windowBytes / elapsed;
+  if (!state.windowThrottled) {
+    if (state.holdWindows > 0) {
+      state.holdWindows--;
+    } else if (state.lastThroughput == 0.0 ||
+               state.throughput > state.lastThroughput * 1.1) {
+      // 伸びたので同じ向きにもう1つ動かす
+    } else if (state.adaptStep > 0) {
+      state.adaptStep = -1;
+    } else {
+      state.adaptStep = 1;
+      state.holdWindows = ADAPT_HOLD_WINDOWS;
+    }
+    if (state.holdWindows == 0) {
+      state.targetConnections =
+          std::clamp(state.targetConnections + state.adaptStep, 1,
+                     MAX_DOWNLOAD_CONNECTIONS);
+    }
+    state.lastThroughput = state.throughput;
+  }
+  state.windowStart = now;
+  state.windowBytes = 0;
+  state.windowThrottled = false;
+}
+
+// 1リクエストでRTTの分の待ちが小さくなり、かつ接続数分並べても
+// 先読みの上限に収まる大きさにする
+static void adaptChunkSize() {
+  double bytes = state.connectionRate * state.rttMs * CHUNK_RTT_RATIO;
+  size_t limit = DOWNLOAD_READAHEAD / (state.targetConnections + 1);
+  size_t size =
+      static_cast<size_t>(bytes) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+  state.chunkSize =
+      std::clamp(size, MIN_CHUNK_SIZE, std::min(MAX_CHUNK_SIZE, limit));
+}
+
+bool downloaderResponse(int id, int status, double totalSize) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  auto it = state.requests.find(id);
+  if (it == state.requests.end()) {
+    return false;
+  }
+  DownloadRequest &request = it->second;
+  request.status = status;
+  if (totalSize >= 0) {
+    setFileSize(static_cast<size_t>(totalSize));
+  }
+  // ファイルの終わりをまたぐ範囲はサーバが短くして返す
+  const DownloadChunk &chunk = request.chunk;
+  request.chunk.size =
+      std::min(chunk.size, state.fileSize - std::min(chunk.offset,
+                                                      state.fileSize));
+  return status == 206 && request.chunk.size > 0;
+}
+
+bool downloaderReceive(int id, emscripten::val chunk) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  auto it = state.requests.find(id);
+  if (it == state.requests.end()) {
+    return false;
+  }
+  DownloadRequest &request = it->second;
+  size_t remain = request.chunk.size - request.received;
+  size_t size = std::min(chunk["length"].as<size_t>(), remain);
+  if (request.received == 0) {
+    // 最初のバイトが届くまでの時間をRTTとみなす
+    request.firstByteMs = emscripten_get_now();
+    double rttMs = request.firstByteMs - request.startMs;
+    state.rttMs = state.rttMeasured ? std::min(state.rttMs, rttMs) : rttMs;
+    state.rttMeasured = true;
+  }
+
+  // 先頭の続きなら入力バッファに直接書き込み、そうでなければ並べ替えを待つ
+  size_t offset = request.chunk.offset + request.received;
+  uint8_t *dest =
+      offset == state.writeOffset ? state.sink.reserve(size) : nullptr;
+  if (dest) {
+    copyChunk(chunk, dest, size);
+    feedGopIndex(offset, dest, size);
+    state.sink.commit(size);
+    state.writeOffset += size;
+    flushReorderBuffer();
+  } else if (size > 0) {
+    auto &data = state.reorderBuffer[offset];
+    data.resize(size);
+    copyChunk(chunk, data.data(), size);
+  }
+  request.received += size;
+  state.windowBytes += size;
+  finishIfComplete();
+  return request.received < request.chunk.size;
+}
+
+void downloaderFinished(int id, bool completed) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  auto it = state.requests.find(id);
+  if (it == state.requests.end()) {
+    return;
+  }
+  DownloadRequest request = it->second;
+  state.requests.erase(it);
+  const DownloadChunk &chunk = request.chunk;
+  size_t endOffset = chunk.offset + request.received;
+  TRACE("fetch finished offset: {} size: {}/{} status: {}", chunk.offset,
+        request.received, chunk.size, request.status);
+
+  if (request.received == chunk.size) {
+    state.consecutiveFailures = 0;
+  } else if (request.status == 416) {
+    // 範囲の先頭がファイルの終わり以降だった
+    setFileSize(chunk.offset);
+  } else if (request.status == 206 && completed) {
+    // エラーなく終わったのに短いのはファイルの終わりに達したから
+    setFileSize(endOffset);
+  } else if (request.status == 200 ||
+             (request.status >= 400 && request.status < 500 &&
+              request.status != 408 && request.status != 429)) {
+    // Rangeに対応していないか、取り直しても変わらない
+    spdlog::error("fetch failed URL: {} status code: {}", state.url,
+                  request.status);
+    state.failures++;
+    giveUp();
+  } else {
+    retryLater({endOffset, chunk.size - request.received});
+  }
+
+  if (request.received > 0) {
+    double now = emscripten_get_now();
+    double transferMs = std::max(now - request.firstByteMs, 1.0);
+    double rate = request.received / transferMs;
+    state.connectionRate = state.connectionRate == 0.0
+                               ? rate
+                               : state.connectionRate * 0.7 + rate * 0.3;
+    adaptConnections(now);
+    adaptChunkSize();
+  }
+  flushReorderBuffer();
+  finishIfComplete();
+  issueRequests();
+}
+
+// size=0ならHEADでContent-Lengthだけ調べる
+static void fetchRead(int id, size_t offset, size_t size) {
+  // clang-format off
+  EM_ASM({
+    const id = $0;
+    const url = UTF8ToString($1);
+    const offset = $2;
+    const size = $3;
+    const range = 'bytes=' + offset + '-' + (offset + size - 1);
+    const init =
+        size > 0 ? { headers: { 'Range': range } } : { method: 'HEAD' };
+    fetch(url, init)
+      .then(async response => {
+        const contentRange = response.headers.get('Content-Range') || '';
+        const slash = contentRange.lastIndexOf('/');
+        const total = size > 0
+            ? Number(contentRange.substring(slash + 1))
+            : Number(response.headers.get('Content-Length'));
+        const data = size > 0 && response.status === 206
+            ? new Uint8Array(await response.arrayBuffer())
+            : new Uint8Array(0);
+        Module['downloaderReadDone'](id, response.status,
+                                     slash >= 0 || size == 0 ? total : -1,
+                                     data);
+      })
+      .catch(ex => {
+        console.error('downloader read error', ex);
+        Module['downloaderReadDone'](id, 0, -1, new Uint8Array(0));
+      });
+  }, id, state.url.c_str(), static_cast<double>(offset),
+     static_cast<double>(size));
+  // clang-format on
+}
+
+void readDownloaderRange(size_t offset, size_t size,
+                         DownloaderReadCallback callback) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (state.url.empty()) {
+    return;
+  }
+  int id = state.nextRequestId++;
+  state.reads[id] = std::move(callback);
+  fetchRead(id, offset, size);
+}
+
+void downloaderReadDone(int id, int status, double totalSize,
+                        emscripten::val data) {
+  DownloaderReadCallback callback;
+  std::vector<uint8_t> buffer;
+  {
+    std::lock_guard<std::mutex> lock(state.mtx);
+    auto it = state.reads.find(id);
+    if (it == state.reads.end()) {
+      return;
+    }
+    callback = std::move(it->second);
+    state.reads.erase(it);
+    // Number(null)などはNaNか0になる
+    if (totalSize > 0) {
+      setFileSize(static_cast<size_t>(totalSize));
+    }
+  }
+  buffer.resize(data["length"].as<size_t>());
+  copyChunk(data, buffer.data(), buffer.size());
+  // コールバックの中から次を読めるように、ロックの外で呼ぶ
+  callback(status, buffer);
+}
+
+// 接続数・チャンクの大きさ・RTTは測り直す
+static void startAt(size_t offset) {
+  state.requests.clear();
+  state.running = true;
+  state.ended = false;
+  state.nextOffset = offset;
+  state.writeOffset = offset;
+  state.consecutiveFailures = 0;
+  state.retryAfterMs = 0.0;
+  state.retries = 0;
+  state.failures = 0;
+  state.retryChunks.clear();
+  state.reorderBuffer.clear();
+  state.targetConnections = INITIAL_DOWNLOAD_CONNECTIONS;
+  state.chunkSize = INITIAL_CHUNK_SIZE;
+  state.rttMeasured = false;
+  state.rttMs = DEFAULT_RTT_MS;
+  state.connectionRate = 0.0;
+  state.windowStart = 0.0;
+  state.windowBytes = 0;
+  state.windowThrottled = false;
+  state.lastThroughput = 0.0;
+  state.throughput = 0.0;
+  state.adaptStep = 1;
+  state.holdWindows = 0;
+  issueRequests();
+}
+
+void startDownloader(const std::string &url, const DownloaderSink &sink) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.url = url;
+  state.sink = sink;
+  state.fileSize = UNKNOWN_FILE_SIZE;
+  state.reads.clear();
+  startAt(0);
+}
+
+void restartDownloader(size_t offset) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (state.url.empty()) {
+    return;
+  }
+  spdlog::info("restart download at {} bytes", offset);
+  startAt(std::min(offset, state.fileSize));
+}
+
+void stopDownloader() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.running = false;
+  state.requests.clear();
+  state.reads.clear();
+  state.retryChunks.clear();
+  state.reorderBuffer.clear();
+}
+
+void pumpDownloader() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (!state.running) {
+    return;
+  }
+  flushReorderBuffer();
+  finishIfComplete();
+  issueRequests();
+}
+
+DownloaderStats getDownloaderStats() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  return {
+      .active = state.running,
+      .connections = state.targetConnections,
+      .chunkSize = state.chunkSize,
+      .throughputMbps = state.throughput * 8.0 / 1000.0,
+      .rttMs = state.rttMs,
+      .retries = state.retries,
+      .failures = state.failures,
+      .fileSize = state.fileSize == UNKNOWN_FILE_SIZE ? 0 : state.fileSize,
+      .complete = state.ended && state.writeOffset >= state.fileSize,
+  };
+}
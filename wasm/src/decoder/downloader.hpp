@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <emscripten/val.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// 録画ファイルを複数のRangeリクエストで並列にダウンロードし、
+// 届いた順ではなくファイルの先頭から順に入力バッファへ書き込む。
+// 各リクエストはメインスレッドのfetchで読めた分から渡され、
+// 先頭の続きであればそのまま入力バッファに入る。
+// 同時接続数とチャンクの大きさは測ったスループットとRTTから決める
+
+struct DownloaderSink {
+  // 入力バッファに入っていて、まだ読まれていないバイト数
+  std::function<size_t()> bufferedSize;
+  // 書き込み先を返す。入力バッファに空きが足りなければnullptr
+  std::function<uint8_t *(size_t size)> reserve;
+  std::function<void(size_t size)> commit;
+  // ファイルの終わりまで書き込んだか、ダウンロードを諦めた
+  std::function<void()> end;
+};
+
+// statusは接続できなかった場合0。dataは206の場合だけ入る
+using DownloaderReadCallback =
+    std::function<void(int status, const std::vector<uint8_t> &data)>;
+
+struct DownloaderStats {
+  // 録画ファイルの再生中か
+  bool active;
+  int connections;
+  size_t chunkSize;
+  // 直近の全接続合計のスループット
+  double throughputMbps;
+  double rttMs;
+  // 失敗した範囲を取り直した回数と、失敗したリクエストの数
+  int retries;
+  int failures;
+  // 分からなければ0
+  size_t fileSize;
+  bool complete;
+};
+
+// start・pumpはメインスレッドから呼ぶ
+void startDownloader(const std::string &url, const DownloaderSink &sink);
+// リクエスト中のものは次にデータが届いたところで読むのをやめる
+void stopDownloader();
+// 同じURLのoffsetから入力バッファに書き込み直す。
+// 入力バッファは呼ぶ側で空にしておく
+void restartDownloader(size_t offset);
+// 入力バッファが読まれて空いた分だけ、並べ替え待ちを書き込み次をリクエストする
+void pumpDownloader();
+DownloaderStats getDownloaderStats();
+// 再生中のURLの一部を入力バッファとは別に読む。size=0なら大きさだけ調べる。
+// 分かったファイルの大きさはgetDownloaderStatsのfileSizeに入る
+void readDownloaderRange(size_t offset, size_t size,
+                         DownloaderReadCallback callback);
+
+// fetchのJSから呼ばれる。falseを返したらそのリクエストは読むのをやめる。
+// totalSizeはContent-Rangeから分からなければ-1
+bool downloaderResponse(int id, int status, double totalSize);
+bool downloaderReceive(int id, emscripten::val chunk);
+// completedはボディを最後までエラーなく読めたか
+void downloaderFinished(int id, bool completed);
+void downloaderReadDone(int id, int status, double totalSize,
+                        emscripten::val data);
@@ -0,0 +1,218 @@
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+#include "framepool.hpp"
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+// libavcodecはバッファ末尾を少し読み越すことがあるので余分に確保する
+const size_t VIDEO_BUFFER_PADDING = 64;
+
+// 1フレーム分(Y/U/V)を1つのバッファに連続して確保する。
+// WebGPU側はこれを1回のwriteBufferで送って、プレーンごとに
+// copyBufferToTextureで取り出す。
+struct VideoBufferPool {
+  std::mutex mtx;
+  AVBufferPool *pool = nullptr;
+  int width = 0;
+  int height = 0;
+  int linesize[3] = {};
+  size_t offset[3] = {};
+  size_t size = 0;
+  // NV12に詰め直したUVプレーン用
+  AVBufferPool *uvPool = nullptr;
+  int uvWidth = 0;
+  int uvHeight = 0;
+  int uvLinesize = 0;
+};
+
+static int alignUp(int value, int alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static void updateGeometry(VideoBufferPool &p, AVCodecContext *codecContext,
+                           int width, int height) {
+  int alignedWidth = width;
+  int alignedHeight = height;
+  int linesizeAlign[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(codecContext, &alignedWidth, &alignedHeight,
+                            linesizeAlign);
+
+  int chromaHeight = (alignedHeight + 1) / 2;
+  p.linesize[0] = alignUp(alignedWidth, VIDEO_BUFFER_ROW_ALIGNMENT);
+  p.linesize[1] = alignUp((alignedWidth + 1) / 2, VIDEO_BUFFER_ROW_ALIGNMENT);
+  p.linesize[2] = p.linesize[1];
+  p.offset[0] = 0;
+  p.offset[1] = static_cast<size_t>(p.linesize[0]) * alignedHeight;
+  p.offset[2] = p.offset[1] + static_cast<size_t>(p.linesize[1]) * chromaHeight;
+  p.size = p.offset[2] + static_cast<size_t>(p.linesize[2]) * chromaHeight +
+           VIDEO_BUFFER_PADDING;
+
+  // 貸し出し中のバッファは返却されたタイミングで解放される
+  av_buffer_pool_uninit(&p.pool);
+  p.pool = av_buffer_pool_init(p.size, nullptr);
+  p.width = width;
+  p.height = height;
+  spdlog::info("video buffer pool: {}x{} linesize:{}/{} size:{}", width,
+               height, p.linesize[0], p.linesize[1], p.size);
+}
+
+static int getVideoBuffer2(AVCodecContext *codecContext, AVFrame *frame,
+                           int flags) {
+  auto p = static_cast<VideoBufferPool *>(codecContext->opaque);
+  if (p == nullptr || frame->format != AV_PIX_FMT_YUV420P ||
+      !(codecContext->codec->capabilities & AV_CODEC_CAP_DR1)) {
+    return avcodec_default_get_buffer2(codecContext, frame, flags);
+  }
+
+  std::lock_guard<std::mutex> lock(p->mtx);
+  if (frame->width != p->width || frame->height != p->height) {
+    updateGeometry(*p, codecContext, frame->width, frame->height);
+  }
+  if (p->pool == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  frame->buf[0] = av_buffer_pool_get(p->pool);
+  if (frame->buf[0] == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  for (int i = 0; i < 3; i++) {
+    frame->data[i] = frame->buf[0]->data + p->offset[i];
+    frame->linesize[i] = p->linesize[i];
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+static void updateUvGeometry(VideoBufferPool &p, int width, int height) {
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  p.uvLinesize = alignUp(chromaWidth * 2, VIDEO_BUFFER_ROW_ALIGNMENT);
+  av_buffer_pool_uninit(&p.uvPool);
+  p.uvPool = av_buffer_pool_init(
+      static_cast<size_t>(p.uvLinesize) * chromaHeight + VIDEO_BUFFER_PADDING,
+      nullptr);
+  p.uvWidth = width;
+  p.uvHeight = height;
+}
+
+// U/Vを1バイトずつ交互に並べる
+static void interleaveChromaRow(uint8_t *dst, const uint8_t *u,
+                                const uint8_t *v, int width) {
+  int x = 0;
+#ifdef __wasm_simd128__
+  for (; x + 16 <= width; x += 16) {
+    v128_t uu = wasm_v128_load(u + x);
+    v128_t vv = wasm_v128_load(v + x);
+    wasm_v128_store(dst + 2 * x,
+                    wasm_i8x16_shuffle(uu, vv, 0, 16, 1, 17, 2, 18, 3, 19, 4,
+                                       20, 5, 21, 6, 22, 7, 23));
+    wasm_v128_store(dst + 2 * x + 16,
+                    wasm_i8x16_shuffle(uu, vv, 8, 24, 9, 25, 10, 26, 11, 27,
+                                       12, 28, 13, 29, 14, 30, 15, 31));
+  }
+#endif
+  for (; x < width; x++) {
+    dst[2 * x] = u[x];
+    dst[2 * x + 1] = v[x];
+  }
+}
+
+int packVideoFrameChroma(AVCodecContext *codecContext, const AVFrame *src,
+                         AVFrame *dst) {
+  auto p = static_cast<VideoBufferPool *>(codecContext->opaque);
+  if (p == nullptr || src->format != AV_PIX_FMT_YUV420P) {
+    return AVERROR(EINVAL);
+  }
+  AVBufferRef *yBuffer = av_frame_get_plane_buffer(src, 0);
+  if (yBuffer == nullptr) {
+    return AVERROR(EINVAL);
+  }
+
+  AVBufferRef *uvBuffer = nullptr;
+  int uvLinesize = 0;
+  {
+    std::lock_guard<std::mutex> lock(p->mtx);
+    if (src->width != p->uvWidth || src->height != p->uvHeight) {
+      updateUvGeometry(*p, src->width, src->height);
+    }
+    if (p->uvPool != nullptr) {
+      uvBuffer = av_buffer_pool_get(p->uvPool);
+    }
+    uvLinesize = p->uvLinesize;
+  }
+  if (uvBuffer == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+
+  int chromaWidth = (src->width + 1) / 2;
+  int chromaHeight = (src->height + 1) / 2;
+  for (int y = 0; y < chromaHeight; y++) {
+    size_t row = y;
+    interleaveChromaRow(uvBuffer->data + row * uvLinesize,
+                        src->data[1] + row * src->linesize[1],
+                        src->data[2] + row * src->linesize[2], chromaWidth);
+  }
+
+  dst->format = AV_PIX_FMT_NV12;
+  dst->width = src->width;
+  dst->height = src->height;
+  dst->buf[0] = av_buffer_ref(yBuffer);
+  dst->buf[1] = uvBuffer;
+  if (dst->buf[0] == nullptr) {
+    av_frame_unref(dst);
+    return AVERROR(ENOMEM);
+  }
+  dst->data[0] = src->data[0];
+  dst->linesize[0] = src->linesize[0];
+  dst->data[1] = uvBuffer->data;
+  dst->linesize[1] = uvLinesize;
+  dst->extended_data = dst->data;
+  int ret = av_frame_copy_props(dst, src);
+  if (ret < 0) {
+    av_frame_unref(dst);
+  }
+  return ret;
+}
+
+void setupVideoBufferPool(AVCodecContext *codecContext) {
+  codecContext->opaque = new VideoBufferPool();
+  codecContext->get_buffer2 = getVideoBuffer2;
+}
+
+void trimVideoBufferPool(AVCodecContext *codecContext) {
+  auto p = static_cast<VideoBufferPool *>(codecContext->opaque);
+  if (p == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(p->mtx);
+  // 貸し出し中のバッファは返却されたタイミングで解放される
+  av_buffer_pool_uninit(&p->pool);
+  av_buffer_pool_uninit(&p->uvPool);
+  p->width = p->height = 0;
+  p->uvWidth = p->uvHeight = 0;
+  spdlog::info("video buffer pool trimmed");
+}
+
+void releaseVideoBufferPool(AVCodecContext *codecContext) {
+  auto p = static_cast<VideoBufferPool *>(codecContext->opaque);
+  if (p == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(p->mtx);
+    av_buffer_pool_uninit(&p->pool);
+    av_buffer_pool_uninit(&p->uvPool);
+  }
+  codecContext->get_buffer2 = avcodec_default_get_buffer2;
+  codecContext->opaque = nullptr;
+  delete p;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// WebGPUのコピーで要求される行ピッチ(bytesPerRow)のアライメント
+const int VIDEO_BUFFER_ROW_ALIGNMENT = 256;
+
+// 行ピッチを揃えたバッファプールからデコードさせる(get_buffer2の差し替え)
+void setupVideoBufferPool(AVCodecContext *codecContext);
+void releaseVideoBufferPool(AVCodecContext *codecContext);
+// 使われていないバッファを解放する。次に必要になった時に確保し直す
+void trimVideoBufferPool(AVCodecContext *codecContext);
+
+// Y/U/Vの3プレーンのフレームを、U/Vを交互に並べたNV12(Y/UVの2プレーン)に
+// 詰め直す。Yプレーンは参照を共有するのでコピーはUVプレーンのみ。
+// 対応していない形式の場合は負のエラーコードを返す
+int packVideoFrameChroma(AVCodecContext *codecContext, const AVFrame *src,
+                         AVFrame *dst);
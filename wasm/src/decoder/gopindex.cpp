@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+#include "../util/trace.hpp"
+#include "gopindex.hpp"
+#include "seeker.hpp"
+
+const size_t TS_PACKET_SIZE = 188;
+const int GOP_INDEX_FORMAT_VERSION = 1;
+// 同じ範囲内でも、これ以上離れたキーフレームの間はシークに使わない
+// (録画の途中で止まっていた部分など)
+const double MAX_KEYFRAME_INTERVAL = 10.0;
+
+struct GopIndexState {
+  // ファイル上の位置順
+  std::map<size_t, GopIndexEntry> entries;
+  // 読み終わった範囲 [先頭, 終わり)
+  std::map<size_t, size_t> ranges;
+  // 今読んでいる範囲の先頭と、次に来るはずの位置
+  size_t rangeStart = 0;
+  size_t expectedOffset = SIZE_MAX;
+  // 前回に入りきらなかったTSパケットの前半
+  uint8_t carry[TS_PACKET_SIZE];
+  size_t carrySize = 0;
+  int videoPid = -1;
+  // 映像がH.264か(最初のNALがAUDなら)。それ以外はMPEG-2
+  bool h264 = false;
+};
+
+static GopIndexState state;
+
+// PESヘッダの33ビットのPTS
+static int64_t readPesTimestamp(const uint8_t *p) {
+  return (static_cast<int64_t>(p[0] & 0x0e) << 29) | (p[1] << 22) |
+         ((p[2] & 0xfe) << 14) | (p[3] << 7) | (p[4] >> 1);
+}
+
+// PESの先頭のパケットに入っているスタートコードから、
+// シーケンスヘッダ・Iフレームかどうかを見る
+static void scanStartCodes(const uint8_t *es, size_t size, bool &sequence,
+                           bool &keyframe) {
+  bool first = true;
+  for (size_t i = 0; i + 5 < size; i++) {
+    if (es[i] != 0 || es[i + 1] != 0 || es[i + 2] != 1) {
+      continue;
+    }
+    uint8_t code = es[i + 3];
+    if (first) {
+      state.h264 = code == 0x09;
+      first = false;
+    }
+    if (state.h264) {
+      int nalType = code & 0x1f;
+      sequence |= nalType == 7;
+      keyframe |= nalType == 5;
+    } else if (code == 0xb3) {
+      sequence = true;
+    } else if (code == 0x00) {
+      // picture_coding_type 1: I
+      keyframe |= ((es[i + 5] >> 3) & 0x07) == 1;
+    }
+  }
+}
+
+// 映像のPESの先頭のパケットならPTSと、シーケンスヘッダ・Iフレームを
+// 含むかを読んでtrue
+static bool readVideoPesStart(const uint8_t *packet, int64_t &pts,
+                              bool &sequence, bool &keyframe) {
+  bool unitStart = packet[1] & 0x40;
+  int adaptation = (packet[3] >> 4) & 0x03;
+  if (!unitStart || !(adaptation & 0x01)) {
+    return false;
+  }
+  size_t start = 4 + ((adaptation & 0x02) ? 1 + packet[4] : 0);
+  if (start + 14 > TS_PACKET_SIZE) {
+    return false;
+  }
+  const uint8_t *pes = packet + start;
+  size_t pesSize = TS_PACKET_SIZE - start;
+  // 映像のPES(stream_id 0xE0-0xEF)でPTSがあるもの
+  if (pes[0] != 0 || pes[1] != 0 || pes[2] != 1 || (pes[3] & 0xf0) != 0xe0 ||
+      !(pes[7] & 0x80)) {
+    return false;
+  }
+  int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+  if (state.videoPid < 0) {
+    state.videoPid = pid;
+  }
+  if (pid != state.videoPid) {
+    return false;
+  }
+  sequence = false;
+  keyframe = false;
+  size_t esStart = 9 + pes[8];
+  if (esStart < pesSize) {
+    scanStartCodes(pes + esStart, pesSize - esStart, sequence, keyframe);
+  }
+  // 放送のMPEG-2ではシーケンスヘッダはGOPの先頭(Iフレームの直前)にだけ入る。
+  // 量子化マトリクスが長いとピクチャヘッダは次のパケットにずれる
+  if (!state.h264 && sequence) {
+    keyframe = true;
+  }
+  pts = readPesTimestamp(pes + 9);
+  return true;
+}
+
+static void indexPacket(size_t offset, const uint8_t *packet) {
+  int64_t pts;
+  bool sequence;
+  bool keyframe;
+  if (!readVideoPesStart(packet, pts, sequence, keyframe) ||
+      (!sequence && !keyframe)) {
+    return;
+  }
+  TRACE("gop index offset:{} pts:{} key:{}", offset, pts, keyframe);
+  state.entries[offset] = {offset, pts, keyframe};
+}
+
+// 今読んでいる範囲を記録し、隣の範囲とつながったらまとめる
+static void extendRange(size_t end) {
+  size_t start = state.rangeStart;
+  auto it = state.ranges.lower_bound(start);
+  if (it != state.ranges.begin() && std::prev(it)->second >= start) {
+    --it;
+    start = it->first;
+  }
+  while (it != state.ranges.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = state.ranges.erase(it);
+  }
+  state.ranges[start] = end;
+  state.rangeStart = start;
+}
+
+void feedGopIndex(size_t offset, const uint8_t *data, size_t size) {
+  if (offset != state.expectedOffset) {
+    state.carrySize = 0;
+    state.rangeStart = offset;
+  }
+  state.expectedOffset = offset + size;
+
+  // 前回の残りを1パケットにしてから、続きはdataから直接読む
+  size_t pos = 0;
+  if (state.carrySize > 0) {
+    size_t need = std::min(TS_PACKET_SIZE - state.carrySize, size);
+    memcpy(state.carry + state.carrySize, data, need);
+    state.carrySize += need;
+    pos = need;
+    if (state.carrySize < TS_PACKET_SIZE) {
+      return;
+    }
+    if (state.carry[0] == 0x47) {
+      indexPacket(offset - (TS_PACKET_SIZE - need), state.carry);
+    }
+    state.carrySize = 0;
+  }
+  while (pos + TS_PACKET_SIZE <= size) {
+    if (data[pos] != 0x47) {
+      pos++;
+      continue;
+    }
+    indexPacket(offset + pos, data + pos);
+    pos += TS_PACKET_SIZE;
+  }
+  memcpy(state.carry, data + pos, size - pos);
+  state.carrySize = size - pos;
+  extendRange(offset + pos);
+}
+
+// offsetを含む読み終わった範囲の終わり。含まれなければ0
+static size_t rangeEndOf(size_t offset) {
+  auto it = state.ranges.upper_bound(offset);
+  if (it == state.ranges.begin()) {
+    return 0;
+  }
+  --it;
+  return offset < it->second ? it->second : 0;
+}
+
+bool findGopIndexKeyframe(double seconds, GopIndexEntry &entry) {
+  // 位置順に見て、secondsを挟む隣り合ったキーフレームの組を探す
+  const GopIndexEntry *prev = nullptr;
+  double prevTime = 0.0;
+  for (const auto &[offset, current] : state.entries) {
+    if (!current.keyframe) {
+      continue;
+    }
+    double time = recordingTimeFromPts(current.pts);
+    if (std::isnan(time)) {
+      return false;
+    }
+    if (prev && prevTime <= seconds && seconds < time &&
+        time - prevTime < MAX_KEYFRAME_INTERVAL &&
+        rangeEndOf(prev->offset) > current.offset) {
+      entry = *prev;
+      return true;
+    }
+    prev = &current;
+    prevTime = time;
+  }
+  return false;
+}
+
+bool findAdjacentKeyframe(double seconds, int direction,
+                          GopIndexEntry &entry) {
+  bool found = false;
+  double bestTime = 0.0;
+  for (const auto &[offset, current] : state.entries) {
+    if (!current.keyframe) {
+      continue;
+    }
+    double time = recordingTimeFromPts(current.pts);
+    if (std::isnan(time) || (direction < 0 ? time >= seconds
+                                           : time <= seconds)) {
+      continue;
+    }
+    if (!found ||
+        (direction < 0 ? time > bestTime : time < bestTime)) {
+      entry = current;
+      bestTime = time;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool findKeyframePes(const uint8_t *data, size_t size, GopIndexEntry &entry,
+                     size_t &end) {
+  bool found = false;
+  end = 0;
+  size_t pos = 0;
+  while (pos + TS_PACKET_SIZE <= size) {
+    if (data[pos] != 0x47) {
+      pos++;
+      continue;
+    }
+    int64_t pts;
+    bool sequence;
+    bool keyframe;
+    if (readVideoPesStart(data + pos, pts, sequence, keyframe)) {
+      if (found) {
+        end = pos + TS_PACKET_SIZE;
+        break;
+      }
+      if (keyframe) {
+        entry = {pos, pts, true};
+        found = true;
+      }
+    }
+    pos += TS_PACKET_SIZE;
+  }
+  return found;
+}
+
+size_t getGopIndexSize() { return state.entries.size(); }
+
+void resetGopIndex() {
+  state.entries.clear();
+  state.ranges.clear();
+  state.rangeStart = 0;
+  state.expectedOffset = SIZE_MAX;
+  state.carrySize = 0;
+  state.videoPid = -1;
+  state.h264 = false;
+}
+
+// [版, 範囲の数, (先頭, 終わり)..., 記録の数, (位置, PTS, キー)...]
+emscripten::val exportGopIndex() {
+  std::vector<double> values;
+  values.reserve(3 + state.ranges.size() * 2 + state.entries.size() * 3);
+  values.push_back(GOP_INDEX_FORMAT_VERSION);
+  values.push_back(state.ranges.size());
+  for (const auto &[start, end] : state.ranges) {
+    values.push_back(start);
+    values.push_back(end);
+  }
+  values.push_back(state.entries.size());
+  for (const auto &[offset, entry] : state.entries) {
+    values.push_back(offset);
+    values.push_back(entry.pts);
+    values.push_back(entry.keyframe ? 1 : 0);
+  }
+  // wasmのメモリを指したままにしないようコピーして返す
+  return emscripten::val(
+             emscripten::typed_memory_view(values.size(), values.data()))
+      .call<emscripten::val>("slice");
+}
+
+void importGopIndex(emscripten::val data) {
+  std::vector<double> values(data["length"].as<size_t>());
+  emscripten::val(emscripten::typed_memory_view(values.size(), values.data()))
+      .call<void>("set", data);
+  size_t pos = 0;
+  auto next = [&]() { return pos < values.size() ? values[pos++] : -1.0; };
+  if (next() != GOP_INDEX_FORMAT_VERSION) {
+    spdlog::warn("gop index: unknown format");
+    return;
+  }
+  double rangeCount = next();
+  for (int i = 0; i < rangeCount && pos + 2 <= values.size(); i++) {
+    size_t start = static_cast<size_t>(next());
+    size_t end = static_cast<size_t>(next());
+    state.rangeStart = start;
+    extendRange(end);
+  }
+  double entryCount = next();
+  for (int i = 0; i < entryCount && pos + 3 <= values.size(); i++) {
+    size_t offset = static_cast<size_t>(next());
+    int64_t pts = static_cast<int64_t>(next());
+    bool keyframe = next() != 0.0;
+    state.entries[offset] = {offset, pts, keyframe};
+  }
+  // 次に届いたデータは新しい範囲として扱う
+  state.expectedOffset = SIZE_MAX;
+  state.carrySize = 0;
+  spdlog::info("gop index: imported {} entries in {} ranges",
+               state.entries.size(), state.ranges.size());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <emscripten/val.h>
+
+// ダウンロードした録画ファイルを書き込みながらTSパケットを見て、
+// シーケンスヘッダかIフレームを含む映像PESの位置とPTSを記録する。
+// 読み終わった範囲の中へのシークは、ここからすぐにバイト位置が分かる。
+// すべてメインスレッドから呼ぶ
+
+struct GopIndexEntry {
+  // PESの先頭のTSパケットのファイル上の位置
+  size_t offset;
+  // 90kHz
+  int64_t pts;
+  // Iフレーム(H.264ならIDR)を含む。falseならシーケンスヘッダだけ
+  bool keyframe;
+};
+
+void resetGopIndex();
+// offsetはdataのファイル上の位置。続いていなければ新しい範囲として見る
+void feedGopIndex(size_t offset, const uint8_t *data, size_t size);
+// secondsを挟む索引済みの範囲があれば、seconds以前で最後のキーフレーム
+bool findGopIndexKeyframe(double seconds, GopIndexEntry &entry);
+// secondsより前(direction < 0)または後で一番近いキーフレーム
+bool findAdjacentKeyframe(double seconds, int direction,
+                          GopIndexEntry &entry);
+// dataの中で最初のキーフレームのPESを探す。entry.offsetはdataの中の位置。
+// endには次の映像のPESの最初のTSパケットの終わりを入れ、まだ無ければ0
+bool findKeyframePes(const uint8_t *data, size_t size, GopIndexEntry &entry,
+                     size_t &end);
+size_t getGopIndexSize();
+// JSで保存・復元するためのFloat64Array
+emscripten::val exportGopIndex();
+void importGopIndex(emscripten::val data);
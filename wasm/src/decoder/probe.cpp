@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+#include "probe.hpp"
+
+// 1フレームの表示期間に対して、デコードに使ってよい割合。
+// 表示・音声・UIの分を残し、Iフレームでの揺れも吸収できるようにする
+const double FULL_DECODE_BUDGET = 0.35;
+const double FAST_DECODE_BUDGET = 0.6;
+const double HALF_DECODE_BUDGET = 1.0;
+// インターレース解除に使ってよい割合
+const double DEINTERLACE_BUDGET = 0.25;
+
+const int DEFAULT_VIDEO_QUEUE_DEPTH = 30;
+const int SLOW_VIDEO_QUEUE_DEPTH = 45;
+const int MAX_DECODE_THREADS = 4;
+
+CapabilitySettings chooseCapabilitySettings(const CapabilityMeasurement &m) {
+  double frameMs = 1000.0 / (m.contentFps > 0 ? m.contentFps : 29.97);
+  // CPUで描画している場合はyadifもデコードと同じくCPUの負荷になる
+  double cpuMs = m.videoDecodeMs + m.audioMsPerSecond * frameMs / 1000.0;
+  if (m.softwareRenderer) {
+    cpuMs += m.rendererFrameMs;
+  }
+  double cpuLoad = cpuMs / frameMs;
+
+  CapabilitySettings settings;
+  if (cpuLoad < FULL_DECODE_BUDGET) {
+    settings.qualityTier = 0;
+  } else if (cpuLoad < FAST_DECODE_BUDGET) {
+    settings.qualityTier = 1;
+  } else if (cpuLoad < HALF_DECODE_BUDGET) {
+    settings.qualityTier = 2;
+  } else {
+    settings.qualityTier = 3;
+  }
+
+  // 余裕がない場合だけスライス並列でデコードする。
+  // メイン・表示・音声・デコーダの各スレッドの分は残す
+  settings.decodeThreads = 1;
+  if (cpuLoad >= FULL_DECODE_BUDGET) {
+    settings.decodeThreads =
+        std::clamp(m.hardwareThreads - 3, 1, MAX_DECODE_THREADS);
+  }
+
+  settings.deinterlace = m.rendererFrameMs / frameMs < DEINTERLACE_BUDGET;
+  // デコードが重い環境ではIフレームでの遅れを吸収できるよう深めにする
+  settings.videoQueueDepth = settings.qualityTier > 0
+                                 ? SLOW_VIDEO_QUEUE_DEPTH
+                                 : DEFAULT_VIDEO_QUEUE_DEPTH;
+
+  spdlog::info("capability probe: decode:{:.2f}ms renderer:{:.2f}ms{} "
+               "audio:{:.2f}ms/s fps:{:.2f} threads:{} => tier:{} "
+               "decodeThreads:{} deinterlace:{} queue:{}",
+               m.videoDecodeMs, m.rendererFrameMs,
+               m.softwareRenderer ? "(cpu)" : "", m.audioMsPerSecond,
+               m.contentFps, m.hardwareThreads, settings.qualityTier,
+               settings.decodeThreads, settings.deinterlace,
+               settings.videoQueueDepth);
+  return settings;
+}
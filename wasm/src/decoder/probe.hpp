@@ -0,0 +1,28 @@
+#pragma once
+
+// 初回再生時に負荷を測って、その環境に合う設定を選ぶ。
+// 測定には実際に再生中のストリームを使い、結果はJS側でlocalStorageに
+// 保存して次回以降は測り直さない
+
+struct CapabilityMeasurement {
+  // 映像1フレームのデコード時間(ms)
+  double videoDecodeMs;
+  // 1フレームのインターレース解除・色変換の時間(ms)
+  double rendererFrameMs;
+  bool softwareRenderer;
+  // 音声1秒分の変換(リサンプル・AudioWorkletへの受け渡し)にかかる時間(ms)
+  double audioMsPerSecond;
+  double contentFps;
+  int hardwareThreads;
+};
+
+struct CapabilitySettings {
+  // decoder.cppのQualityTier
+  int qualityTier;
+  int decodeThreads;
+  bool deinterlace;
+  // デコード済みの映像フレームを先読みしておく数
+  int videoQueueDepth;
+};
+
+CapabilitySettings chooseCapabilitySettings(const CapabilityMeasurement &m);
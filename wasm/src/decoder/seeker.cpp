@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+#include "../util/trace.hpp"
+#include "downloader.hpp"
+#include "gopindex.hpp"
+#include "seeker.hpp"
+
+const size_t TS_PACKET_SIZE = 188;
+// PCRは100ms以内の間隔で入るので、高いビットレートでも1つは含まれる
+const size_t SEEK_PROBE_SIZE = 256 * 1024;
+const int64_t PCR_WRAP = 1LL << 33;
+const double PCR_CLOCK = 90000.0;
+// キーフレーム(0.5秒程度ごと)を目標より手前で拾えるよう、少し前に着地する
+const double SEEK_PREROLL = 0.5;
+// 着地点の時刻が目標からこれ以内の手前なら探すのをやめる
+const double SEEK_ACCURACY = 0.5;
+const int MAX_SEEK_PROBES = 12;
+
+struct SeekerState {
+  // ファイルが変わったら増やし、前のファイルの読み込み結果を捨てる
+  int generation = 0;
+  int pcrPid = -1;
+  int64_t firstPcr = -1;
+  double duration = 0.0;
+  size_t fileSize = 0;
+
+  bool searching = false;
+  int searchId = 0;
+  double target = 0.0;
+  size_t lo = 0;
+  size_t hi = 0;
+  double loTime = 0.0;
+  double hiTime = 0.0;
+  int probes = 0;
+  std::function<void(size_t)> callback;
+};
+
+static SeekerState state;
+
+static int findTsSync(const std::vector<uint8_t> &data) {
+  for (size_t i = 0; i < TS_PACKET_SIZE && i < data.size(); i++) {
+    if (data[i] == 0x47 &&
+        (i + TS_PACKET_SIZE >= data.size() ||
+         data[i + TS_PACKET_SIZE] == 0x47) &&
+        (i + TS_PACKET_SIZE * 2 >= data.size() ||
+         data[i + TS_PACKET_SIZE * 2] == 0x47)) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// adaptation_fieldにPCRがあれば取り出す
+static bool readPcr(const uint8_t *packet, int &pid, int64_t &pcr) {
+  bool hasAdaptation = packet[3] & 0x20;
+  if (!hasAdaptation || packet[4] < 7 || !(packet[5] & 0x10)) {
+    return false;
+  }
+  pid = ((packet[1] & 0x1f) << 8) | packet[2];
+  pcr = (static_cast<int64_t>(packet[6]) << 25) |
+        (static_cast<int64_t>(packet[7]) << 17) | (packet[8] << 9) |
+        (packet[9] << 1) | (packet[10] >> 7);
+  return true;
+}
+
+// 先頭(lastなら最後)のPCRを探す。PCRのPIDが決まっていなければ
+// 最初に見つかったものに決める
+static bool findPcr(const std::vector<uint8_t> &data, bool last,
+                    int64_t &pcr) {
+  int sync = findTsSync(data);
+  if (sync < 0) {
+    return false;
+  }
+  bool found = false;
+  for (size_t i = sync; i + TS_PACKET_SIZE <= data.size();
+       i += TS_PACKET_SIZE) {
+    int pid;
+    int64_t packetPcr;
+    if (data[i] != 0x47 || !readPcr(&data[i], pid, packetPcr)) {
+      continue;
+    }
+    if (state.pcrPid < 0) {
+      state.pcrPid = pid;
+    }
+    if (pid != state.pcrPid) {
+      continue;
+    }
+    pcr = packetPcr;
+    found = true;
+    if (!last) {
+      break;
+    }
+  }
+  return found;
+}
+
+// 先頭のPCRからの秒数。33ビットで一周するのを考慮する
+static double pcrToTime(int64_t pcr) {
+  return ((pcr - state.firstPcr) % PCR_WRAP + PCR_WRAP) % PCR_WRAP /
+         PCR_CLOCK;
+}
+
+static void finishSearch(size_t offset) {
+  state.searching = false;
+  spdlog::info("seek: target:{:.1f}s offset:{} probes:{}", state.target,
+               offset, state.probes);
+  auto callback = std::move(state.callback);
+  state.callback = nullptr;
+  callback(offset);
+}
+
+static void probeNext();
+
+static void onProbe(int searchId, size_t offset, int status,
+                    const std::vector<uint8_t> &data) {
+  if (!state.searching || searchId != state.searchId) {
+    return;
+  }
+  int64_t pcr;
+  if (status != 206 || !findPcr(data, false, pcr)) {
+    spdlog::warn("seek: no PCR at {} status:{}", offset, status);
+    finishSearch(state.lo);
+    return;
+  }
+  double time = pcrToTime(pcr);
+  TRACE("seek probe offset:{} time:{:.2f}s", offset, time);
+  state.probes++;
+  if (time <= state.target) {
+    state.lo = offset;
+    state.loTime = time;
+    if (state.target - time < SEEK_ACCURACY) {
+      finishSearch(offset);
+      return;
+    }
+  } else {
+    state.hi = offset;
+    state.hiTime = time;
+  }
+  probeNext();
+}
+
+// ビットレートがほぼ一定なので時刻で内挿した位置を読む。
+// 外れても範囲が必ず縮むよう両端から1/16は空ける
+static void probeNext() {
+  size_t span = state.hi - state.lo;
+  if (state.probes >= MAX_SEEK_PROBES || span <= SEEK_PROBE_SIZE ||
+      state.hiTime <= state.loTime) {
+    finishSearch(state.lo);
+    return;
+  }
+  double ratio =
+      (state.target - state.loTime) / (state.hiTime - state.loTime);
+  size_t offset = state.lo + static_cast<size_t>(span * ratio);
+  offset = std::clamp(offset, state.lo + span / 16, state.hi - span / 16);
+  offset = offset / TS_PACKET_SIZE * TS_PACKET_SIZE;
+  int searchId = state.searchId;
+  readDownloaderRange(offset, SEEK_PROBE_SIZE,
+                      [searchId, offset](int status, const auto &data) {
+                        onProbe(searchId, offset, status, data);
+                      });
+}
+
+static void startSearch() {
+  state.target = std::min(state.target, state.duration);
+  state.lo = 0;
+  state.loTime = 0.0;
+  state.hi = state.fileSize;
+  state.hiTime = state.duration;
+  state.probes = 0;
+  probeNext();
+}
+
+static void onTail(int generation, int status,
+                   const std::vector<uint8_t> &data) {
+  if (generation != state.generation) {
+    return;
+  }
+  int64_t lastPcr;
+  if (status != 206 || !findPcr(data, true, lastPcr)) {
+    spdlog::warn("seeker: no PCR at the end status:{}", status);
+    return;
+  }
+  state.duration = pcrToTime(lastPcr);
+  spdlog::info("seeker: duration:{:.1f}s size:{}", state.duration,
+               state.fileSize);
+  if (state.searching) {
+    startSearch();
+  }
+}
+
+static void readTail(int generation) {
+  state.fileSize = getDownloaderStats().fileSize;
+  if (state.fileSize == 0) {
+    spdlog::warn("seeker: file size unknown");
+    return;
+  }
+  size_t size = std::min(SEEK_PROBE_SIZE, state.fileSize);
+  readDownloaderRange(state.fileSize - size, size,
+                      [generation](int status, const auto &data) {
+                        onTail(generation, status, data);
+                      });
+}
+
+static void onHead(int generation, int status,
+                   const std::vector<uint8_t> &data) {
+  if (generation != state.generation) {
+    return;
+  }
+  if (status != 206 || !findPcr(data, false, state.firstPcr)) {
+    spdlog::warn("seeker: no PCR at the start status:{}", status);
+    return;
+  }
+  spdlog::info("seeker: PCR PID:{} first PCR:{}", state.pcrPid,
+               state.firstPcr);
+  // Content-Rangeが読めなければHEADのContent-Lengthで調べる
+  if (getDownloaderStats().fileSize == 0) {
+    readDownloaderRange(0, 0, [generation](int, const auto &) {
+      if (generation == state.generation) {
+        readTail(generation);
+      }
+    });
+  } else {
+    readTail(generation);
+  }
+}
+
+void startSeeker() {
+  resetSeeker();
+  int generation = state.generation;
+  readDownloaderRange(0, SEEK_PROBE_SIZE,
+                      [generation](int status, const auto &data) {
+                        onHead(generation, status, data);
+                      });
+}
+
+void resetSeeker() {
+  state.generation++;
+  state.pcrPid = -1;
+  state.firstPcr = -1;
+  state.duration = 0.0;
+  state.fileSize = 0;
+  state.searching = false;
+  state.callback = nullptr;
+}
+
+void findSeekOffset(double seconds, std::function<void(size_t)> callback) {
+  GopIndexEntry entry;
+  if (findGopIndexKeyframe(seconds, entry)) {
+    // 前に探していたものは捨てる
+    state.searching = false;
+    state.searchId++;
+    state.callback = nullptr;
+    spdlog::info("seek: target:{:.1f}s offset:{} (indexed)", seconds,
+                 entry.offset);
+    callback(entry.offset);
+    return;
+  }
+  state.searching = true;
+  state.searchId++;
+  state.target = std::max(seconds - SEEK_PREROLL, 0.0);
+  state.callback = std::move(callback);
+  // 長さが分かってから探す
+  if (state.duration > 0.0) {
+    startSearch();
+  }
+}
+
+double getRecordingPosition(double mediaTime) {
+  if (state.firstPcr < 0 || std::isnan(mediaTime)) {
+    return NAN;
+  }
+  return pcrToTime(static_cast<int64_t>(mediaTime * PCR_CLOCK));
+}
+
+double recordingTimeFromPts(int64_t pts) {
+  if (state.firstPcr < 0) {
+    return NAN;
+  }
+  return pcrToTime(pts);
+}
+
+double getRecordingDuration() { return state.duration; }
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// 録画ファイルの再生位置(先頭のPCRからの秒数)とバイト位置を対応させる。
+// 先頭と末尾のPCRを読んで長さを求めておき、シークではその間を
+// PCRを読みながら時刻で内挿して絞り込む。すべてメインスレッドから呼ぶ
+
+// 再生するファイルが変わったら呼ぶ。先頭と末尾を読んで長さを調べ始める
+void startSeeker();
+void resetSeeker();
+// secondsの少し手前(キーフレームを拾える位置)のバイト位置を探して
+// callbackに渡す。索引済みの範囲ならその場でキーフレームの位置を渡し、
+// そうでなければ長さが分かってから探す。
+// 探している間に次が呼ばれたら前の結果は捨てる
+void findSeekOffset(double seconds, std::function<void(size_t)> callback);
+// ストリームの時刻(秒)を先頭からの秒数にする。分からなければNaN
+double getRecordingPosition(double mediaTime);
+// 90kHzのPTSを先頭からの秒数にする。分からなければNaN
+double recordingTimeFromPts(int64_t pts);
+// 分からなければ0
+double getRecordingDuration();
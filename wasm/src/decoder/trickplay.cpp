@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emscripten/emscripten.h>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+#include "../util/trace.hpp"
+#include "downloader.hpp"
+#include "gopindex.hpp"
+#include "seeker.hpp"
+#include "trickplay.hpp"
+
+const size_t TS_PACKET_SIZE = 188;
+// 索引にあるキーフレームは先頭から読み、PESが終わらなければ続きを読む
+const size_t TRICK_READ_SIZE = 256 * 1024;
+// 索引に無い所は1GOPより大きく読み、その中のキーフレームを探す
+const size_t TRICK_PROBE_SIZE = 1024 * 1024;
+// これより大きいキーフレームは読めた所までで諦める
+const size_t MAX_KEYFRAME_SIZE = 4 * 1024 * 1024;
+// 書き込んだキーフレームがまだこれ以上読まれていなければ次を読まない
+const size_t TRICK_MAX_BUFFERED = 512 * 1024;
+// read_packetはAVIOのバッファ(64KB)分溜まるまで待つので、書き込んだ
+// キーフレームが読まれずに残らないよう後ろをNULLパケットで埋める
+const size_t TRICK_PADDING_SIZE = 64 * 1024 / TS_PACKET_SIZE * TS_PACKET_SIZE +
+                                  TS_PACKET_SIZE;
+// 索引に無い所を読みに行くのは、仮想の再生位置がこれだけ動いてから
+const double TRICK_PROBE_STEP = 1.0;
+// 読めなかったら少し待ってから読み直す
+const double TRICK_RETRY_MS = 500.0;
+
+struct TrickPlayState {
+  int rate = 0;
+  // 入力バッファを空にし終えるのを待っている
+  bool waiting = false;
+  TrickPlaySink sink;
+  // 倍率に合わせて進める仮想の再生位置(秒)と、最後に進めた時刻(ms)
+  double position = 0.0;
+  double lastTick = 0.0;
+  // 最後に書き込んだキーフレーム
+  double shownTime = NAN;
+  size_t shownOffset = 0;
+  bool shown = false;
+  // 最後に索引に無い所を読みに行った仮想の再生位置
+  double probeTime = NAN;
+  double nextReadTime = 0.0;
+
+  // 止めたり読み直したりしたら増やし、前に読んでいた結果を捨てる
+  int generation = 0;
+  bool reading = false;
+  size_t readOffset = 0;
+  std::vector<uint8_t> data;
+};
+
+static TrickPlayState state;
+
+bool isTrickPlayRate(int rate) {
+  int speed = std::abs(rate);
+  return speed == 2 || speed == 4 || speed == 8 || speed == 16;
+}
+
+// 向きに沿って、最後に書き込んだものより先のキーフレームか
+static bool isAhead(double time) {
+  if (std::isnan(time)) {
+    return false;
+  }
+  if (!state.shown) {
+    return true;
+  }
+  return state.rate > 0 ? time > state.shownTime : time < state.shownTime;
+}
+
+// キーフレームのPESを入力バッファに書き、後ろをNULLパケットで埋める。
+// 入力バッファに空きが無ければfalse
+static bool writeKeyframe(const uint8_t *data, size_t size) {
+  size_t total = size + TRICK_PADDING_SIZE;
+  uint8_t *buffer = state.sink.reserve(total);
+  if (!buffer) {
+    spdlog::warn("trick play: input buffer full");
+    return false;
+  }
+  memcpy(buffer, data, size);
+  for (size_t pos = size; pos < total; pos += TS_PACKET_SIZE) {
+    uint8_t *packet = buffer + pos;
+    packet[0] = 0x47;
+    packet[1] = 0x1f;
+    packet[2] = 0xff;
+    packet[3] = 0x10;
+    memset(packet + 4, 0xff, TS_PACKET_SIZE - 4);
+  }
+  state.sink.commit(total);
+  return true;
+}
+
+static void readChunk(size_t offset, size_t size);
+
+static void onRead(int generation, size_t offset, size_t size, int status,
+                   const std::vector<uint8_t> &data) {
+  if (generation != state.generation) {
+    return;
+  }
+  if (status != 206 || data.empty()) {
+    spdlog::warn("trick play: read failed at {} status:{}", offset, status);
+    state.reading = false;
+    state.nextReadTime = emscripten_get_now() + TRICK_RETRY_MS;
+    return;
+  }
+  // 読んだ所も索引に入れておき、次からは索引から探す
+  feedGopIndex(offset, data.data(), data.size());
+  state.data.insert(state.data.end(), data.begin(), data.end());
+
+  GopIndexEntry keyframe;
+  size_t end;
+  if (!findKeyframePes(state.data.data(), state.data.size(), keyframe, end)) {
+    TRACE("trick play: no keyframe in {} bytes at {}", state.data.size(),
+          state.readOffset);
+    state.reading = false;
+    return;
+  }
+  // 短ければファイルの終わりなので、続きは読まない
+  if (end == 0 && state.data.size() - keyframe.offset < MAX_KEYFRAME_SIZE &&
+      data.size() == size) {
+    readChunk(offset + data.size(), TRICK_READ_SIZE);
+    return;
+  }
+  state.reading = false;
+  if (end == 0) {
+    end = keyframe.offset + (state.data.size() - keyframe.offset) /
+                                TS_PACKET_SIZE * TS_PACKET_SIZE;
+  }
+  double time = recordingTimeFromPts(keyframe.pts);
+  if (!isAhead(time)) {
+    return;
+  }
+  // 書けなかったものは出ていないので、次も同じキーフレームを読み直す
+  if (!writeKeyframe(state.data.data() + keyframe.offset,
+                     end - keyframe.offset)) {
+    state.nextReadTime = emscripten_get_now() + TRICK_RETRY_MS;
+    return;
+  }
+  state.shownTime = time;
+  state.shownOffset = state.readOffset + keyframe.offset;
+  state.shown = true;
+  TRACE("trick play: keyframe time:{:.2f}s offset:{} size:{}", time,
+        state.shownOffset, end - keyframe.offset);
+}
+
+static void readChunk(size_t offset, size_t size) {
+  int generation = state.generation;
+  readDownloaderRange(
+      offset, size, [generation, offset, size](int status, const auto &data) {
+        onRead(generation, offset, size, status, data);
+      });
+}
+
+static void readKeyframe(size_t offset, size_t size) {
+  state.reading = true;
+  state.readOffset = offset;
+  state.data.clear();
+  readChunk(offset, size);
+}
+
+// 索引に無い所は、ビットレートがほぼ一定としてバイト位置を見積もって読む。
+// 巻き戻しでは仮想の再生位置より手前のキーフレームを拾えるよう1回分前から読む
+static void probeKeyframe(double duration) {
+  size_t fileSize = getDownloaderStats().fileSize;
+  if (fileSize == 0) {
+    return;
+  }
+  state.probeTime = state.position;
+  size_t offset = static_cast<size_t>(fileSize * (state.position / duration));
+  if (state.rate < 0) {
+    offset = offset > TRICK_PROBE_SIZE ? offset - TRICK_PROBE_SIZE : 0;
+  }
+  offset = std::min(offset, fileSize > TRICK_PROBE_SIZE
+                                ? fileSize - TRICK_PROBE_SIZE
+                                : 0);
+  offset = offset / TS_PACKET_SIZE * TS_PACKET_SIZE;
+  readKeyframe(offset, TRICK_PROBE_SIZE);
+}
+
+void startTrickPlay(int rate, double position, const TrickPlaySink &sink) {
+  stopTrickPlay();
+  state.rate = rate;
+  state.waiting = true;
+  state.sink = sink;
+  state.position = position;
+  spdlog::info("trick play: start rate:{} position:{:.1f}s", rate, position);
+}
+
+void resumeTrickPlay() {
+  if (state.rate == 0) {
+    return;
+  }
+  state.waiting = false;
+  state.lastTick = emscripten_get_now();
+}
+
+void changeTrickPlayRate(int rate) {
+  if (state.rate == 0 || rate == state.rate) {
+    return;
+  }
+  // 向きを変えたら今出ている所から進める
+  if ((rate > 0) != (state.rate > 0) && state.shown) {
+    state.position = state.shownTime;
+  }
+  state.rate = rate;
+  state.probeTime = NAN;
+  spdlog::info("trick play: rate:{}", rate);
+}
+
+void stopTrickPlay() {
+  state.generation++;
+  state.rate = 0;
+  state.waiting = false;
+  state.shown = false;
+  state.shownTime = NAN;
+  state.probeTime = NAN;
+  state.nextReadTime = 0.0;
+  state.reading = false;
+  state.data.clear();
+  state.data.shrink_to_fit();
+}
+
+bool pumpTrickPlay() {
+  if (state.rate == 0 || state.waiting) {
+    return true;
+  }
+  double now = emscripten_get_now();
+  double duration = getRecordingDuration();
+  state.position = std::clamp(
+      state.position + state.rate * (now - state.lastTick) / 1000.0, 0.0,
+      duration);
+  state.lastTick = now;
+  if (state.reading) {
+    return true;
+  }
+  if (now >= state.nextReadTime &&
+      state.sink.bufferedSize() <= TRICK_MAX_BUFFERED) {
+    GopIndexEntry entry;
+    if (findGopIndexKeyframe(state.position, entry)) {
+      if (isAhead(recordingTimeFromPts(entry.pts))) {
+        readKeyframe(entry.offset, TRICK_READ_SIZE);
+      }
+    } else if (duration > 0.0 &&
+               (std::isnan(state.probeTime) ||
+                std::abs(state.position - state.probeTime) >=
+                    TRICK_PROBE_STEP)) {
+      probeKeyframe(duration);
+    }
+  }
+  bool atEdge = state.rate > 0 ? state.position >= duration
+                               : state.position <= 0.0;
+  return state.reading || !atEdge;
+}
+
+bool isTrickPlaying() { return state.rate != 0; }
+
+int getTrickPlayRate() { return state.rate; }
+
+double getTrickPlayPosition() {
+  return state.shown ? state.shownTime : state.position;
+}
+
+bool getTrickPlayOffset(size_t &offset) {
+  offset = state.shownOffset;
+  return state.shown;
+}
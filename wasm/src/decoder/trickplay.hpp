@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// 録画ファイルの早送り・巻き戻し。倍率に合わせて進める仮想の再生位置の
+// キーフレームを1枚ずつRangeリクエストで読み、そのPESだけを入力バッファに
+// 書き込む。読む量はストリームのビットレートではなくキーフレームの数で決まる。
+// キーフレームの位置は索引から、索引に無ければ見積もった位置を読んで探す。
+// すべてメインスレッドから呼ぶ
+
+struct TrickPlaySink {
+  // 入力バッファに入っていて、まだ読まれていないバイト数
+  std::function<size_t()> bufferedSize;
+  // 書き込み先を返す。入力バッファに空きが足りなければnullptr
+  std::function<uint8_t *(size_t size)> reserve;
+  std::function<void(size_t size)> commit;
+};
+
+// ±2, 4, 8, 16
+bool isTrickPlayRate(int rate);
+// positionから始める。入力バッファを空にし終えてresumeTrickPlayが
+// 呼ばれるまでは書き込まない
+void startTrickPlay(int rate, double position, const TrickPlaySink &sink);
+void resumeTrickPlay();
+// 早送り・巻き戻しのまま倍率や向きだけ変える
+void changeTrickPlayRate(int rate);
+void stopTrickPlay();
+// 仮想の再生位置を進め、次のキーフレームに達していれば読みに行く。
+// ファイルの端に着いて読むものが無くなったらfalse
+bool pumpTrickPlay();
+bool isTrickPlaying();
+// 通常の再生なら0
+int getTrickPlayRate();
+// 最後に書き込んだキーフレームの時刻(秒)。まだ無ければ仮想の再生位置
+double getTrickPlayPosition();
+// 最後に書き込んだキーフレームのファイル上の位置があればtrue
+bool getTrickPlayOffset(size_t &offset);
@@ -4,6 +4,7 @@
 #include <emscripten/bind.h>
 #include <emscripten/emscripten.h>
 #include <emscripten/fetch.h>
+#include <emscripten/html5.h>
 #include <emscripten/val.h>
 #include <mutex>
 #include <spdlog/spdlog.h>
@@ -12,6 +13,12 @@
 
 #include "audio/audioworklet.hpp"
 #include "decoder/decoder.hpp"
+#include "decoder/downloader.hpp"
+#include "decoder/gopindex.hpp"
+#include "util/startup.hpp"
+#include "util/trace.hpp"
+#include "video/presenter.hpp"
+#include "video/renderer.hpp"
 #include "video/webgpu.hpp"
 
 extern "C" {
@@ -35,18 +42,56 @@ void showVersionInfo() {
          avutil_configuration());
 }
 
-void setLogLevelDebug() { spdlog::set_level(spdlog::level::debug); }
-void setLogLevelInfo() { spdlog::set_level(spdlog::level::info); }
+// パケット・フレームごとの出力もデバッグログと一緒に切り替える
+void setLogLevelDebug() {
+  spdlog::set_level(spdlog::level::debug);
+  setTraceEnabled(true);
+}
+void setLogLevelInfo() {
+  spdlog::set_level(spdlog::level::info);
+  setTraceEnabled(false);
+}
+
+// 表示用のスレッドで描画している場合はメインスレッドでは描画しない
+bool presenterOnWorker = false;
+
+EM_BOOL onVisibilityChange(int eventType,
+                           const EmscriptenVisibilityChangeEvent *event,
+                           void *userData) {
+  setBackgroundMode(event->hidden);
+  return EM_FALSE;
+}
 
 void mainloop(void *arg) {
   // mainloop
   decoderMainloop();
+  if (!presenterOnWorker) {
+    presentVideoFrame();
+  }
 }
 
 int main() {
   spdlog::info("Wasm main() started.");
+  markStartup("main");
   startTime = std::chrono::system_clock::now();
 
+  // WebGPU起動
+  // パイプライン(シェーダ)の作成は非同期なので最初に始めておき、
+  // デコーダやAudioWorkletの初期化と並行させる
+  // OffscreenCanvasが使えればcanvasごと表示用のスレッドに渡して、
+  // UIの処理やGCで描画が止まらないようにする
+  // WebGPUが使えない(deviceが渡されていない)場合や、forceSoftwareRenderer
+  // が指定された場合はCPUで描画する
+  bool useWebGpu = EM_ASM_INT({
+    return !!Module['preinitializedWebGPUDevice'] &&
+           !Module['forceSoftwareRenderer'];
+  });
+  presenterOnWorker = startPresenter(useWebGpu);
+  if (!presenterOnWorker) {
+    initRenderer(useWebGpu);
+  }
+  markStartup("renderer-started");
+
   // デコーダスレッド起動
   spdlog::info("initializing Decoder");
   initDecoder();
@@ -54,10 +99,16 @@ int main() {
   // AudioWorklet起動
   spdlog::info("initializing audio worklet");
   startAudioWorklet();
+  markStartup("decoder-started");
 
-  // WebGPU起動
-  spdlog::info("initializing webgpu");
-  initWebGpu();
+  // タブが隠れている間は映像の処理を止める
+  EmscriptenVisibilityChangeEvent visibility;
+  if (emscripten_get_visibility_status(&visibility) ==
+      EMSCRIPTEN_RESULT_SUCCESS) {
+    setBackgroundMode(visibility.hidden);
+  }
+  emscripten_set_visibilitychange_callback(nullptr, EM_FALSE,
+                                           onVisibilityChange);
 
   // //
   // fps指定するとrAFループじゃなくタイマーになるので裏周りしても再生が続く。fps<=0だとrAFが使われるらしい。
@@ -77,14 +128,36 @@ EMSCRIPTEN_BINDINGS(ts_live_module) {
   emscripten::function("getExceptionMsg", &getExceptionMsg);
   emscripten::function("showVersionInfo", &showVersionInfo);
   emscripten::function("setCaptionCallback", &setCaptionCallback);
+  emscripten::function("setCaptionOverlay", &setCaptionOverlay);
   emscripten::function("setStatsCallback", &setStatsCallback);
   emscripten::function("playFile", &playFile);
+  emscripten::function("seek", &seek);
+  emscripten::function("getRecordingTime", &getRecordingTime);
+  emscripten::function("scrub", &scrub);
+  emscripten::function("stepKeyframe", &stepKeyframe);
+  emscripten::function("setTrickPlayRate", &setTrickPlayRate);
+  emscripten::function("exportGopIndex", &exportGopIndex);
+  emscripten::function("importGopIndex", &importGopIndex);
   emscripten::function("getNextInputBuffer", &getNextInputBuffer);
   emscripten::function("commitInputData", &commitInputData);
+  emscripten::function("downloaderResponse", &downloaderResponse);
+  emscripten::function("downloaderReceive", &downloaderReceive);
+  emscripten::function("downloaderFinished", &downloaderFinished);
+  emscripten::function("downloaderReadDone", &downloaderReadDone);
   emscripten::function("reset", &reset);
   emscripten::function("setLogLevelDebug", &setLogLevelDebug);
   emscripten::function("setLogLevelInfo", &setLogLevelInfo);
+  emscripten::function("setTraceEnabled", &setTraceEnabled);
   emscripten::function("setBufferedAudioSamples", &setBufferedAudioSamples);
   emscripten::function("setAudioGain", &setAudioGain);
   emscripten::function("setDualMonoMode", &setDualMonoMode);
+  emscripten::function("setScaleFilter", &setScaleFilter);
+  emscripten::function("setChromaPacking", &setChromaPacking);
+  emscripten::function("setQualityTier", &setQualityTier);
+  emscripten::function("setDecodeThreads", &setDecodeThreads);
+  emscripten::function("setVideoQueueDepth", &setVideoQueueDepth);
+  emscripten::function("startCapabilityProbe", &startCapabilityProbe);
+  emscripten::function("setRendererCheck", &setRendererCheck);
+  emscripten::function("setDeinterlace", &setDeinterlace);
+  emscripten::function("setSharpness", &setSharpness);
 }
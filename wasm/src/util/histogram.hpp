@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// 境界値で区切った度数分布。N個の境界からN+1個のビンができる
+template <size_t N> class Histogram {
+public:
+  explicit Histogram(const std::array<double, N> &edges) : edges(edges) {}
+
+  void add(double value) {
+    size_t bin = 0;
+    while (bin < N && value >= edges[bin]) {
+      bin++;
+    }
+    counts[bin]++;
+  }
+
+  const std::array<uint32_t, N + 1> &bins() const { return counts; }
+
+  void clear() { counts.fill(0); }
+
+private:
+  std::array<double, N> edges;
+  std::array<uint32_t, N + 1> counts = {};
+};
@@ -0,0 +1,71 @@
+#include <atomic>
+#include <mutex>
+
+#include "histogram.hpp"
+#include "playbackstats.hpp"
+
+const double PLAYBACK_STATS_INTERVAL_MS = 1000.0;
+
+struct PlaybackStatsState {
+  std::atomic<uint64_t> totals[PLAYBACK_COUNTER_COUNT] = {};
+  std::mutex mtx;
+  Histogram<PLAYBACK_HISTOGRAM_EDGES_MS.size()> avOffset{
+      PLAYBACK_HISTOGRAM_EDGES_MS};
+  Histogram<PLAYBACK_HISTOGRAM_EDGES_MS.size()> presentJitter{
+      PLAYBACK_HISTOGRAM_EDGES_MS};
+  double windowStartMs = -1;
+  uint64_t windowTotals[PLAYBACK_COUNTER_COUNT] = {};
+  std::array<double, PLAYBACK_COUNTER_COUNT> perSecond = {};
+};
+
+static PlaybackStatsState state;
+
+void countPlaybackFrame(PlaybackCounter counter) {
+  //
+  state.totals[counter]++;
+}
+
+void recordAvOffset(double offsetMs) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.avOffset.add(offsetMs);
+}
+
+void recordPresentJitter(double jitterMs) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.presentJitter.add(jitterMs);
+}
+
+PlaybackStats getPlaybackStats(double nowMs) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (state.windowStartMs < 0) {
+    state.windowStartMs = nowMs;
+  }
+  double elapsedMs = nowMs - state.windowStartMs;
+  if (elapsedMs >= PLAYBACK_STATS_INTERVAL_MS) {
+    for (int i = 0; i < PLAYBACK_COUNTER_COUNT; i++) {
+      uint64_t total = state.totals[i];
+      state.perSecond[i] =
+          (total - state.windowTotals[i]) * 1000.0 / elapsedMs;
+      state.windowTotals[i] = total;
+    }
+    state.windowStartMs = nowMs;
+  }
+
+  PlaybackStats stats;
+  stats.perSecond = state.perSecond;
+  stats.avOffsetHistogram = state.avOffset.bins();
+  stats.presentJitterHistogram = state.presentJitter.bins();
+  return stats;
+}
+
+void resetPlaybackStats() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  for (int i = 0; i < PLAYBACK_COUNTER_COUNT; i++) {
+    state.totals[i] = 0;
+    state.windowTotals[i] = 0;
+  }
+  state.perSecond.fill(0);
+  state.windowStartMs = -1;
+  state.avOffset.clear();
+  state.presentJitter.clear();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+enum PlaybackCounter {
+  // デコードされたVideoFrame
+  FRAMES_DECODED = 0,
+  // 表示したVideoFrame
+  FRAMES_PRESENTED,
+  // 表示時刻に間に合わず捨てたVideoFrame
+  FRAMES_DROPPED_LATE,
+  // 不正なフレームなど、方針として表示しなかったVideoFrame
+  FRAMES_SKIPPED,
+  // 新しいフレームが無く、前のフレームを出し続けたvsync
+  FRAMES_REPEATED,
+  PLAYBACK_COUNTER_COUNT,
+};
+
+// A/Vのズレ・表示間隔の揺らぎ(ms)のヒストグラムの境界
+constexpr std::array<double, 8> PLAYBACK_HISTOGRAM_EDGES_MS = {
+    -50.0, -20.0, -10.0, -5.0, 5.0, 10.0, 20.0, 50.0};
+constexpr int PLAYBACK_HISTOGRAM_BINS = PLAYBACK_HISTOGRAM_EDGES_MS.size() + 1;
+
+struct PlaybackStats {
+  // 直近1秒間の各カウンタの値(/秒)
+  std::array<double, PLAYBACK_COUNTER_COUNT> perSecond;
+  // 表示した時点の再生位置 - フレームのPTS(ms)。正なら映像が遅れている
+  std::array<uint32_t, PLAYBACK_HISTOGRAM_BINS> avOffsetHistogram;
+  // 表示間隔 - コンテンツのフレーム間隔(ms)
+  std::array<uint32_t, PLAYBACK_HISTOGRAM_BINS> presentJitterHistogram;
+};
+
+// どのスレッドから呼んでもよい
+void countPlaybackFrame(PlaybackCounter counter);
+void recordAvOffset(double offsetMs);
+void recordPresentJitter(double jitterMs);
+// 1秒ごとにカウンタの差分から毎秒の値を更新する
+PlaybackStats getPlaybackStats(double nowMs);
+void resetPlaybackStats();
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+// 直近N個の値の平均・最大を求めるためのリングバッファ
+template <size_t N> class RollingWindow {
+public:
+  void push(double value) {
+    values[next] = value;
+    next = (next + 1) % N;
+    if (count < N) {
+      count++;
+    }
+  }
+
+  double mean() const {
+    if (count == 0) {
+      return 0.0;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+      sum += values[i];
+    }
+    return sum / count;
+  }
+
+  double max() const {
+    if (count == 0) {
+      return 0.0;
+    }
+    return *std::max_element(values.begin(), values.begin() + count);
+  }
+
+  size_t size() const { return count; }
+
+  void clear() {
+    count = 0;
+    next = 0;
+  }
+
+private:
+  std::array<double, N> values = {};
+  size_t count = 0;
+  size_t next = 0;
+};
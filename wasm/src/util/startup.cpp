@@ -0,0 +1,34 @@
+#include <emscripten/emscripten.h>
+#include <mutex>
+#include <set>
+#include <spdlog/spdlog.h>
+#include <string>
+
+#include "startup.hpp"
+
+static std::mutex startupMtx;
+static std::set<std::string> startupMarks;
+// 最初に記録した時刻(main()の開始)。emscripten_get_now()はスレッド間で
+// 起点が揃っているので、どのスレッドからの記録もこれとの差で比べられる
+static double startupOrigin = 0;
+
+void markStartup(const char *name) {
+  double now = emscripten_get_now();
+  {
+    std::lock_guard<std::mutex> lock(startupMtx);
+    if (!startupMarks.insert(name).second) {
+      return;
+    }
+    if (startupMarks.size() == 1) {
+      startupOrigin = now;
+    }
+  }
+  spdlog::info("startup: {} +{:.1f}ms", name, now - startupOrigin);
+  // clang-format off
+  EM_ASM({
+    if (typeof performance !== 'undefined' && performance.mark) {
+      performance.mark('ts-live:' + UTF8ToString($0));
+    }
+  }, name);
+  // clang-format on
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// 起動から最初のフレーム表示までの各段階の時刻を記録する。
+// ログに出すのに加えてperformance.mark()するので、DevToolsの
+// Performanceパネルのタイムライン上でも確認できる。
+// 時刻は最初に記録したもの(main()の開始)からの経過時間。
+// 同じ名前は最初の1回だけ記録する
+void markStartup(const char *name);
@@ -0,0 +1,8 @@
+#include "trace.hpp"
+
+std::atomic<bool> traceEnabled = false;
+
+void setTraceEnabled(bool enabled) {
+  //
+  traceEnabled = enabled;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <spdlog/spdlog.h>
+
+// パケット・フレームごとのデバッグ出力。
+// TS_LIVE_TRACEを0にしてビルドすると出力ごと消え、
+// 1の場合もsetTraceEnabled(true)の間しか引数を評価しない
+
+#ifndef TS_LIVE_TRACE
+#define TS_LIVE_TRACE 1
+#endif
+
+extern std::atomic<bool> traceEnabled;
+
+void setTraceEnabled(bool enabled);
+
+#if TS_LIVE_TRACE
+#define TRACE_ENABLED() (traceEnabled.load(std::memory_order_relaxed))
+#else
+#define TRACE_ENABLED() (false)
+#endif
+
+#define TRACE(...)                                                             \
+  do {                                                                         \
+    if (TRACE_ENABLED()) {                                                     \
+      spdlog::debug(__VA_ARGS__);                                              \
+    }                                                                          \
+  } while (0)
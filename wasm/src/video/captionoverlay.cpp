@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <cstddef>
+#include <emscripten/emscripten.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../util/trace.hpp"
+#include "captionoverlay.hpp"
+
+// アトラスは1辺ATLAS_SIZEの正方形を、1辺SLOT_SIZEの区画に分けて使う
+const int ATLAS_SIZE = 1024;
+const int SLOT_SIZE = 64;
+const int SLOTS_PER_ROW = ATLAS_SIZE / SLOT_SIZE;
+const int SLOT_COUNT = SLOTS_PER_ROW * SLOTS_PER_ROW;
+// 区画に描く文字の大きさ。縁取り(文字の大きさの1/8の線幅)がはみ出さない分だけ
+// 小さくする
+const int GLYPH_FONT_SIZE = 56;
+
+enum CaptionQuadKind : uint32_t { QUAD_FILL = 0, QUAD_ATLAS = 1 };
+
+// caption.vert.wgslの頂点入力(インスタンスごと)
+struct CaptionQuad {
+  float rect[4];
+  float uvRect[4];
+  uint32_t foreground;
+  uint32_t outline;
+  uint32_t kind;
+  uint32_t padding;
+};
+
+struct CaptionParams {
+  float planeWidth;
+  float planeHeight;
+  float padding[2];
+};
+
+struct AtlasSlot {
+  std::string key;
+  uint64_t lastUsed = 0;
+};
+
+struct CaptionOverlayContext {
+  WGPUDevice device = nullptr;
+  WGPUQueue queue = nullptr;
+  WGPURenderPipeline pipeline = nullptr;
+  WGPUTexture atlasTexture = nullptr;
+  WGPUBuffer paramsBuffer = nullptr;
+  WGPUBindGroup bindGroup = nullptr;
+  WGPUBuffer quadBuffer = nullptr;
+  uint64_t quadBufferSize = 0;
+  uint32_t quadCount = 0;
+  int planeWidth = 0;
+  int planeHeight = 0;
+  // 文字(UTF-8)・DRCS(大きさとパターン)から区画の番号を引く
+  std::unordered_map<std::string, int> slotIndex;
+  AtlasSlot slots[SLOT_COUNT];
+  // ページを差し替えるたびに増やす。区画のlastUsedと同じなら表示中
+  uint64_t pageCount = 0;
+  std::vector<CaptionQuad> quads;
+  // 区画1つ分のRGBA
+  std::vector<uint8_t> slotPixels;
+};
+
+static CaptionOverlayContext overlay;
+
+static void onCaptionPipelineCreated(WGPUCreatePipelineAsyncStatus status,
+                                     WGPURenderPipeline pipeline,
+                                     const char *message, void *userdata) {
+  if (status != WGPUCreatePipelineAsyncStatus_Success) {
+    spdlog::error("failed to create caption pipeline: {}",
+                  message ? message : "");
+  }
+  overlay.pipeline = pipeline;
+}
+
+static WGPUShaderModule createShader(const char *const code) {
+  WGPUShaderModuleWGSLDescriptor wgsl = {};
+  wgsl.chain.sType = WGPUSType_ShaderModuleWGSLDescriptor;
+  wgsl.code = code;
+  WGPUShaderModuleDescriptor desc = {};
+  desc.nextInChain = reinterpret_cast<WGPUChainedStruct *>(&wgsl);
+  return wgpuDeviceCreateShaderModule(overlay.device, &desc);
+}
+
+static void createPipeline(WGPUBindGroupLayout bindGroupLayout) {
+  std::string vertWgsl =
+#include "shaders/caption.vert.wgsl"
+      ;
+  std::string fragWgsl =
+#include "shaders/caption.frag.wgsl"
+      ;
+  WGPUShaderModule vertMod = createShader(vertWgsl.c_str());
+  WGPUShaderModule fragMod = createShader(fragWgsl.c_str());
+
+  WGPUPipelineLayoutDescriptor layoutDesc = {};
+  layoutDesc.bindGroupLayoutCount = 1;
+  layoutDesc.bindGroupLayouts = &bindGroupLayout;
+  WGPUPipelineLayout pipelineLayout =
+      wgpuDeviceCreatePipelineLayout(overlay.device, &layoutDesc);
+
+  WGPUVertexAttribute attributes[3] = {};
+  attributes[0].format = WGPUVertexFormat_Float32x4;
+  attributes[0].offset = offsetof(CaptionQuad, rect);
+  attributes[0].shaderLocation = 0;
+  attributes[1].format = WGPUVertexFormat_Float32x4;
+  attributes[1].offset = offsetof(CaptionQuad, uvRect);
+  attributes[1].shaderLocation = 1;
+  attributes[2].format = WGPUVertexFormat_Uint32x4;
+  attributes[2].offset = offsetof(CaptionQuad, foreground);
+  attributes[2].shaderLocation = 2;
+
+  WGPUVertexBufferLayout vertexBuffer = {};
+  vertexBuffer.arrayStride = sizeof(CaptionQuad);
+  vertexBuffer.stepMode = WGPUVertexStepMode_Instance;
+  vertexBuffer.attributeCount = 3;
+  vertexBuffer.attributes = attributes;
+
+  // シェーダは乗算済みアルファで出力する
+  WGPUBlendState blend = {};
+  blend.color.operation = WGPUBlendOperation_Add;
+  blend.color.srcFactor = WGPUBlendFactor_One;
+  blend.color.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha;
+  blend.alpha.operation = WGPUBlendOperation_Add;
+  blend.alpha.srcFactor = WGPUBlendFactor_One;
+  blend.alpha.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha;
+
+  WGPUColorTargetState colorTarget = {};
+  colorTarget.format = WGPUTextureFormat_BGRA8Unorm;
+  colorTarget.blend = &blend;
+  colorTarget.writeMask = WGPUColorWriteMask_All;
+
+  WGPUFragmentState fragment = {};
+  fragment.module = fragMod;
+  fragment.entryPoint = "main";
+  fragment.targetCount = 1;
+  fragment.targets = &colorTarget;
+
+  WGPURenderPipelineDescriptor desc = {};
+  desc.fragment = &fragment;
+  desc.layout = pipelineLayout;
+  desc.depthStencil = nullptr;
+
+  desc.vertex.module = vertMod;
+  desc.vertex.entryPoint = "main";
+  desc.vertex.bufferCount = 1;
+  desc.vertex.buffers = &vertexBuffer;
+
+  desc.multisample.count = 1;
+  desc.multisample.mask = 0xFFFFFFFF;
+  desc.multisample.alphaToCoverageEnabled = false;
+
+  desc.primitive.frontFace = WGPUFrontFace_CCW;
+  desc.primitive.cullMode = WGPUCullMode_None;
+  desc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
+  desc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+
+  wgpuDeviceCreateRenderPipelineAsync(overlay.device, &desc,
+                                      onCaptionPipelineCreated, nullptr);
+
+  wgpuPipelineLayoutRelease(pipelineLayout);
+  wgpuShaderModuleRelease(fragMod);
+  wgpuShaderModuleRelease(vertMod);
+}
+
+void initCaptionOverlay(WGPUDevice device, WGPUQueue queue,
+                        WGPUSampler sampler) {
+  overlay.device = device;
+  overlay.queue = queue;
+  overlay.slotPixels.resize(SLOT_SIZE * SLOT_SIZE * 4);
+
+  WGPUTextureDescriptor textureDesc = {};
+  textureDesc.dimension = WGPUTextureDimension_2D;
+  textureDesc.usage =
+      WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
+  textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
+  textureDesc.size = {ATLAS_SIZE, ATLAS_SIZE, 1};
+  textureDesc.sampleCount = 1;
+  textureDesc.mipLevelCount = 1;
+  overlay.atlasTexture = wgpuDeviceCreateTexture(device, &textureDesc);
+
+  WGPUTextureViewDescriptor viewDesc = {};
+  viewDesc.format = WGPUTextureFormat_RGBA8Unorm;
+  viewDesc.dimension = WGPUTextureViewDimension_2D;
+  viewDesc.arrayLayerCount = 1;
+  viewDesc.mipLevelCount = 1;
+  viewDesc.aspect = WGPUTextureAspect_All;
+  WGPUTextureView atlasView =
+      wgpuTextureCreateView(overlay.atlasTexture, &viewDesc);
+
+  WGPUBufferDescriptor bufferDesc = {};
+  bufferDesc.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst;
+  bufferDesc.size = sizeof(CaptionParams);
+  overlay.paramsBuffer = wgpuDeviceCreateBuffer(device, &bufferDesc);
+
+  WGPUSamplerBindingLayout samplerLayout = {};
+  samplerLayout.type = WGPUSamplerBindingType_Filtering;
+
+  WGPUTextureBindingLayout textureLayout = {};
+  textureLayout.sampleType = WGPUTextureSampleType_Float;
+  textureLayout.multisampled = false;
+  textureLayout.viewDimension = WGPUTextureViewDimension_2D;
+
+  WGPUBufferBindingLayout uniformLayout = {};
+  uniformLayout.type = WGPUBufferBindingType_Uniform;
+  uniformLayout.minBindingSize = sizeof(CaptionParams);
+
+  WGPUBindGroupLayoutEntry bglEntries[] = {
+      {.binding = 0,
+       .visibility = WGPUShaderStage_Fragment,
+       .sampler = samplerLayout},
+      {.binding = 1,
+       .visibility = WGPUShaderStage_Fragment,
+       .texture = textureLayout},
+      {.binding = 2,
+       .visibility = WGPUShaderStage_Vertex,
+       .buffer = uniformLayout},
+  };
+  WGPUBindGroupLayoutDescriptor bglDesc = {};
+  bglDesc.entryCount = sizeof(bglEntries) / sizeof(bglEntries[0]);
+  bglDesc.entries = bglEntries;
+  WGPUBindGroupLayout bindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(device, &bglDesc);
+
+  WGPUBindGroupEntry bgEntries[] = {
+      {.binding = 0, .sampler = sampler},
+      {.binding = 1, .textureView = atlasView},
+      {.binding = 2,
+       .buffer = overlay.paramsBuffer,
+       .size = sizeof(CaptionParams)},
+  };
+  WGPUBindGroupDescriptor bgDesc = {};
+  bgDesc.layout = bindGroupLayout;
+  bgDesc.entryCount = sizeof(bgEntries) / sizeof(bgEntries[0]);
+  bgDesc.entries = bgEntries;
+  overlay.bindGroup = wgpuDeviceCreateBindGroup(device, &bgDesc);
+
+  createPipeline(bindGroupLayout);
+
+  // バインドグループが参照を持つので、ここで解放してよい
+  wgpuBindGroupLayoutRelease(bindGroupLayout);
+  wgpuTextureViewRelease(atlasView);
+}
+
+// 文字を白で、塗りをR・縁取りをGに描く。
+// 描画スレッドのワーカーでもOffscreenCanvasの2Dコンテキストは使える
+static void rasterizeGlyph(const std::string &text, uint8_t *pixels) {
+  // clang-format off
+  EM_ASM({
+    const size = $2;
+    const fontSize = $3;
+    if (!Module['captionGlyphContext']) {
+      const canvas = new OffscreenCanvas(size, size);
+      Module['captionGlyphContext'] =
+          canvas.getContext('2d', { willReadFrequently: true });
+    }
+    const context = Module['captionGlyphContext'];
+    const text = UTF8ToString($0);
+    context.font = fontSize + 'px sans-serif';
+    context.textAlign = 'center';
+    context.textBaseline = 'middle';
+    context.lineJoin = 'round';
+    context.lineWidth = fontSize / 8;
+    context.fillStyle = 'white';
+    context.strokeStyle = 'white';
+
+    context.clearRect(0, 0, size, size);
+    context.fillText(text, size / 2, size / 2);
+    const fill = context.getImageData(0, 0, size, size).data;
+    context.clearRect(0, 0, size, size);
+    context.strokeText(text, size / 2, size / 2);
+    const stroke = context.getImageData(0, 0, size, size).data;
+    for (let i = 0; i < size * size; i++) {
+      HEAPU8[$1 + i * 4] = fill[i * 4 + 3];
+      HEAPU8[$1 + i * 4 + 1] = stroke[i * 4 + 3];
+      HEAPU8[$1 + i * 4 + 2] = 0;
+      HEAPU8[$1 + i * 4 + 3] = 255;
+    }
+  }, text.c_str(), pixels, SLOT_SIZE, GLYPH_FONT_SIZE);
+  // clang-format on
+}
+
+// DRCSは縁取りなしで、区画の左上に等倍で置く(区画より大きい分は切る)
+static void rasterizeDrcs(const CaptionDrcs &drcs, uint8_t *pixels) {
+  std::fill(pixels, pixels + SLOT_SIZE * SLOT_SIZE * 4, 0);
+  int width = std::min(drcs.width, SLOT_SIZE);
+  int height = std::min(drcs.height, SLOT_SIZE);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *pixel = pixels + (y * SLOT_SIZE + x) * 4;
+      pixel[0] = drcs.alpha[y * drcs.width + x];
+      pixel[3] = 255;
+    }
+  }
+}
+
+// キーに対応する区画を返す。無ければ表示中でない区画のうち一番長く
+// 使われていないものを空けてrasterizeで描く。空きが無ければ-1
+template <typename Rasterize>
+static int acquireSlot(const std::string &key, Rasterize rasterize) {
+  auto it = overlay.slotIndex.find(key);
+  if (it != overlay.slotIndex.end()) {
+    overlay.slots[it->second].lastUsed = overlay.pageCount;
+    return it->second;
+  }
+  int victim = -1;
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    if (overlay.slots[i].lastUsed == overlay.pageCount) {
+      continue;
+    }
+    if (victim < 0 ||
+        overlay.slots[i].lastUsed < overlay.slots[victim].lastUsed) {
+      victim = i;
+    }
+  }
+  if (victim < 0) {
+    TRACE("caption atlas full, skip: {}", key);
+    return -1;
+  }
+  AtlasSlot &slot = overlay.slots[victim];
+  if (!slot.key.empty()) {
+    overlay.slotIndex.erase(slot.key);
+  }
+  slot.key = key;
+  slot.lastUsed = overlay.pageCount;
+  overlay.slotIndex[key] = victim;
+
+  rasterize(overlay.slotPixels.data());
+  WGPUImageCopyTexture dst = {};
+  dst.texture = overlay.atlasTexture;
+  dst.origin.x = victim % SLOTS_PER_ROW * SLOT_SIZE;
+  dst.origin.y = victim / SLOTS_PER_ROW * SLOT_SIZE;
+  dst.aspect = WGPUTextureAspect_All;
+  WGPUTextureDataLayout layout = {
+      .offset = 0,
+      .bytesPerRow = SLOT_SIZE * 4,
+      .rowsPerImage = SLOT_SIZE,
+  };
+  WGPUExtent3D size = {SLOT_SIZE, SLOT_SIZE, 1};
+  wgpuQueueWriteTexture(overlay.queue, &dst, overlay.slotPixels.data(),
+                        overlay.slotPixels.size(), &layout, &size);
+  return victim;
+}
+
+static void pushQuad(float x, float y, float width, float height,
+                     uint32_t color) {
+  CaptionQuad quad = {};
+  quad.rect[0] = x;
+  quad.rect[1] = y;
+  quad.rect[2] = width;
+  quad.rect[3] = height;
+  quad.foreground = color;
+  quad.kind = QUAD_FILL;
+  overlay.quads.push_back(quad);
+}
+
+// 区画のうち左上からwidth x heightの範囲を、中心(centerX, centerY)に
+// quadWidth x quadHeightで描く
+static void pushAtlasQuad(int slot, int width, int height, float centerX,
+                          float centerY, float quadWidth, float quadHeight,
+                          const CaptionRun &run) {
+  float u = static_cast<float>(slot % SLOTS_PER_ROW * SLOT_SIZE);
+  float v = static_cast<float>(slot / SLOTS_PER_ROW * SLOT_SIZE);
+  CaptionQuad quad = {};
+  quad.rect[0] = centerX - quadWidth / 2;
+  quad.rect[1] = centerY - quadHeight / 2;
+  quad.rect[2] = quadWidth;
+  quad.rect[3] = quadHeight;
+  quad.uvRect[0] = u / ATLAS_SIZE;
+  quad.uvRect[1] = v / ATLAS_SIZE;
+  quad.uvRect[2] = (u + width) / ATLAS_SIZE;
+  quad.uvRect[3] = (v + height) / ATLAS_SIZE;
+  quad.foreground = run.foreground;
+  // 縁取りの指定が無ければ黒で縁取る(JSでの描画と同じ)
+  quad.outline = run.outline != 0 ? run.outline : 0x000000FF;
+  quad.kind = QUAD_ATLAS;
+  overlay.quads.push_back(quad);
+}
+
+static size_t utf8CharLength(uint8_t lead) {
+  if (lead < 0x80) {
+    return 1;
+  } else if (lead < 0xE0) {
+    return 2;
+  } else if (lead < 0xF0) {
+    return 3;
+  }
+  return 4;
+}
+
+static void pushGlyphs(const CaptionRun &run, float centerY) {
+  // 区画には縁取りの分の余白を付けて描いてあるので、その分大きく描く
+  float quadScale = static_cast<float>(SLOT_SIZE) / GLYPH_FONT_SIZE;
+  size_t pos = 0;
+  for (int i = 0; i < run.length && pos < run.text.size(); i++) {
+    size_t length = utf8CharLength(run.text[pos]);
+    std::string ch = run.text.substr(pos, length);
+    pos += length;
+    if (ch == " " || ch == "　") {
+      continue;
+    }
+    int slot = acquireSlot("g" + ch, [&ch](uint8_t *pixels) {
+      rasterizeGlyph(ch, pixels);
+    });
+    if (slot < 0) {
+      continue;
+    }
+    // 中サイズなどは横に縮める
+    pushAtlasQuad(slot, SLOT_SIZE, SLOT_SIZE,
+                  run.x + run.cellWidth * (i + 0.5f), centerY,
+                  run.charWidth * quadScale, run.charHeight * quadScale, run);
+  }
+}
+
+static void pushDrcs(const CaptionRun &run, const CaptionDrcs &drcs,
+                     float centerY) {
+  std::string key = "d" + std::to_string(drcs.width) + "x" +
+                    std::to_string(drcs.height) + ":";
+  key.append(drcs.alpha.begin(), drcs.alpha.end());
+  int slot = acquireSlot(
+      key, [&drcs](uint8_t *pixels) { rasterizeDrcs(drcs, pixels); });
+  if (slot < 0) {
+    return;
+  }
+  pushAtlasQuad(slot, std::min(drcs.width, SLOT_SIZE),
+                std::min(drcs.height, SLOT_SIZE), run.x + run.cellWidth / 2.0f,
+                centerY, run.charWidth, run.charHeight, run);
+}
+
+void setCaptionOverlayPage(const CaptionPage &page) {
+  overlay.pageCount++;
+  overlay.quads.clear();
+  overlay.quadCount = 0;
+  if (!overlay.device || page.runs.empty()) {
+    return;
+  }
+
+  for (const CaptionRun &run : page.runs) {
+    if ((run.background & 0xFF) != 0) {
+      pushQuad(run.x, run.y, run.cellWidth * run.length, run.cellHeight,
+               run.background);
+    }
+    // 字間・行間は文字の前後に半分ずつ入る
+    float centerY = run.y + run.cellHeight / 2.0f;
+    if (run.drcs >= 0 &&
+        static_cast<size_t>(run.drcs) < page.drcs.size()) {
+      pushDrcs(run, page.drcs[run.drcs], centerY);
+    } else {
+      pushGlyphs(run, centerY);
+    }
+    if (run.underline) {
+      pushQuad(run.x, centerY + run.charHeight / 2.0f,
+               run.cellWidth * run.length,
+               std::max(1.0f, run.charHeight / 18.0f), run.foreground);
+    }
+  }
+
+  uint64_t size = overlay.quads.size() * sizeof(CaptionQuad);
+  if (overlay.quadBufferSize < size) {
+    if (overlay.quadBuffer) {
+      wgpuBufferRelease(overlay.quadBuffer);
+    }
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.usage = WGPUBufferUsage_Vertex | WGPUBufferUsage_CopyDst;
+    // ページごとに作り直さないよう、倍々で大きくする
+    bufferDesc.size = std::max(size, overlay.quadBufferSize * 2);
+    overlay.quadBuffer = wgpuDeviceCreateBuffer(overlay.device, &bufferDesc);
+    overlay.quadBufferSize = bufferDesc.size;
+  }
+  wgpuQueueWriteBuffer(overlay.queue, overlay.quadBuffer, 0,
+                       overlay.quads.data(), size);
+  overlay.quadCount = overlay.quads.size();
+
+  if (page.planeWidth != overlay.planeWidth ||
+      page.planeHeight != overlay.planeHeight) {
+    overlay.planeWidth = page.planeWidth;
+    overlay.planeHeight = page.planeHeight;
+    CaptionParams params = {};
+    params.planeWidth = page.planeWidth;
+    params.planeHeight = page.planeHeight;
+    wgpuQueueWriteBuffer(overlay.queue, overlay.paramsBuffer, 0, &params,
+                         sizeof(CaptionParams));
+  }
+}
+
+bool hasCaptionOverlay() {
+  return overlay.pipeline && overlay.quadCount > 0 && overlay.planeWidth > 0 &&
+         overlay.planeHeight > 0;
+}
+
+void drawCaptionOverlay(WGPURenderPassEncoder renderPass, float x, float y,
+                        float width, float height) {
+  if (!hasCaptionOverlay()) {
+    return;
+  }
+  float scale = std::min(width / overlay.planeWidth,
+                         height / overlay.planeHeight);
+  float planeWidth = overlay.planeWidth * scale;
+  float planeHeight = overlay.planeHeight * scale;
+  wgpuRenderPassEncoderSetPipeline(renderPass, overlay.pipeline);
+  wgpuRenderPassEncoderSetViewport(
+      renderPass, x + (width - planeWidth) / 2, y + (height - planeHeight) / 2,
+      planeWidth, planeHeight, 0.0f, 1.0f);
+  wgpuRenderPassEncoderSetBindGroup(renderPass, 0, overlay.bindGroup, 0, 0);
+  wgpuRenderPassEncoderSetVertexBuffer(renderPass, 0, overlay.quadBuffer, 0,
+                                       overlay.quadCount *
+                                           sizeof(CaptionQuad));
+  wgpuRenderPassEncoderDraw(renderPass, 6, overlay.quadCount, 0, 0);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include "../caption/aribcaption.hpp"
+
+// WebGPUの描画で映像の上に字幕を重ねる。
+// 文字とDRCSは初めて使うときに1回だけアトラスのテクスチャに描いておき
+// (いっぱいになったら一番長く使われていないものと入れ替える)、
+// ページの背景・文字・下線をインスタンスごとの四角形としてまとめて描く。
+// すべて描画スレッドから呼ぶ
+
+void initCaptionOverlay(WGPUDevice device, WGPUQueue queue,
+                        WGPUSampler sampler);
+// 表示するページを差し替える。runsが空なら消す
+void setCaptionOverlayPage(const CaptionPage &page);
+// パイプラインの作成が終わっていて、描くものがあるか
+bool hasCaptionOverlay();
+// 映像の表示矩形に表示面を縦横比を保って合わせて描く
+void drawCaptionOverlay(WGPURenderPassEncoder renderPass, float x, float y,
+                        float width, float height);
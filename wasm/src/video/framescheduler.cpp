@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "../util/playbackstats.hpp"
+#include "framescheduler.hpp"
+
+// 推定値が無い間の既定値
+const double DEFAULT_REFRESH_INTERVAL_MS = 1000.0 / 60.0;
+const double DEFAULT_FRAME_DURATION = 1001.0 / 30000.0;
+// 推定値を追従させる速さ(指数移動平均の係数)
+const double REFRESH_INTERVAL_SMOOTHING = 0.05;
+const double FRAME_DURATION_SMOOTHING = 0.1;
+
+struct FrameSchedulerState {
+  std::mutex mtx;
+  double lastTickMs = NAN;
+  double refreshIntervalMs = DEFAULT_REFRESH_INTERVAL_MS;
+  double frameDuration = DEFAULT_FRAME_DURATION;
+  double lastPresentMs = NAN;
+  std::array<uint32_t, PRESENT_INTERVAL_BINS> presentIntervalHistogram = {};
+};
+
+static FrameSchedulerState state;
+
+void beginFrameSchedulerTick(double nowMs) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (!std::isnan(state.lastTickMs)) {
+    double delta = nowMs - state.lastTickMs;
+    // 描画が間に合わずvsyncを飛ばした場合は、飛ばした回数で割って1回分にする
+    double vsyncs = std::max(1.0, std::round(delta / state.refreshIntervalMs));
+    double sample = delta / vsyncs;
+    if (sample > 0) {
+      state.refreshIntervalMs +=
+          (sample - state.refreshIntervalMs) * REFRESH_INTERVAL_SMOOTHING;
+      // 240Hz〜20Hzの範囲に収める
+      state.refreshIntervalMs =
+          std::clamp(state.refreshIntervalMs, 1000.0 / 240.0, 1000.0 / 20.0);
+    }
+  }
+  state.lastTickMs = nowMs;
+}
+
+double getTimeToNextVsyncMs() {
+  // rAFのコールバックはvsync直後に呼ばれるので、今描いたものは次のvsyncで出る
+  std::lock_guard<std::mutex> lock(state.mtx);
+  return state.refreshIntervalMs;
+}
+
+FrameVerdict classifyFrame(double ptsTime, double nextPtsTime,
+                           double mediaTimeAtVsync) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  // コンテンツのフレームレートは表示とは独立にPTSの間隔から推定する。
+  // シークや不連続点は無視する
+  double delta = nextPtsTime - ptsTime;
+  if (delta > 0 && delta < 1.0) {
+    state.frameDuration +=
+        (delta - state.frameDuration) * FRAME_DURATION_SMOOTHING;
+  }
+  if (mediaTimeAtVsync < ptsTime) {
+    return FRAME_EARLY;
+  }
+  // 次のフレームが未デコードの場合はフレームレートから表示終了時刻を推定する
+  double endTime =
+      std::isnan(nextPtsTime) ? ptsTime + state.frameDuration : nextPtsTime;
+  if (mediaTimeAtVsync >= endTime && !std::isnan(nextPtsTime)) {
+    return FRAME_LATE;
+  }
+  return FRAME_PRESENT;
+}
+
+void onFramePresented(double nowMs) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (!std::isnan(state.lastPresentMs)) {
+    double intervalMs = nowMs - state.lastPresentMs;
+    recordPresentJitter(intervalMs - state.frameDuration * 1000.0);
+    int vsyncs =
+        static_cast<int>(std::lround(intervalMs / state.refreshIntervalMs));
+    int bin = std::clamp(vsyncs, 1, PRESENT_INTERVAL_BINS) - 1;
+    state.presentIntervalHistogram[bin]++;
+  }
+  state.lastPresentMs = nowMs;
+}
+
+bool hasPresentedFrame() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  return !std::isnan(state.lastPresentMs);
+}
+
+void resetFrameScheduler() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.frameDuration = DEFAULT_FRAME_DURATION;
+  state.lastPresentMs = NAN;
+  state.presentIntervalHistogram.fill(0);
+}
+
+FrameSchedulerStats getFrameSchedulerStats() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  FrameSchedulerStats stats;
+  stats.displayRefreshHz = 1000.0 / state.refreshIntervalMs;
+  stats.contentFps = 1.0 / state.frameDuration;
+  stats.presentIntervalHistogram = state.presentIntervalHistogram;
+  return stats;
+}
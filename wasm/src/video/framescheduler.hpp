@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// 表示間隔(vsync何回分か)のヒストグラムのビン数。最後のビンはそれ以上
+const int PRESENT_INTERVAL_BINS = 6;
+
+struct FrameSchedulerStats {
+  double displayRefreshHz;
+  double contentFps;
+  std::array<uint32_t, PRESENT_INTERVAL_BINS> presentIntervalHistogram;
+};
+
+enum FrameVerdict {
+  // まだ表示時刻になっていない(前のフレームを出し続ける)
+  FRAME_EARLY,
+  // 次のvsyncで表示する
+  FRAME_PRESENT,
+  // 次のフレームの表示時刻も過ぎているので捨てる
+  FRAME_LATE,
+};
+
+// 描画ループの各回の最初に呼ぶ。呼ばれた間隔からディスプレイの
+// リフレッシュ間隔を推定し、次のvsyncの時刻を予測する
+void beginFrameSchedulerTick(double nowMs);
+// 次のvsyncまでの時間(ms)
+double getTimeToNextVsyncMs();
+// 次のvsyncの時点での再生位置(mediaTimeAtVsync)が、ptsTimeから
+// 次のフレームの表示時刻(nextPtsTime、不明ならNaN)までに入っているか
+FrameVerdict classifyFrame(double ptsTime, double nextPtsTime,
+                           double mediaTimeAtVsync);
+// 表示した時刻を記録して表示間隔のヒストグラムを更新する
+void onFramePresented(double nowMs);
+// 前回のreset以降に1枚でも表示したか
+bool hasPresentedFrame();
+void resetFrameScheduler();
+FrameSchedulerStats getFrameSchedulerStats();
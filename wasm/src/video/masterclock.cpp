@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+#include "masterclock.hpp"
+
+// 音声の位置がこの時間進まなければ止まったとみなす
+const double AUDIO_STALL_SEC = 0.5;
+// 最初の映像フレームからこの時間待っても音声が来なければ映像で始める
+const double AUDIO_WAIT_SEC = 1.0;
+// 音声に戻す時、差がこれ以下なら少しずつ寄せ、超えていれば一度に合わせる
+const double HANDBACK_SLEW_LIMIT_SEC = 0.2;
+// 寄せる速さ(1秒あたりに動かす秒数)
+const double HANDBACK_SLEW_RATE = 0.05;
+const double HANDBACK_DONE_SEC = 0.005;
+
+struct MasterClockState {
+  std::mutex mtx;
+  ClockSource source = CLOCK_NONE;
+  double offset = NAN;
+  double lastEvalSec = NAN;
+  // 音声から求めたオフセットと、音声の位置が最後に進んだ時刻
+  double audioOffset = NAN;
+  double lastAudioPlayTime = NAN;
+  double lastAudioProgressSec = NAN;
+  // 最初に映像で始めようとした時刻
+  double firstVideoSec = NAN;
+};
+
+static MasterClockState state;
+
+static bool isAudioHealthy(double nowSec) {
+  return !std::isnan(state.audioOffset) &&
+         nowSec - state.lastAudioProgressSec < AUDIO_STALL_SEC;
+}
+
+static void setSource(ClockSource source) {
+  if (state.source != source) {
+    spdlog::info("master clock: {} -> {}", static_cast<int>(state.source),
+                 static_cast<int>(source));
+    state.source = source;
+  }
+}
+
+void updateAudioClock(double audioPlayTime, double nowSec) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (audioPlayTime != state.lastAudioPlayTime) {
+    state.lastAudioPlayTime = audioPlayTime;
+    state.lastAudioProgressSec = nowSec;
+  }
+  state.audioOffset = audioPlayTime - nowSec;
+}
+
+void anchorVideoClock(double ptsTime, double nowSec) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  if (!std::isnan(state.offset) || isAudioHealthy(nowSec)) {
+    return;
+  }
+  if (std::isnan(state.firstVideoSec)) {
+    state.firstVideoSec = nowSec;
+  }
+  if (nowSec - state.firstVideoSec < AUDIO_WAIT_SEC) {
+    return;
+  }
+  state.offset = ptsTime - nowSec;
+  state.lastEvalSec = nowSec;
+  setSource(CLOCK_WALL);
+}
+
+double getMasterClockOffset(double nowSec) {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  double elapsed = std::isnan(state.lastEvalSec)
+                       ? 0.0
+                       : std::max(0.0, nowSec - state.lastEvalSec);
+  state.lastEvalSec = nowSec;
+
+  if (!isAudioHealthy(nowSec)) {
+    // 直前の位置からそのまま進める(オフセットを変えなければ時計どおりに進む)
+    if (!std::isnan(state.offset)) {
+      setSource(CLOCK_WALL);
+    }
+    return state.offset;
+  }
+
+  double diff = state.audioOffset - state.offset;
+  if (state.source == CLOCK_WALL && std::abs(diff) <= HANDBACK_SLEW_LIMIT_SEC &&
+      std::abs(diff) > HANDBACK_DONE_SEC) {
+    // 映像が飛ばないよう、少しだけ速く・遅く進めて音声に追いつかせる
+    double step = HANDBACK_SLEW_RATE * elapsed;
+    state.offset += std::clamp(diff, -step, step);
+    return state.offset;
+  }
+  state.offset = state.audioOffset;
+  setSource(CLOCK_AUDIO);
+  return state.offset;
+}
+
+ClockSource getClockSource() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  return state.source;
+}
+
+void resetMasterClock() {
+  std::lock_guard<std::mutex> lock(state.mtx);
+  state.source = CLOCK_NONE;
+  state.offset = NAN;
+  state.lastEvalSec = NAN;
+  state.audioOffset = NAN;
+  state.lastAudioPlayTime = NAN;
+  state.lastAudioProgressSec = NAN;
+  state.firstVideoSec = NAN;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// 映像の表示の基準になる再生位置。
+// 音声が正常に出ている間は音声の再生位置に従い、音声が無い・止まった場合は
+// 最後の位置(無ければ映像のPTS)からemscripten_get_now()で進める。
+// 時刻はすべて秒で、再生位置は「now + オフセット」で求める
+
+enum ClockSource {
+  // まだ再生位置が決まっていない
+  CLOCK_NONE = 0,
+  CLOCK_AUDIO = 1,
+  CLOCK_WALL = 2,
+};
+
+// 現在再生している音声の位置を報告する(メインループから毎回呼ぶ)
+void updateAudioClock(double audioPlayTime, double nowSec);
+// 音声が来ないまま映像が届いている場合に、そのPTSから時計を始める。
+// 少し待っても音声が来なければ始めるので、表示のたびに呼んでよい
+void anchorVideoClock(double ptsTime, double nowSec);
+// 再生位置 - now。決まっていなければNaN
+double getMasterClockOffset(double nowSec);
+ClockSource getClockSource();
+void resetMasterClock();
@@ -0,0 +1,92 @@
+#include <emscripten/emscripten.h>
+#include <emscripten/threading.h>
+#include <pthread.h>
+#include <spdlog/spdlog.h>
+
+#include "../decoder/decoder.hpp"
+#include "../util/startup.hpp"
+#include "presenter.hpp"
+#include "renderer.hpp"
+
+// transferredcanvasesはquerySelectorで探されるので#付きで指定する
+const char *PRESENTER_CANVAS_SELECTOR = "#video";
+
+static pthread_t presenterThread;
+
+static void presenterMainloop() {
+  // mainloop
+  presentVideoFrame();
+}
+
+// GPUDeviceはスレッド間で受け渡しできないので、ワーカー側で取り直す
+extern "C" EMSCRIPTEN_KEEPALIVE void onPresenterDeviceReady(int useWebGpu) {
+  markStartup("presenter-device-ready");
+  spdlog::info("initializing renderer on presenter thread");
+  initRenderer(useWebGpu);
+  // vsyncに合わせて表示フレームを選ぶのでrAF駆動にする
+  emscripten_set_main_loop(presenterMainloop, 0, 0);
+}
+
+static void *presenterThreadFunc(void *arg) {
+  bool useWebGpu = arg != nullptr;
+  // clang-format off
+  EM_ASM({
+    (async function() {
+      if (!$0 || !navigator.gpu) {
+        _onPresenterDeviceReady(0);
+        return;
+      }
+      try {
+        const adapter = await navigator.gpu.requestAdapter();
+        if (!adapter) {
+          throw new Error('WebGPU adapter not available');
+        }
+        const requiredFeatures = [];
+        if (adapter.features.has('timestamp-query')) {
+          requiredFeatures.push('timestamp-query');
+        }
+        const device = await adapter.requestDevice({ requiredFeatures });
+        Module['preinitializedWebGPUDevice'] = device;
+      } catch (e) {
+        console.error('presenter: falling back to software renderer', e);
+        _onPresenterDeviceReady(0);
+        return;
+      }
+      _onPresenterDeviceReady(1);
+    })();
+  }, useWebGpu);
+  // clang-format on
+
+  // 以降はワーカーのイベントループで動く
+  emscripten_exit_with_live_runtime();
+  return nullptr;
+}
+
+bool startPresenter(bool useWebGpu) {
+  // clang-format off
+  bool supported = EM_ASM_INT({
+    return typeof OffscreenCanvas !== 'undefined' &&
+        typeof HTMLCanvasElement.prototype.transferControlToOffscreen ===
+            'function';
+  });
+  // clang-format on
+  if (!supported) {
+    spdlog::info("OffscreenCanvas not supported, presenting on main thread");
+    return false;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  emscripten_pthread_attr_settransferredcanvases(&attr,
+                                                 PRESENTER_CANVAS_SELECTOR);
+  // 引数はポインタしか渡せないので、WebGPUを使うかどうかをnullかどうかで渡す
+  void *arg = useWebGpu ? &presenterThread : nullptr;
+  int ret = pthread_create(&presenterThread, &attr, presenterThreadFunc, arg);
+  pthread_attr_destroy(&attr);
+  if (ret != 0) {
+    spdlog::error("pthread_create for presenter failed: {}", ret);
+    return false;
+  }
+  spdlog::info("presenter thread started");
+  return true;
+}
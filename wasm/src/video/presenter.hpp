@@ -0,0 +1,7 @@
+#pragma once
+
+// 映像の表示をOffscreenCanvasを持つ専用スレッドで行う。
+// useWebGpuがfalseか、スレッド側でWebGPUが使えなければCPUで描画する。
+// OffscreenCanvasが使えないブラウザではfalseを返すので、その場合は
+// メインスレッドでinitRenderer()/presentVideoFrame()を呼ぶ
+bool startPresenter(bool useWebGpu);
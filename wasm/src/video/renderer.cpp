@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+#include "renderer.hpp"
+#include "software.hpp"
+#include "webgpu.hpp"
+
+enum RendererType { RENDERER_NONE, RENDERER_WEBGPU, RENDERER_SOFTWARE };
+
+// 表示用のスレッドで決まり、統計のためにメインスレッドからも読まれる
+static std::atomic<RendererType> rendererType = RENDERER_NONE;
+static std::atomic<bool> rendererCheck = false;
+static std::atomic<bool> rendererCheckPending = false;
+// CPUで計算した、比較待ちのフレーム
+static std::vector<uint8_t> expectedRgba;
+
+void initRenderer(bool useWebGpu) {
+  if (useWebGpu) {
+    spdlog::info("initializing webgpu");
+    initWebGpu();
+    rendererType = RENDERER_WEBGPU;
+  } else {
+    spdlog::info("initializing software renderer");
+    initSoftwareRenderer();
+    rendererType = RENDERER_SOFTWARE;
+  }
+}
+
+void prepareRenderer(int width, int height, int format) {
+  if (rendererType == RENDERER_WEBGPU) {
+    prepareWebGpuTextures(width, height, format);
+  }
+}
+
+bool isRendererReady() {
+  switch (rendererType) {
+  case RENDERER_WEBGPU:
+    return isWebGpuReady();
+  case RENDERER_SOFTWARE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void compareWithExpected(const uint8_t *rgba, uint32_t bytesPerRow,
+                                int width, int height) {
+  size_t rowBytes = static_cast<size_t>(width) * 4;
+  if (expectedRgba.size() != rowBytes * height) {
+    spdlog::warn("renderer check: size mismatch {}x{}", width, height);
+    rendererCheckPending = false;
+    return;
+  }
+  size_t mismatched = 0;
+  int maxDiff = 0;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *gpu = rgba + static_cast<size_t>(y) * bytesPerRow;
+    const uint8_t *cpu = expectedRgba.data() + y * rowBytes;
+    for (size_t i = 0; i < rowBytes; i++) {
+      int diff = std::abs(gpu[i] - cpu[i]);
+      if (diff != 0) {
+        mismatched++;
+        maxDiff = std::max(maxDiff, diff);
+      }
+    }
+  }
+  spdlog::info("renderer check: {}x{} mismatched bytes:{} max diff:{}", width,
+               height, mismatched, maxDiff);
+  rendererCheckPending = false;
+}
+
+void drawVideoFrame(AVFrame *frame) {
+  if (rendererType == RENDERER_SOFTWARE) {
+    drawSoftware(frame);
+    return;
+  }
+  if (rendererType != RENDERER_WEBGPU) {
+    return;
+  }
+  if (!rendererCheck) {
+    drawWebGpu(frame);
+    return;
+  }
+
+  // 前後のフレームの履歴を揃えるため、比較しないフレームもCPUで計算する
+  // 読み出しは描画前に要求しておき、このフレームの変換結果と比べる
+  std::vector<uint8_t> rgba;
+  bool comparable = renderSoftware(frame, rgba);
+  if (comparable && !rendererCheckPending) {
+    expectedRgba = std::move(rgba);
+    rendererCheckPending = requestWebGpuFrameReadback(compareWithExpected);
+  }
+  drawWebGpu(frame);
+}
+
+double getRendererFrameMs() {
+  switch (rendererType) {
+  case RENDERER_WEBGPU:
+    return getWebGpuTimings().yadifMs;
+  case RENDERER_SOFTWARE:
+    return getSoftwareRenderMs();
+  default:
+    return 0.0;
+  }
+}
+
+bool isSoftwareRenderer() {
+  //
+  return rendererType == RENDERER_SOFTWARE;
+}
+
+bool supportsCaptionOverlay() {
+  //
+  return rendererType == RENDERER_WEBGPU;
+}
+
+void setRendererCaptionPage(const CaptionPage &page) {
+  if (rendererType == RENDERER_WEBGPU) {
+    setWebGpuCaptionPage(page);
+  }
+}
+
+void setDeinterlace(bool enabled) {
+  setWebGpuDeinterlace(enabled);
+  setSoftwareDeinterlace(enabled);
+}
+
+void setRendererCheck(bool enabled) {
+  //
+  rendererCheck = enabled;
+}
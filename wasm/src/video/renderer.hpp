@@ -0,0 +1,29 @@
+#pragma once
+
+struct CaptionPage;
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// WebGPUが使えればWebGPUで、使えなければCPU(software.cpp)で描画する
+void initRenderer(bool useWebGpu);
+// 指定の解像度・フォーマット用の描画リソースを描画前に用意しておく
+void prepareRenderer(int width, int height, int format);
+// 描画の準備(パイプラインの作成など)が終わっているか。
+// 終わるまではキューのフレームを取り出さずに待つ
+bool isRendererReady();
+void drawVideoFrame(AVFrame *frame);
+// 1フレームのインターレース解除・色変換にかかる時間(ms)の直近の平均。
+// WebGPUではyadifパスのGPU時間、CPUではその処理時間
+double getRendererFrameMs();
+bool isSoftwareRenderer();
+// 字幕を描画に重ねられるか(WebGPUのみ)。CPUでの描画ではJSのcanvasに任せる
+bool supportsCaptionOverlay();
+// 次に描画するフレームから重ねる字幕を差し替える。runsが空なら消す
+void setRendererCaptionPage(const CaptionPage &page);
+// インターレース解除(yadif)の有無。WebGPU・CPUのどちらの描画にも効く
+void setDeinterlace(bool enabled);
+// WebGPUの出力をCPUで計算した結果と突き合わせてログに出す(動作確認用)。
+// 有効な間は毎フレームCPUでも計算するので重い
+void setRendererCheck(bool enabled);
@@ -0,0 +1,244 @@
+#include <map>
+#include <memory>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rendergraph.hpp"
+
+// 解像度ごとに保持しておく中間テクスチャの組の最大数。
+// 切り替え前後の2つの解像度を行き来しても作り直さないようにする
+const size_t MAX_TRANSIENT_SIZES = 2;
+
+struct RenderGraphPass {
+  std::string name;
+  RenderGraphTarget target;
+  RenderGraphPassFunc execute;
+  bool enabled;
+};
+
+// 実行計画の1ステップ。input/outputは中間テクスチャの番号(無ければ-1)
+struct RenderGraphStep {
+  RenderGraphPass *pass;
+  int input;
+  int output;
+};
+
+struct TransientTextures {
+  std::vector<RenderGraphTexture> textures;
+  uint64_t lastUsed = 0;
+};
+
+struct RenderGraph {
+  WGPUDevice device = nullptr;
+  WGPUSampler sampler = nullptr;
+  WGPUBindGroupLayout inputLayout = nullptr;
+  WGPUBindGroupLayout outputLayout = nullptr;
+  std::vector<std::unique_ptr<RenderGraphPass>> passes;
+  // パスの有効・無効が変わるたびに増やし、実行時に計画を作り直す
+  uint32_t revision = 1;
+  uint32_t compiledRevision = 0;
+  std::vector<RenderGraphStep> plan;
+  // 計画が同時に必要とする中間テクスチャの数
+  int transientCount = 0;
+  std::map<std::pair<int, int>, TransientTextures> transientPool;
+  uint64_t executeCount = 0;
+};
+
+static RenderGraph graph;
+
+void initRenderGraph(WGPUDevice device, WGPUSampler sampler,
+                     WGPUBindGroupLayout inputLayout,
+                     WGPUBindGroupLayout outputLayout) {
+  graph.device = device;
+  graph.sampler = sampler;
+  graph.inputLayout = inputLayout;
+  graph.outputLayout = outputLayout;
+}
+
+int addRenderGraphPass(const char *name, RenderGraphTarget target,
+                       RenderGraphPassFunc execute, bool enabled) {
+  auto pass = std::make_unique<RenderGraphPass>();
+  pass->name = name;
+  pass->target = target;
+  pass->execute = std::move(execute);
+  pass->enabled = enabled;
+  graph.passes.push_back(std::move(pass));
+  graph.revision++;
+  return static_cast<int>(graph.passes.size()) - 1;
+}
+
+void setRenderGraphPassEnabled(int id, bool enabled) {
+  if (id < 0 || id >= static_cast<int>(graph.passes.size())) {
+    return;
+  }
+  if (graph.passes[id]->enabled != enabled) {
+    graph.passes[id]->enabled = enabled;
+    graph.revision++;
+  }
+}
+
+bool isRenderGraphPassEnabled(int id) {
+  if (id < 0 || id >= static_cast<int>(graph.passes.size())) {
+    return false;
+  }
+  return graph.passes[id]->enabled;
+}
+
+// 有効なパスだけを並べ、中間テクスチャを割り当てる。
+// 中間テクスチャは次に中間テクスチャへ書くパスが読み終えた時点で空くので、
+// 空いたものから順に再利用する
+static void compileRenderGraph() {
+  graph.plan.clear();
+  graph.transientCount = 0;
+  std::vector<int> freeTextures;
+  int live = -1;
+  std::string order;
+  for (auto &pass : graph.passes) {
+    if (!pass->enabled) {
+      continue;
+    }
+    RenderGraphStep step = {pass.get(), live, -1};
+    if (pass->target == TARGET_TRANSIENT) {
+      if (freeTextures.empty()) {
+        step.output = graph.transientCount++;
+      } else {
+        step.output = freeTextures.back();
+        freeTextures.pop_back();
+      }
+      if (live >= 0) {
+        freeTextures.push_back(live);
+      }
+      live = step.output;
+    }
+    graph.plan.push_back(step);
+    order += (order.empty() ? "" : " -> ") + pass->name;
+  }
+  spdlog::info("render graph: {} (transient textures: {})", order,
+               graph.transientCount);
+}
+
+static void releaseTransient(RenderGraphTexture &tex) {
+  wgpuBindGroupRelease(tex.inputBindGroup);
+  wgpuBindGroupRelease(tex.outputBindGroup);
+  wgpuTextureViewRelease(tex.view);
+  wgpuTextureRelease(tex.texture);
+}
+
+static void createTransient(RenderGraphTexture &tex, int width, int height) {
+  tex.width = width;
+  tex.height = height;
+
+  WGPUTextureDescriptor textureDesc = {};
+  textureDesc.dimension = WGPUTextureDimension_2D;
+  textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
+  // CopySrcはフレームの読み出し(動作確認用)のため
+  textureDesc.usage = WGPUTextureUsage_CopySrc |
+                      WGPUTextureUsage_TextureBinding |
+                      WGPUTextureUsage_StorageBinding;
+  textureDesc.sampleCount = 1;
+  textureDesc.mipLevelCount = 1;
+  textureDesc.size = {.width = static_cast<uint32_t>(width),
+                      .height = static_cast<uint32_t>(height),
+                      .depthOrArrayLayers = 1};
+  tex.texture = wgpuDeviceCreateTexture(graph.device, &textureDesc);
+
+  WGPUTextureViewDescriptor viewDesc = {};
+  viewDesc.format = WGPUTextureFormat_RGBA8Unorm;
+  viewDesc.dimension = WGPUTextureViewDimension_2D;
+  viewDesc.arrayLayerCount = 1;
+  viewDesc.mipLevelCount = 1;
+  viewDesc.aspect = WGPUTextureAspect_All;
+  tex.view = wgpuTextureCreateView(tex.texture, &viewDesc);
+
+  WGPUBindGroupEntry inputEntries[] = {
+      {.binding = 0, .sampler = graph.sampler},
+      {.binding = 1, .textureView = tex.view},
+  };
+  WGPUBindGroupDescriptor bgDesc = {};
+  bgDesc.layout = graph.inputLayout;
+  bgDesc.entryCount = sizeof(inputEntries) / sizeof(inputEntries[0]);
+  bgDesc.entries = inputEntries;
+  tex.inputBindGroup = wgpuDeviceCreateBindGroup(graph.device, &bgDesc);
+
+  WGPUBindGroupEntry outputEntries[] = {
+      {.binding = 0, .textureView = tex.view},
+  };
+  bgDesc.layout = graph.outputLayout;
+  bgDesc.entryCount = sizeof(outputEntries) / sizeof(outputEntries[0]);
+  bgDesc.entries = outputEntries;
+  tex.outputBindGroup = wgpuDeviceCreateBindGroup(graph.device, &bgDesc);
+}
+
+// 一番長く使われていない解像度のものから捨てる
+static void evictTransients(const std::pair<int, int> &keep) {
+  while (graph.transientPool.size() > MAX_TRANSIENT_SIZES) {
+    auto oldest = graph.transientPool.end();
+    for (auto it = graph.transientPool.begin();
+         it != graph.transientPool.end(); ++it) {
+      if (it->first == keep) {
+        continue;
+      }
+      if (oldest == graph.transientPool.end() ||
+          it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    if (oldest == graph.transientPool.end()) {
+      return;
+    }
+    for (auto &tex : oldest->second.textures) {
+      releaseTransient(tex);
+    }
+    graph.transientPool.erase(oldest);
+  }
+}
+
+static TransientTextures &getTransients(int width, int height) {
+  if (graph.compiledRevision != graph.revision) {
+    graph.compiledRevision = graph.revision;
+    compileRenderGraph();
+  }
+  auto key = std::make_pair(width, height);
+  TransientTextures &transients = graph.transientPool[key];
+  // パスを有効にして足りなくなった分だけ作る。余った分はそのまま持っておく
+  while (static_cast<int>(transients.textures.size()) <
+         graph.transientCount) {
+    spdlog::info("create transient texture: {}x{}", width, height);
+    createTransient(transients.textures.emplace_back(), width, height);
+  }
+  evictTransients(key);
+  return transients;
+}
+
+void prepareRenderGraph(int width, int height) {
+  if (!graph.device || width <= 0 || height <= 0) {
+    return;
+  }
+  getTransients(width, height);
+}
+
+void executeRenderGraph(WGPUCommandEncoder encoder, AVFrame *frame,
+                        WGPUTextureView swapChainView) {
+  TransientTextures &transients = getTransients(frame->width, frame->height);
+  transients.lastUsed = ++graph.executeCount;
+
+  bool swapChainCleared = false;
+  for (auto &step : graph.plan) {
+    RenderGraphPassContext passCtx = {
+        .encoder = encoder,
+        .frame = frame,
+        .input = step.input >= 0 ? &transients.textures[step.input] : nullptr,
+        .output =
+            step.output >= 0 ? &transients.textures[step.output] : nullptr,
+        .swapChainView = swapChainView,
+        .clearSwapChain = false,
+    };
+    if (step.pass->target == TARGET_SWAPCHAIN) {
+      passCtx.clearSwapChain = !swapChainCleared;
+      swapChainCleared = true;
+    }
+    step.pass->execute(passCtx);
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <webgpu/webgpu.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// 描画をパスの列として組み立てる。
+// パスは登録した順に実行され、無効なパスは実行計画から外れるので何もしない。
+// パス間で受け渡す中間テクスチャはグラフが持ち、寿命が重ならないパス同士で
+// 同じテクスチャを使い回す(パスが増えても同時に生きている2枚で済む)。
+// すべて描画スレッドから呼ぶ
+
+// パス間で受け渡す中間テクスチャ(フレームと同じ大きさのRGBA)
+struct RenderGraphTexture {
+  int width = 0;
+  int height = 0;
+  WGPUTexture texture = nullptr;
+  WGPUTextureView view = nullptr;
+  // 読む側のパスの@group(0) (binding 0: sampler, 1: texture)
+  WGPUBindGroup inputBindGroup = nullptr;
+  // 書く側のcomputeパスの@group(1) (binding 0: storage texture)
+  WGPUBindGroup outputBindGroup = nullptr;
+};
+
+enum RenderGraphTarget {
+  // 中間テクスチャに書く
+  TARGET_TRANSIENT,
+  // swapchainに書く。最初のパスがクリアし、以降のパスは上に重ねる
+  TARGET_SWAPCHAIN,
+};
+
+struct RenderGraphPassContext {
+  WGPUCommandEncoder encoder;
+  AVFrame *frame;
+  // 直前に中間テクスチャに書いたパスの出力。
+  // 最初のパスではnullptr(フレームのプレーンから読む)
+  RenderGraphTexture *input;
+  // TARGET_TRANSIENTのパスの書き込み先
+  RenderGraphTexture *output;
+  // TARGET_SWAPCHAINのパスの書き込み先
+  WGPUTextureView swapChainView;
+  bool clearSwapChain;
+};
+
+using RenderGraphPassFunc = std::function<void(RenderGraphPassContext &)>;
+
+// inputLayout/outputLayoutは中間テクスチャのバインドグループの作成に使う
+void initRenderGraph(WGPUDevice device, WGPUSampler sampler,
+                     WGPUBindGroupLayout inputLayout,
+                     WGPUBindGroupLayout outputLayout);
+// パスを末尾に追加してidを返す
+int addRenderGraphPass(const char *name, RenderGraphTarget target,
+                       RenderGraphPassFunc execute, bool enabled = true);
+void setRenderGraphPassEnabled(int id, bool enabled);
+bool isRenderGraphPassEnabled(int id);
+// 中間テクスチャを描画前に用意しておく
+void prepareRenderGraph(int width, int height);
+void executeRenderGraph(WGPUCommandEncoder encoder, AVFrame *frame,
+                        WGPUTextureView swapChainView);
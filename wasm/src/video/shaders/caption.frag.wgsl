@@ -0,0 +1,22 @@
+R"(
+struct VertexOutput {
+  @builtin(position) Position : vec4<f32>,
+  @location(0) atlasUV : vec2<f32>,
+  @location(1) @interpolate(flat) foreground : vec4<f32>,
+  @location(2) @interpolate(flat) outline : vec4<f32>,
+  @location(3) @interpolate(flat) kind : u32,
+};
+
+@group(0) @binding(0) var atlasSampler: sampler;
+@group(0) @binding(1) var atlasTexture: texture_2d<f32>;
+
+// kind 0: 塗りつぶし(背景・下線), 1: アトラスの文字・DRCS
+// アトラスはrが文字の塗り、gが縁取りの濃さ
+@fragment
+fn main(input : VertexOutput) -> @location(0) vec4<f32> {
+  var coverage = textureSample(atlasTexture, atlasSampler, input.atlasUV);
+  var glyph = input.foreground * coverage.r +
+      input.outline * (coverage.g * (1.0 - coverage.r));
+  return select(glyph, input.foreground, input.kind == 0u);
+}
+)"
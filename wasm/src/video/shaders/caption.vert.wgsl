@@ -0,0 +1,51 @@
+R"(
+struct CaptionParams {
+  planeSize : vec2<f32>,
+  padding : vec2<f32>,
+};
+
+struct VertexOutput {
+  @builtin(position) Position : vec4<f32>,
+  @location(0) atlasUV : vec2<f32>,
+  @location(1) @interpolate(flat) foreground : vec4<f32>,
+  @location(2) @interpolate(flat) outline : vec4<f32>,
+  @location(3) @interpolate(flat) kind : u32,
+};
+
+@group(0) @binding(2) var<uniform> params: CaptionParams;
+
+// 0xRRGGBBAAを乗算済みアルファのRGBAにする
+fn unpackColor(rgba: u32) -> vec4<f32> {
+  var c = unpack4x8unorm(rgba).wzyx;
+  return vec4<f32>(c.rgb * c.a, c.a);
+}
+
+// インスタンスごとに四角形を1つ描く。
+// rectは表示面の座標(x, y, 幅, 高さ)、uvRectはアトラス上の範囲(左上, 右下)、
+// styleは(文字色, 縁取りの色, 種類, 未使用)
+@vertex
+fn main(@builtin(vertex_index) VertexIndex : u32,
+        @location(0) rect : vec4<f32>,
+        @location(1) uvRect : vec4<f32>,
+        @location(2) style : vec4<u32>) -> VertexOutput {
+  var corner = array<vec2<f32>, 6>(
+      vec2<f32>(0.0, 0.0),
+      vec2<f32>(1.0, 0.0),
+      vec2<f32>(0.0, 1.0),
+
+      vec2<f32>(1.0, 0.0),
+      vec2<f32>(1.0, 1.0),
+      vec2<f32>(0.0, 1.0));
+
+  var c = corner[VertexIndex];
+  var pos = (rect.xy + rect.zw * c) / params.planeSize;
+
+  var output : VertexOutput;
+  output.Position = vec4<f32>(pos.x * 2.0 - 1.0, 1.0 - pos.y * 2.0, 0.0, 1.0);
+  output.atlasUV = mix(uvRect.xy, uvRect.zw, c);
+  output.foreground = unpackColor(style.x);
+  output.outline = unpackColor(style.y);
+  output.kind = style.z;
+  return output;
+}
+)"
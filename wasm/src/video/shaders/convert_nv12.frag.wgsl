@@ -0,0 +1,27 @@
+R"(
+// convert.frag.wgslのNV12版。バインディングはyadif_nv12.frag.wgslと同じ
+@group(0) @binding(0) var mySampler : sampler;
+@group(0) @binding(2) var currentY : texture_2d<f32>;
+@group(0) @binding(3) var currentUV : texture_2d<f32>;
+@group(1) @binding(0) var outputFrame : texture_storage_2d<rgba8unorm, write>;
+
+@compute
+@workgroup_size(16, 4, 1)
+fn main(
+  @builtin(global_invocation_id) coord3: vec3<u32>
+) {
+  var col = i32(coord3[0]);
+  var row = i32(coord3[1]);
+  var uv = (load(currentUV, col, row) - 128.0 / 255.0) * 128.0 / (128.0 - 16.0);
+  var u = uv.x;
+  var v = uv.y;
+  var y00 = (load(currentY, 2 * col + 0, 2 * row + 0).x - 16.0 / 255.0) * 255.0 / (235.0 - 16.0);
+  var y01 = (load(currentY, 2 * col + 0, 2 * row + 1).x - 16.0 / 255.0) * 255.0 / (235.0 - 16.0);
+  var y10 = (load(currentY, 2 * col + 1, 2 * row + 0).x - 16.0 / 255.0) * 255.0 / (235.0 - 16.0);
+  var y11 = (load(currentY, 2 * col + 1, 2 * row + 1).x - 16.0 / 255.0) * 255.0 / (235.0 - 16.0);
+  textureStore(outputFrame, vec2<i32>(2 * col + 0, 2 * row + 0), yuv2rgba(y00, u, v));
+  textureStore(outputFrame, vec2<i32>(2 * col + 0, 2 * row + 1), yuv2rgba(y01, u, v));
+  textureStore(outputFrame, vec2<i32>(2 * col + 1, 2 * row + 0), yuv2rgba(y10, u, v));
+  textureStore(outputFrame, vec2<i32>(2 * col + 1, 2 * row + 1), yuv2rgba(y11, u, v));
+}
+)"
@@ -0,0 +1,37 @@
+R"(
+struct SharpenParams {
+  strength : f32,
+  padding0 : f32,
+  padding1 : f32,
+  padding2 : f32,
+};
+
+@group(0) @binding(0) var mySampler : sampler;
+@group(0) @binding(1) var inputFrame : texture_2d<f32>;
+@group(1) @binding(0) var outputFrame : texture_storage_2d<rgba8unorm, write>;
+@group(2) @binding(0) var<uniform> params : SharpenParams;
+
+fn loadClamped(pos: vec2<i32>, dim: vec2<i32>) -> vec3<f32> {
+  return textureLoad(inputFrame, clamp(pos, vec2<i32>(0), dim - 1), 0).rgb;
+}
+
+// 上下左右の4近傍とのアンシャープマスク
+@compute
+@workgroup_size(8, 8, 1)
+fn main(
+  @builtin(global_invocation_id) coord3: vec3<u32>
+) {
+  var dim = vec2<i32>(textureDimensions(inputFrame));
+  var pos = vec2<i32>(coord3.xy);
+  if (pos.x >= dim.x || pos.y >= dim.y) {
+    return;
+  }
+  var center = loadClamped(pos, dim);
+  var neighbors = loadClamped(pos + vec2<i32>(-1, 0), dim) +
+                  loadClamped(pos + vec2<i32>(1, 0), dim) +
+                  loadClamped(pos + vec2<i32>(0, -1), dim) +
+                  loadClamped(pos + vec2<i32>(0, 1), dim);
+  var sharpened = center + params.strength * (4.0 * center - neighbors);
+  textureStore(outputFrame, pos, vec4<f32>(clamp(sharpened, vec3<f32>(0.0), vec3<f32>(1.0)), 1.0));
+}
+)"
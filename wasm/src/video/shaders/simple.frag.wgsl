@@ -1,9 +1,55 @@
 R"(
+struct ScaleParams {
+  outputSize : vec2<f32>,
+  filter : u32,
+  padding : u32,
+};
+
 @group(0) @binding(0) var mySampler: sampler;
 @group(0) @binding(1) var myTexture: texture_2d<f32>;
+@group(1) @binding(0) var<uniform> params: ScaleParams;
+
+// Catmull-Rom (B=0, C=0.5)
+fn cubic(x: f32) -> f32 {
+  var ax = abs(x);
+  if (ax < 1.0) {
+    return (1.5 * ax - 2.5) * ax * ax + 1.0;
+  }
+  if (ax < 2.0) {
+    return ((-0.5 * ax + 2.5) * ax - 4.0) * ax + 2.0;
+  }
+  return 0.0;
+}
+
+// 分離可能なカーネルを縦横それぞれの重みの積で評価する。
+// 縮小時はエイリアスを避けるためにカーネルを縮小率分だけ広げる(最大2倍)。
+fn sampleBicubic(fragUV: vec2<f32>) -> vec4<f32> {
+  var dim = vec2<i32>(textureDimensions(myTexture));
+  var scale = clamp(vec2<f32>(dim) / params.outputSize, vec2<f32>(1.0), vec2<f32>(2.0));
+  var pos = fragUV * vec2<f32>(dim) - 0.5;
+  var base = vec2<i32>(floor(pos));
+  var radius = vec2<i32>(ceil(2.0 * scale));
+
+  var sum = vec4<f32>(0.0);
+  var weightSum = 0.0;
+  for (var j = 1 - radius[1]; j <= radius[1]; j++) {
+    var y = clamp(base[1] + j, 0, dim[1] - 1);
+    var wy = cubic((f32(base[1] + j) - pos[1]) / scale[1]);
+    for (var i = 1 - radius[0]; i <= radius[0]; i++) {
+      var x = clamp(base[0] + i, 0, dim[0] - 1);
+      var w = wy * cubic((f32(base[0] + i) - pos[0]) / scale[0]);
+      sum += w * textureLoad(myTexture, vec2<i32>(x, y), 0);
+      weightSum += w;
+    }
+  }
+  return clamp(sum / weightSum, vec4<f32>(0.0), vec4<f32>(1.0));
+}
 
 @fragment
 fn main(@location(0) fragUV : vec2<f32>) -> @location(0) vec4<f32> {
+  if (params.filter == 1u) {
+    return sampleBicubic(fragUV);
+  }
   return textureSampleLevel(myTexture, mySampler, fragUV, 0.0);
 }
 )"
@@ -0,0 +1,125 @@
+R"(
+fn to_coord(tex: texture_2d<f32>, fragUV: vec2<f32>) -> vec2<i32> {
+  var dim = textureDimensions(tex);
+  return vec2<i32>(
+    i32(fragUV[0] * f32(dim[0])),
+    i32(fragUV[1] * f32(dim[1]))
+  );
+}
+
+fn bordered(x_: i32, y_: i32, dim: vec2<i32>) -> vec2<i32> {
+  var x = x_;
+  var y = y_;
+  if (x < 0) {
+    x = -x;
+  }
+  if (y < 0) {
+    y = -y;
+  }
+  if (x > dim[0] - 1) {
+    x = dim[0] - 1 - (x - (dim[0] - 1));
+  }
+  if (y > dim[1] - 1) {
+    y = dim[1] - 1 - (y - (dim[1] - 1));
+  }
+  return vec2<i32>(x, y);
+}
+
+// R8のプレーンは.x、RG8にパックしたUVプレーンは.xyにU/Vが入るので、
+// yadifは2チャンネルまとめて計算する
+fn load(tex: texture_2d<f32>, x: i32, y: i32) -> vec2<f32> {
+
+  // https://www.w3.org/TR/WGSL/#textureload
+  // If an out of bounds access occurs, the built-in function returns one of:
+  // - The data for some texel within bounds of the texture
+  // - A vector (0,0,0,0) or (0,0,0,1) of the appropriate type for non-depth textures
+  // - 0.0 for depth textures
+  // とあるので、実装によって結果が違うかも・・・
+  return textureLoad(tex, vec2<i32>(x, y), 0).xy;
+
+  // return textureLoad(tex, bordered(x, y, textureDimensions(tex)), 0).xy;
+}
+
+fn avg(a: vec2<f32>, b: vec2<f32>) -> vec2<f32> {
+  return (a + b) * 0.5;
+}
+
+fn absd(a: vec2<f32>, b: vec2<f32>) -> vec2<f32> {
+  return max(a, b) - min(a, b);
+}
+
+fn max3(a: vec2<f32>, b: vec2<f32>, c: vec2<f32>) -> vec2<f32> {
+  return max(max(a, b), c);
+}
+
+fn min3(a: vec2<f32>, b: vec2<f32>, c: vec2<f32>) -> vec2<f32> {
+  return (min(min(a, b), c));
+}
+
+fn yadif(cur: texture_2d<f32>, prev: texture_2d<f32>, next: texture_2d<f32>, x: i32, y: i32) -> vec2<f32> {
+  if (y % 2 == 0) {
+    return load(cur, x, y);
+  }
+  var c = load(cur, x, y - 1);
+  var d = avg(load(cur, x, y), load(next, x, y));
+  var e = load(cur, x, y + 1);
+  var tmp_diff0 = absd(load(cur, x, y), load(next, x, y)) / 2.0;
+  var tmp_diff1 = avg(absd(load(prev, x, y - 1), c), absd(load(prev, x, y + 1), e));
+  var tmp_diff2 = avg(absd(load(next, x, y - 1), c), absd(load(next, x, y + 1), e));
+  var diff = max3(tmp_diff0, tmp_diff1, tmp_diff2);
+
+  var b = avg(load(cur, x, y - 2), load(next, x, y - 2));
+  var f = avg(load(cur, x, y + 2), load(next, x, y + 2));
+  var max_ = max3(d - e, d - c, min(b - c, f - e));
+  var min_ = min3(d - e, d - c, max(b - c, f - e));
+  diff = max3(diff, min_, -max_);
+
+  var score_0 =
+    absd(load(cur, x - 1, y - 1), load(cur, x - 1, y + 1))
+    + absd(c, e)
+    + absd(load(cur, x + 1, y - 1), load(cur, x + 1, y + 1))
+    - 1.0 / 255.0;
+
+  var score_1 =
+      absd(load(cur, x - 2, y - 1), load(cur, x - 0, y + 1))
+    + absd(load(cur, x - 1, y - 1), load(cur, x + 1, y + 1))
+    + absd(load(cur, x - 0, y - 1), load(cur, x + 2, y + 1));
+
+  var score_2 =
+      absd(load(cur, x - 0, y - 1), load(cur, x - 2, y + 1))
+    + absd(load(cur, x + 1, y - 1), load(cur, x - 1, y + 1))
+    + absd(load(cur, x + 2, y - 1), load(cur, x - 0, y + 1));
+
+  var score_11 =
+      absd(load(cur, x - 3, y - 1), load(cur, x + 1, y + 1))
+    + absd(load(cur, x - 2, y - 1), load(cur, x + 2, y + 1))
+    + absd(load(cur, x - 1, y - 1), load(cur, x + 3, y + 1));
+
+  var score_21 =
+      absd(load(cur, x + 1, y - 1), load(cur, x - 3, y + 1))
+    + absd(load(cur, x + 2, y - 1), load(cur, x - 2, y + 1))
+    + absd(load(cur, x + 3, y - 1), load(cur, x - 1, y + 1));
+
+  var spatial_pred_0 = avg(c, e);
+  var spatial_pred_1 = avg(load(cur, x - 1, y - 1), load(cur, x + 1, y + 1));
+  var spatial_pred_11 = avg(load(cur, x - 2, y - 1), load(cur, x + 2, y + 1));
+  var spatial_pred_2 = avg(load(cur, x + 1, y - 1), load(cur, x - 1, y + 1));
+  var spatial_pred_21 = avg(load(cur, x + 2, y - 1), load(cur, x - 2, y + 1));
+
+  // チャンネルごとに方向が違うことがあるので分岐ではなくselectで選ぶ
+  var use_1 = (score_1 < score_0) & (score_1 < score_2);
+  var use_2 = (!use_1) & (score_2 < score_0) & (score_2 < score_1);
+  var spatial_pred = spatial_pred_0;
+  spatial_pred = select(spatial_pred, select(spatial_pred_2, spatial_pred_21, score_21 < score_2), use_2);
+  spatial_pred = select(spatial_pred, select(spatial_pred_1, spatial_pred_11, score_11 < score_1), use_1);
+  return clamp(spatial_pred, d - diff, d + diff);
+}
+
+fn yuv2rgba(y: f32, u: f32, v: f32) -> vec4<f32> {
+  return vec4<f32>(
+    clamp(y + 1.5748 * v, 0.0, 1.0),
+    clamp(y - 0.1873 * u - 0.4681 * v, 0.0, 1.0),
+    clamp(y + 1.8556 * u, 0.0, 1.0),
+    1.0);
+}
+)"
@@ -0,0 +1,577 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <emscripten/emscripten.h>
+#include <emscripten/html5.h>
+#include <functional>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../util/rollingwindow.hpp"
+#include "../util/trace.hpp"
+#include "software.hpp"
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+}
+
+// 行を分けて処理するスレッド数の上限(呼び出し元のスレッドを含まない)
+const int MAX_SOFTWARE_WORKERS = 3;
+
+enum SoftwareSlot { SW_PREV = 0, SW_CUR = 1, SW_NEXT = 2, SW_SLOT_COUNT = 3 };
+
+// yadifで前後のフレームを参照するために、Y/U/Vを隙間なく詰めて保持する
+struct PlanarFrame {
+  std::vector<uint8_t> planes[3];
+};
+
+struct Plane {
+  const uint8_t *data;
+  int width;
+  int height;
+};
+
+struct SoftwareContext {
+  int width = 0;
+  int height = 0;
+  PlanarFrame slots[SW_SLOT_COUNT];
+  // 今の解像度になってから受け取ったフレーム数
+  int history = 0;
+  std::vector<uint8_t> rgba;
+  // UIのスレッドから切り替えられる
+  std::atomic<bool> deinterlace = true;
+  // yadif・色変換にかかった時間。統計のためにメインスレッドから読まれる
+  std::mutex timingMtx;
+  RollingWindow<120> renderMs;
+
+  std::vector<std::thread> workers;
+  int workerCount = 0;
+  std::mutex mtx;
+  std::condition_variable startCv, doneCv;
+  std::function<void(int, int)> job;
+  int jobRows = 0;
+  uint64_t generation = 0;
+  int pending = 0;
+
+  bool canvasResized = true;
+  int canvasWidth = 0;
+  int canvasHeight = 0;
+};
+
+static SoftwareContext sw;
+
+// シェーダの定数式と同じく、倍精度で計算してからf32に丸める
+const float ONE_255 = static_cast<float>(1.0 / 255.0);
+const float LUMA_OFFSET = static_cast<float>(16.0 / 255.0);
+const float CHROMA_OFFSET = static_cast<float>(128.0 / 255.0);
+
+struct ScalarLanes {
+  static constexpr int N = 1;
+  using V = float;
+  using M = bool;
+
+  static V splat(float v) { return v; }
+  static V load(const uint8_t *row, int x, int width) {
+    // textureLoadの範囲外アクセスはChrome(Dawn)では範囲内に丸められる
+    return row[std::clamp(x, 0, width - 1)] / 255.0f;
+  }
+  static V loadFloat(const float *p) { return *p; }
+  // 輝度の位置xに対応する色差(同じ値を2画素で使う)
+  static V loadChroma(const float *p, int x) { return p[x / 2]; }
+  static void store(float *p, V v) { *p = v; }
+  static void storeRgba(uint8_t *p, V r, V g, V b) {
+    p[0] = static_cast<uint8_t>(r * 255.0f + 0.5f);
+    p[1] = static_cast<uint8_t>(g * 255.0f + 0.5f);
+    p[2] = static_cast<uint8_t>(b * 255.0f + 0.5f);
+    p[3] = 255;
+  }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V neg(V a) { return -a; }
+  static V min(V a, V b) { return b < a ? b : a; }
+  static V max(V a, V b) { return a < b ? b : a; }
+  static M lt(V a, V b) { return a < b; }
+  static M both(M a, M b) { return a && b; }
+  static M invert(M a) { return !a; }
+  static V select(V f, V t, M cond) { return cond ? t : f; }
+};
+
+#ifdef __wasm_simd128__
+struct SimdLanes {
+  static constexpr int N = 4;
+  using V = v128_t;
+  using M = v128_t;
+
+  static V splat(float v) { return wasm_f32x4_splat(v); }
+  static V load(const uint8_t *row, int x, int width) {
+    if (x >= 0 && x + N <= width) {
+      v128_t bytes = wasm_v128_load32_zero(row + x);
+      v128_t ints =
+          wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(bytes));
+      return wasm_f32x4_div(wasm_f32x4_convert_u32x4(ints),
+                            wasm_f32x4_splat(255.0f));
+    }
+    return wasm_f32x4_make(ScalarLanes::load(row, x, width),
+                           ScalarLanes::load(row, x + 1, width),
+                           ScalarLanes::load(row, x + 2, width),
+                           ScalarLanes::load(row, x + 3, width));
+  }
+  static V loadFloat(const float *p) { return wasm_v128_load(p); }
+  static V loadChroma(const float *p, int x) {
+    return wasm_f32x4_make(p[x / 2], p[x / 2], p[x / 2 + 1], p[x / 2 + 1]);
+  }
+  static void store(float *p, V v) { wasm_v128_store(p, v); }
+  static void storeRgba(uint8_t *p, V r, V g, V b) {
+    v128_t half = wasm_f32x4_splat(0.5f);
+    v128_t scale = wasm_f32x4_splat(255.0f);
+    v128_t ri = wasm_i32x4_trunc_sat_f32x4(
+        wasm_f32x4_add(wasm_f32x4_mul(r, scale), half));
+    v128_t gi = wasm_i32x4_trunc_sat_f32x4(
+        wasm_f32x4_add(wasm_f32x4_mul(g, scale), half));
+    v128_t bi = wasm_i32x4_trunc_sat_f32x4(
+        wasm_f32x4_add(wasm_f32x4_mul(b, scale), half));
+    // リトルエンディアンなのでR,G,B,Aの順に並ぶ
+    v128_t pixels = wasm_v128_or(
+        wasm_v128_or(ri, wasm_i32x4_shl(gi, 8)),
+        wasm_v128_or(wasm_i32x4_shl(bi, 16), wasm_i32x4_splat(0xff000000)));
+    wasm_v128_store(p, pixels);
+  }
+  static V add(V a, V b) { return wasm_f32x4_add(a, b); }
+  static V sub(V a, V b) { return wasm_f32x4_sub(a, b); }
+  static V mul(V a, V b) { return wasm_f32x4_mul(a, b); }
+  static V div(V a, V b) { return wasm_f32x4_div(a, b); }
+  static V neg(V a) { return wasm_f32x4_neg(a); }
+  // pmin/pmaxはスカラー版の比較と同じ値を返す
+  static V min(V a, V b) { return wasm_f32x4_pmin(a, b); }
+  static V max(V a, V b) { return wasm_f32x4_pmax(a, b); }
+  static M lt(V a, V b) { return wasm_f32x4_lt(a, b); }
+  static M both(M a, M b) { return wasm_v128_and(a, b); }
+  static M invert(M a) { return wasm_v128_not(a); }
+  static V select(V f, V t, M cond) { return wasm_v128_bitselect(t, f, cond); }
+};
+#endif
+
+// yadif.common.wgslのyadif()と同じ計算
+template <class L> struct Yadif {
+  using V = typename L::V;
+  using M = typename L::M;
+
+  static V avg(V a, V b) { return L::mul(L::add(a, b), L::splat(0.5f)); }
+  static V absd(V a, V b) { return L::sub(L::max(a, b), L::min(a, b)); }
+  static V max3(V a, V b, V c) { return L::max(L::max(a, b), c); }
+  static V min3(V a, V b, V c) { return L::min(L::min(a, b), c); }
+
+  static V load(const Plane &p, int x, int y) {
+    y = std::clamp(y, 0, p.height - 1);
+    return L::load(p.data + static_cast<size_t>(y) * p.width, x, p.width);
+  }
+
+  // 上の行をk、下の行を-kずらした3画素の差の和
+  static V score(const Plane &cur, int x, int y, int k) {
+    V sum = absd(load(cur, x - 1 + k, y - 1), load(cur, x - 1 - k, y + 1));
+    sum = L::add(sum, absd(load(cur, x + k, y - 1), load(cur, x - k, y + 1)));
+    return L::add(sum, absd(load(cur, x + 1 + k, y - 1),
+                            load(cur, x + 1 - k, y + 1)));
+  }
+
+  static V spatialPred(const Plane &cur, int x, int y, int k) {
+    return avg(load(cur, x + k, y - 1), load(cur, x - k, y + 1));
+  }
+
+  static V apply(const Plane &cur, const Plane &prev, const Plane &next, int x,
+                 int y) {
+    if (y % 2 == 0) {
+      return load(cur, x, y);
+    }
+    V c = load(cur, x, y - 1);
+    V d = avg(load(cur, x, y), load(next, x, y));
+    V e = load(cur, x, y + 1);
+    V tmp_diff0 =
+        L::div(absd(load(cur, x, y), load(next, x, y)), L::splat(2.0f));
+    V tmp_diff1 =
+        avg(absd(load(prev, x, y - 1), c), absd(load(prev, x, y + 1), e));
+    V tmp_diff2 =
+        avg(absd(load(next, x, y - 1), c), absd(load(next, x, y + 1), e));
+    V diff = max3(tmp_diff0, tmp_diff1, tmp_diff2);
+
+    V b = avg(load(cur, x, y - 2), load(next, x, y - 2));
+    V f = avg(load(cur, x, y + 2), load(next, x, y + 2));
+    V max_ = max3(L::sub(d, e), L::sub(d, c),
+                  L::min(L::sub(b, c), L::sub(f, e)));
+    V min_ = min3(L::sub(d, e), L::sub(d, c),
+                  L::max(L::sub(b, c), L::sub(f, e)));
+    diff = max3(diff, min_, L::neg(max_));
+
+    V score_0 = L::sub(score(cur, x, y, 0), L::splat(ONE_255));
+    V score_1 = score(cur, x, y, -1);
+    V score_2 = score(cur, x, y, 1);
+    V score_11 = score(cur, x, y, -2);
+    V score_21 = score(cur, x, y, 2);
+
+    M use_1 = L::both(L::lt(score_1, score_0), L::lt(score_1, score_2));
+    M use_2 = L::both(L::both(L::invert(use_1), L::lt(score_2, score_0)),
+                      L::lt(score_2, score_1));
+    V pred = avg(c, e);
+    pred = L::select(pred,
+                     L::select(spatialPred(cur, x, y, 1),
+                               spatialPred(cur, x, y, 2),
+                               L::lt(score_21, score_2)),
+                     use_2);
+    pred = L::select(pred,
+                     L::select(spatialPred(cur, x, y, -1),
+                               spatialPred(cur, x, y, -2),
+                               L::lt(score_11, score_1)),
+                     use_1);
+    return L::min(L::max(pred, L::sub(d, diff)), L::add(d, diff));
+  }
+
+  static void row(const Plane &cur, const Plane &prev, const Plane &next,
+                  int y, int &x, float *out) {
+    for (; x + L::N <= cur.width; x += L::N) {
+      L::store(out + x, apply(cur, prev, next, x, y));
+    }
+  }
+
+  // インターレース解除しない場合(convert.frag.wgsl)
+  static void copyRow(const Plane &cur, int y, int &x, float *out) {
+    for (; x + L::N <= cur.width; x += L::N) {
+      L::store(out + x, load(cur, x, y));
+    }
+  }
+};
+
+// yadif.frag.wgslのmain()・yuv2rgba()と同じ計算
+template <class L> struct Convert {
+  using V = typename L::V;
+
+  static V clamp01(V v) {
+    return L::min(L::max(v, L::splat(0.0f)), L::splat(1.0f));
+  }
+
+  static void row(const float *luma, const float *u, const float *v,
+                  int width, int &x, uint8_t *out) {
+    for (; x + L::N <= width; x += L::N) {
+      V y = L::div(
+          L::mul(L::sub(L::loadFloat(luma + x), L::splat(LUMA_OFFSET)),
+                 L::splat(255.0f)),
+          L::splat(235.0f - 16.0f));
+      V cb = L::div(
+          L::mul(L::sub(L::loadChroma(u, x), L::splat(CHROMA_OFFSET)),
+                 L::splat(128.0f)),
+          L::splat(128.0f - 16.0f));
+      V cr = L::div(
+          L::mul(L::sub(L::loadChroma(v, x), L::splat(CHROMA_OFFSET)),
+                 L::splat(128.0f)),
+          L::splat(128.0f - 16.0f));
+      V r = clamp01(L::add(y, L::mul(L::splat(1.5748f), cr)));
+      V g = clamp01(L::sub(L::sub(y, L::mul(L::splat(0.1873f), cb)),
+                           L::mul(L::splat(0.4681f), cr)));
+      V b = clamp01(L::add(y, L::mul(L::splat(1.8556f), cb)));
+      L::storeRgba(out + static_cast<size_t>(x) * 4, r, g, b);
+    }
+  }
+};
+
+static void yadifRow(const Plane &cur, const Plane &prev, const Plane &next,
+                     int y, bool deinterlace, float *out) {
+  int x = 0;
+  if (!deinterlace) {
+#ifdef __wasm_simd128__
+    Yadif<SimdLanes>::copyRow(cur, y, x, out);
+#endif
+    Yadif<ScalarLanes>::copyRow(cur, y, x, out);
+    return;
+  }
+#ifdef __wasm_simd128__
+  Yadif<SimdLanes>::row(cur, prev, next, y, x, out);
+#endif
+  Yadif<ScalarLanes>::row(cur, prev, next, y, x, out);
+}
+
+static void convertRow(const float *luma, const float *u, const float *v,
+                       int width, uint8_t *out) {
+  int x = 0;
+#ifdef __wasm_simd128__
+  Convert<SimdLanes>::row(luma, u, v, width, x, out);
+#endif
+  Convert<ScalarLanes>::row(luma, u, v, width, x, out);
+}
+
+static void workerFunc(int index) {
+  uint64_t seen = 0;
+  while (true) {
+    std::function<void(int, int)> job;
+    int rows;
+    {
+      std::unique_lock<std::mutex> lock(sw.mtx);
+      sw.startCv.wait(lock, [&] { return sw.generation != seen; });
+      seen = sw.generation;
+      job = sw.job;
+      rows = sw.jobRows;
+    }
+    int chunks = sw.workerCount + 1;
+    job(rows * index / chunks, rows * (index + 1) / chunks);
+    {
+      std::lock_guard<std::mutex> lock(sw.mtx);
+      sw.pending--;
+    }
+    sw.doneCv.notify_one();
+  }
+}
+
+// rows行を呼び出し元のスレッドとワーカーで分けて処理する
+static void runRows(int rows, const std::function<void(int, int)> &job) {
+  if (sw.workerCount == 0) {
+    job(0, rows);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sw.mtx);
+    sw.job = job;
+    sw.jobRows = rows;
+    sw.pending = sw.workerCount;
+    sw.generation++;
+  }
+  sw.startCv.notify_all();
+  int chunks = sw.workerCount + 1;
+  job(0, rows / chunks);
+  std::unique_lock<std::mutex> lock(sw.mtx);
+  sw.doneCv.wait(lock, [] { return sw.pending == 0; });
+}
+
+// フレームをNEXTのスロットに詰めてコピーする。NV12のUVはU/Vに分ける
+static void copyToNextSlot(AVFrame *frame) {
+  int width = frame->width;
+  int height = frame->height;
+  int chromaWidth = width / 2;
+  int chromaHeight = height / 2;
+  PlanarFrame &next = sw.slots[SW_NEXT];
+  next.planes[0].resize(static_cast<size_t>(width) * height);
+  next.planes[1].resize(static_cast<size_t>(chromaWidth) * chromaHeight);
+  next.planes[2].resize(static_cast<size_t>(chromaWidth) * chromaHeight);
+
+  for (int y = 0; y < height; y++) {
+    std::copy_n(frame->data[0] + static_cast<size_t>(y) * frame->linesize[0],
+                width, next.planes[0].data() + static_cast<size_t>(y) * width);
+  }
+  for (int y = 0; y < chromaHeight; y++) {
+    size_t dst = static_cast<size_t>(y) * chromaWidth;
+    if (frame->format == AV_PIX_FMT_NV12) {
+      const uint8_t *uv =
+          frame->data[1] + static_cast<size_t>(y) * frame->linesize[1];
+      for (int x = 0; x < chromaWidth; x++) {
+        next.planes[1][dst + x] = uv[2 * x];
+        next.planes[2][dst + x] = uv[2 * x + 1];
+      }
+    } else {
+      for (int i = 1; i < 3; i++) {
+        const uint8_t *src =
+            frame->data[i] + static_cast<size_t>(y) * frame->linesize[i];
+        std::copy_n(src, chromaWidth, next.planes[i].data() + dst);
+      }
+    }
+  }
+}
+
+static bool isSupportedFormat(int format) {
+  return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_NV12;
+}
+
+bool renderSoftware(AVFrame *frame, std::vector<uint8_t> &rgba) {
+  if (!isSupportedFormat(frame->format)) {
+    return false;
+  }
+  if (frame->width != sw.width || frame->height != sw.height) {
+    sw.width = frame->width;
+    sw.height = frame->height;
+    sw.history = 0;
+  }
+  copyToNextSlot(frame);
+  // 解像度切り替え直後はWebGPU側と同じく今回のフレームで埋める
+  if (sw.history == 0) {
+    sw.slots[SW_PREV] = sw.slots[SW_NEXT];
+    sw.slots[SW_CUR] = sw.slots[SW_NEXT];
+  }
+  sw.history++;
+
+  int width = sw.width;
+  int chromaWidth = width / 2;
+  int chromaHeight = sw.height / 2;
+  Plane planes[SW_SLOT_COUNT][3];
+  for (int slot = 0; slot < SW_SLOT_COUNT; slot++) {
+    for (int i = 0; i < 3; i++) {
+      planes[slot][i] = {sw.slots[slot].planes[i].data(),
+                         i == 0 ? width : chromaWidth,
+                         i == 0 ? sw.height : chromaHeight};
+    }
+  }
+  rgba.resize(static_cast<size_t>(width) * sw.height * 4);
+  // フレームの途中で切り替わらないように、ここで一度だけ読む
+  bool deinterlace = sw.deinterlace;
+
+  // 色差の1行ごとに、輝度2行分を処理する
+  runRows(chromaHeight, [&](int begin, int end) {
+    std::vector<float> luma0(width), luma1(width);
+    std::vector<float> u(chromaWidth + 1), v(chromaWidth + 1);
+    for (int row = begin; row < end; row++) {
+      yadifRow(planes[SW_CUR][1], planes[SW_PREV][1], planes[SW_NEXT][1], row,
+               deinterlace, u.data());
+      yadifRow(planes[SW_CUR][2], planes[SW_PREV][2], planes[SW_NEXT][2], row,
+               deinterlace, v.data());
+      // 幅が奇数の場合に最後の輝度が参照する分
+      u[chromaWidth] = chromaWidth > 0 ? u[chromaWidth - 1] : 0.0f;
+      v[chromaWidth] = chromaWidth > 0 ? v[chromaWidth - 1] : 0.0f;
+      yadifRow(planes[SW_CUR][0], planes[SW_PREV][0], planes[SW_NEXT][0],
+               2 * row, deinterlace, luma0.data());
+      yadifRow(planes[SW_CUR][0], planes[SW_PREV][0], planes[SW_NEXT][0],
+               2 * row + 1, deinterlace, luma1.data());
+      size_t rowBytes = static_cast<size_t>(width) * 4;
+      convertRow(luma0.data(), u.data(), v.data(), width,
+                 rgba.data() + rowBytes * (2 * row));
+      convertRow(luma1.data(), u.data(), v.data(), width,
+                 rgba.data() + rowBytes * (2 * row + 1));
+    }
+  });
+
+  // current => prev, next => current
+  std::swap(sw.slots[SW_PREV], sw.slots[SW_CUR]);
+  std::swap(sw.slots[SW_CUR], sw.slots[SW_NEXT]);
+  return sw.history >= SW_SLOT_COUNT;
+}
+
+// canvasの表示サイズ(CSS px) x devicePixelRatio に描画バッファを合わせる
+static void updateCanvasSize() {
+  double cssWidth, cssHeight;
+  if (emscripten_get_element_css_size("video", &cssWidth, &cssHeight) !=
+      EMSCRIPTEN_RESULT_SUCCESS) {
+    return;
+  }
+  double dpr = emscripten_get_device_pixel_ratio();
+  int width = std::max(1, static_cast<int>(std::lround(cssWidth * dpr)));
+  int height = std::max(1, static_cast<int>(std::lround(cssHeight * dpr)));
+  if (width == sw.canvasWidth && height == sw.canvasHeight) {
+    return;
+  }
+  emscripten_set_canvas_element_size("video", width, height);
+  sw.canvasWidth = width;
+  sw.canvasHeight = height;
+}
+
+static EM_BOOL onCanvasResize(int eventType, const EmscriptenUiEvent *uiEvent,
+                              void *userData) {
+  sw.canvasResized = true;
+  return EM_FALSE;
+}
+
+void drawSoftware(AVFrame *frame) {
+  if (!isSupportedFormat(frame->format)) {
+    TRACE("software renderer: unsupported format {}", frame->format);
+    return;
+  }
+  double renderStart = emscripten_get_now();
+  renderSoftware(frame, sw.rgba);
+  {
+    std::lock_guard<std::mutex> lock(sw.timingMtx);
+    sw.renderMs.push(emscripten_get_now() - renderStart);
+  }
+  if (sw.canvasResized) {
+    sw.canvasResized = false;
+    updateCanvasSize();
+  }
+
+  // 表示アスペクト比を保ったままcanvasに収まる矩形
+  double displayAspect = 16.0 / 9.0;
+  AVRational sar = frame->sample_aspect_ratio;
+  if (sar.num > 0 && sar.den > 0) {
+    displayAspect = av_q2d(sar) * frame->width / frame->height;
+  }
+  double viewportWidth = sw.canvasWidth;
+  double viewportHeight = sw.canvasHeight;
+  if (viewportWidth / viewportHeight > displayAspect) {
+    viewportWidth = std::round(viewportHeight * displayAspect);
+  } else {
+    viewportHeight = std::round(viewportWidth / displayAspect);
+  }
+  double viewportX = std::floor((sw.canvasWidth - viewportWidth) / 2);
+  double viewportY = std::floor((sw.canvasHeight - viewportHeight) / 2);
+
+  // 表示用のスレッドではtransferされたOffscreenCanvasに、
+  // メインスレッドではDOMのcanvasに描く
+  // clang-format off
+  EM_ASM({
+    let sw = Module['softwareCanvas'];
+    if (!sw) {
+      let target = null;
+      const offscreen = typeof GL !== 'undefined' && GL.offscreenCanvases;
+      if (offscreen && offscreen['video']) {
+        const entry = offscreen['video'];
+        target = entry.offscreenCanvas || entry;
+      } else if (typeof document !== 'undefined') {
+        target = document.getElementById('video');
+      }
+      if (!target) {
+        console.error('software renderer: canvas not found');
+        return;
+      }
+      const frame = typeof OffscreenCanvas !== 'undefined'
+          ? new OffscreenCanvas(1, 1) : document.createElement('canvas');
+      sw = Module['softwareCanvas'] = {
+        ctx: target.getContext('2d'),
+        frame: frame,
+        frameCtx: frame.getContext('2d'),
+        pixels: null,
+      };
+    }
+    const width = $1;
+    const height = $2;
+    if (sw.frame.width !== width || sw.frame.height !== height) {
+      sw.frame.width = width;
+      sw.frame.height = height;
+      sw.pixels = new ImageData(width, height);
+    }
+    // 共有メモリ上の配列はImageDataに直接渡せないのでコピーする
+    sw.pixels.data.set(HEAPU8.subarray($0, $0 + width * height * 4));
+    sw.frameCtx.putImageData(sw.pixels, 0, 0);
+    sw.ctx.fillStyle = 'black';
+    sw.ctx.fillRect(0, 0, sw.ctx.canvas.width, sw.ctx.canvas.height);
+    sw.ctx.imageSmoothingQuality = 'high';
+    sw.ctx.drawImage(sw.frame, $3, $4, $5, $6);
+  }, sw.rgba.data(), sw.width, sw.height, viewportX, viewportY, viewportWidth,
+     viewportHeight);
+  // clang-format on
+}
+
+double getSoftwareRenderMs() {
+  std::lock_guard<std::mutex> lock(sw.timingMtx);
+  return sw.renderMs.mean();
+}
+
+void setSoftwareDeinterlace(bool enabled) {
+  //
+  sw.deinterlace = enabled;
+}
+
+void initSoftwareRenderer() {
+  // ワーカーはメインスレッドのイベントループに戻ってから起動するので、
+  // 最初のフレームまでに立ち上がっていればよい
+  int cores = std::thread::hardware_concurrency();
+  sw.workerCount = std::clamp(cores - 1, 0, MAX_SOFTWARE_WORKERS);
+  for (int i = 0; i < sw.workerCount; i++) {
+    sw.workers.emplace_back(workerFunc, i + 1);
+  }
+  spdlog::info("software renderer: {} worker threads", sw.workerCount);
+
+  emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, nullptr,
+                                 EM_FALSE, onCanvasResize);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// WebGPUが使えない環境向けのCPUでの描画。
+// yadif.frag.wgslと同じ計算(同じ順序のf32演算)でRGBAを求めて2Dのcanvasに描く
+
+void initSoftwareRenderer();
+void drawSoftware(AVFrame *frame);
+// 1フレームのyadif・色変換にかかった時間(ms)の直近の平均
+double getSoftwareRenderMs();
+// 無効にするとyadifを通さず、そのまま色変換する
+void setSoftwareDeinterlace(bool enabled);
+
+// 描画せずにRGBAだけを求める(WebGPUの出力との比較用)。
+// 直前までの2フレームが揃っていない場合はfalseを返す
+bool renderSoftware(AVFrame *frame, std::vector<uint8_t> &rgba);
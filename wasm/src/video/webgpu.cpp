@@ -1,41 +1,156 @@
 // from https://github.com/cwoffenden/hello-webgpu/blob/main/src/main.cpp
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <emscripten/emscripten.h>
 #include <emscripten/html5.h>
 #include <emscripten/html5_webgpu.h>
 #include <fstream>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <spdlog/spdlog.h>
 #include <sstream>
+#include <tuple>
 #include <webgpu/webgpu_cpp.h>
 
+#include "../decoder/framepool.hpp"
+#include "../util/rollingwindow.hpp"
+#include "../util/startup.hpp"
+#include "captionoverlay.hpp"
+#include "rendergraph.hpp"
+#include "webgpu.hpp"
+
 extern "C" {
 #include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
 }
 
+enum ScaleFilter { BILINEAR = 0, BICUBIC = 1 };
+
+struct ScaleParams {
+  float outputWidth;
+  float outputHeight;
+  uint32_t filter;
+  uint32_t padding;
+};
+
+struct SharpenParams {
+  float strength;
+  float padding[3];
+};
+
+// yadif(色変換) begin/end, 拡大縮小 begin/end
+const uint32_t TIMESTAMP_COUNT = 4;
+const size_t TIMESTAMP_BUFFER_SIZE = TIMESTAMP_COUNT * sizeof(uint64_t);
+const int TIMESTAMP_READBACK_COUNT = 4;
+const size_t TIMING_WINDOW_SIZE = 120;
+
+struct TimestampReadback {
+  WGPUBuffer buffer;
+  bool pending = false;
+};
+
+// 解像度・ピクセルフォーマットの組み合わせごとに保持しておくテクスチャの最大数
+const size_t MAX_TEXTURE_POOL_SIZE = 4;
+
+struct FrameTexturesKey {
+  int width;
+  int height;
+  int format;
+
+  bool operator<(const FrameTexturesKey &other) const {
+    return std::tie(width, height, format) <
+           std::tie(other.width, other.height, other.format);
+  }
+  bool operator==(const FrameTexturesKey &other) const {
+    return std::tie(width, height, format) ==
+           std::tie(other.width, other.height, other.format);
+  }
+};
+
+// yadifは前後のフレームも参照するので、プレーンごとに3枚ずつ持つ
+enum FrameSlot { PREV = 0, CUR = 1, NEXT = 2, FRAME_SLOT_COUNT = 3 };
+const int MAX_PLANE_COUNT = 3;
+
+struct FrameTextures {
+  FrameTexturesKey key;
+  // YUV420P: Y/U/V, NV12: Y/UV(RG8)
+  int planeCount = 0;
+  WGPUTexture planeTextures[FRAME_SLOT_COUNT][MAX_PLANE_COUNT];
+  WGPUTextureView planeViews[FRAME_SLOT_COUNT][MAX_PLANE_COUNT];
+  WGPUExtent3D planeSizes[MAX_PLANE_COUNT];
+  // yadif/色変換パスの@group(0)。出力先はレンダーグラフが渡す
+  WGPUBindGroup yadifBindGroup;
+  WGPUBuffer stagingBuffer = nullptr;
+  uint64_t stagingBufferSize = 0;
+  // prev/curに直前のフレームが入っているか。
+  // 切り替えて戻ってきた場合は古いフレームが残っているのでfalseに戻す
+  bool primed = false;
+  uint64_t lastUsed = 0;
+};
+
 struct WebGPUContext {
-  int textureWidth = 0;
-  int textureHeight = 0;
+  int swapChainWidth = 0;
+  int swapChainHeight = 0;
+  bool canvasResized = true;
+  // UIのスレッドから設定され、描画時にuniformへ反映する
+  std::atomic<ScaleFilter> scaleFilter = ScaleFilter::BICUBIC;
+  ScaleParams scaleParams = {};
   WGPUDevice device;
-  WGPUSwapChain swapChain;
+  WGPUSurface surface;
+  WGPUSwapChain swapChain = nullptr;
   WGPUQueue queue;
-  WGPUComputePipeline yadifPipeline;
-  WGPURenderPipeline pipeline;
-  WGPUBindGroupLayout yadifBindGroupLayout, bindGroupLayout;
-  WGPUTexture curTextureY, curTextureU, curTextureV;
-  WGPUTextureView curViewY, curViewU, curViewV;
-  WGPUTexture prevTextureY, prevTextureU, prevTextureV;
-  WGPUTextureView prevViewY, prevViewU, prevViewV;
-  WGPUTexture nextTextureY, nextTextureU, nextTextureV;
-  WGPUTextureView nextViewY, nextViewU, nextViewV;
-  WGPUTexture frameTexture;
-  WGPUTextureView frameView;
-  WGPUBindGroup yadifBindGroup, bindGroup;
+  WGPUComputePipeline yadifPipeline = nullptr, yadifNv12Pipeline = nullptr;
+  WGPUComputePipeline convertPipeline = nullptr, convertNv12Pipeline = nullptr;
+  WGPUComputePipeline sharpenPipeline = nullptr;
+  WGPURenderPipeline pipeline = nullptr;
+  // 非同期に作成中のパイプラインの数。コールバックは作成を依頼した
+  // スレッドで呼ばれるので、描画スレッドからしか触らない
+  int pendingPipelines = 0;
+  WGPUBindGroupLayout yadifBindGroupLayout, yadifNv12BindGroupLayout;
+  // レンダーグラフの中間テクスチャを読む側・書く側
+  WGPUBindGroupLayout inputBindGroupLayout, outputBindGroupLayout;
+  WGPUBindGroupLayout scaleParamsBindGroupLayout, sharpenParamsBindGroupLayout;
+  std::map<FrameTexturesKey, FrameTextures> texturePool;
+  FrameTextures *currentTextures = nullptr;
+  uint64_t drawCount = 0;
   WGPUSampler sampler;
+  WGPUBuffer scaleParamsBuffer;
+  WGPUBindGroup scaleParamsBindGroup;
+  WGPUBuffer sharpenParamsBuffer;
+  WGPUBindGroup sharpenParamsBindGroup;
+  // UIのスレッドから設定され、描画時にuniformへ反映する
+  std::atomic<float> sharpenStrength = 0.0f;
+  float sharpenParamsStrength = -1.0f;
+  std::atomic<bool> deinterlace = true;
+  // レンダーグラフに登録したパス。有効・無効はsyncRenderPassesで
+  // 描画スレッドから切り替える
+  int deinterlacePass = -1, convertPass = -1, sharpenPass = -1,
+      scalePass = -1, captionPass = -1;
+  // 描画中のフレームの表示先とタイムスタンプの書き込み先
+  float viewportX, viewportY, viewportWidth, viewportHeight;
+  TimestampReadback *frameTimestamps = nullptr;
+  // 次に描画するフレームの変換結果を読み出す要求
+  std::atomic<FrameReadbackCallback> frameReadbackCallback = nullptr;
+  bool timestampSupported = false;
+  WGPUQuerySet timestampQuerySet;
+  WGPUBuffer timestampResolveBuffer;
+  TimestampReadback timestampReadbacks[TIMESTAMP_READBACK_COUNT];
+  // 描画スレッドで書き込み、統計のためにメインスレッドから読まれる
+  std::mutex timingMtx;
+  RollingWindow<TIMING_WINDOW_SIZE> uploadMs, yadifMs, renderMs, presentMs;
 };
 
 static WebGPUContext ctx;
 
+static void pushTiming(RollingWindow<TIMING_WINDOW_SIZE> &window, double ms) {
+  std::lock_guard<std::mutex> lock(ctx.timingMtx);
+  window.push(ms);
+}
+
 /**
  * Helper to create a shader from WGSL source.
  *
@@ -53,143 +168,212 @@ static WGPUShaderModule createShader(const char *const code,
   return wgpuDeviceCreateShaderModule(ctx.device, &desc);
 }
 
-static void releaseTextures() {
-  wgpuTextureViewRelease(ctx.curViewY);
-  wgpuTextureViewRelease(ctx.curViewU);
-  wgpuTextureViewRelease(ctx.curViewV);
-  wgpuTextureRelease(ctx.curTextureY);
-  wgpuTextureRelease(ctx.curTextureU);
-  wgpuTextureRelease(ctx.curTextureV);
-
-  wgpuTextureViewRelease(ctx.prevViewY);
-  wgpuTextureViewRelease(ctx.prevViewU);
-  wgpuTextureViewRelease(ctx.prevViewV);
-  wgpuTextureRelease(ctx.prevTextureY);
-  wgpuTextureRelease(ctx.prevTextureU);
-  wgpuTextureRelease(ctx.prevTextureV);
+static void releaseTextures(FrameTextures &tex) {
+  wgpuBindGroupRelease(tex.yadifBindGroup);
 
-  wgpuTextureViewRelease(ctx.nextViewY);
-  wgpuTextureViewRelease(ctx.nextViewU);
-  wgpuTextureViewRelease(ctx.nextViewV);
-  wgpuTextureRelease(ctx.nextTextureY);
-  wgpuTextureRelease(ctx.nextTextureU);
-  wgpuTextureRelease(ctx.nextTextureV);
+  for (int slot = 0; slot < FRAME_SLOT_COUNT; slot++) {
+    for (int plane = 0; plane < tex.planeCount; plane++) {
+      wgpuTextureViewRelease(tex.planeViews[slot][plane]);
+      wgpuTextureRelease(tex.planeTextures[slot][plane]);
+    }
+  }
 
-  wgpuTextureViewRelease(ctx.frameView);
-  wgpuTextureRelease(ctx.frameTexture);
+  if (tex.stagingBuffer) {
+    wgpuBufferRelease(tex.stagingBuffer);
+  }
 }
 
-static void createTextures(int width, int height) {
-  std::vector<uint8_t> tmpBuffer(width * height);
-
-  WGPUExtent3D size = {};
-  size.width = width;
-  size.height = height;
-  size.depthOrArrayLayers = 1;
-
-  WGPUExtent3D uvSize = {};
-  uvSize.width = width / 2;
-  uvSize.height = height / 2;
-  uvSize.depthOrArrayLayers = 1;
+static void createTextures(FrameTextures &tex) {
+  int width = tex.key.width;
+  int height = tex.key.height;
+  bool nv12 = tex.key.format == AV_PIX_FMT_NV12;
+
+  WGPUTextureFormat planeFormats[MAX_PLANE_COUNT] = {
+      WGPUTextureFormat_R8Unorm, WGPUTextureFormat_R8Unorm,
+      WGPUTextureFormat_R8Unorm};
+  tex.planeCount = 3;
+  if (nv12) {
+    planeFormats[1] = WGPUTextureFormat_RG8Unorm;
+    tex.planeCount = 2;
+  }
+  for (int plane = 0; plane < tex.planeCount; plane++) {
+    tex.planeSizes[plane].width = plane == 0 ? width : width / 2;
+    tex.planeSizes[plane].height = plane == 0 ? height : height / 2;
+    tex.planeSizes[plane].depthOrArrayLayers = 1;
+  }
 
   WGPUTextureDescriptor textureDesc = {};
   textureDesc.dimension = WGPUTextureDimension_2D;
-  textureDesc.format = WGPUTextureFormat_R8Unorm;
   textureDesc.usage = WGPUTextureUsage_CopySrc | WGPUTextureUsage_CopyDst |
                       WGPUTextureUsage_TextureBinding;
   textureDesc.sampleCount = 1;
   textureDesc.mipLevelCount = 1;
 
-  textureDesc.size = size;
-  ctx.curTextureY = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.prevTextureY = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.nextTextureY = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-
-  textureDesc.size = uvSize;
-  ctx.curTextureU = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.curTextureV = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.prevTextureU = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.prevTextureV = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.nextTextureU = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-  ctx.nextTextureV = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-
-  textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
-  textureDesc.usage = WGPUTextureUsage_CopyDst |
-                      WGPUTextureUsage_TextureBinding |
-                      WGPUTextureUsage_StorageBinding;
-  textureDesc.size = size;
-  ctx.frameTexture = wgpuDeviceCreateTexture(ctx.device, &textureDesc);
-
-  WGPUSamplerDescriptor samplerDesc = {};
-  samplerDesc.magFilter = WGPUFilterMode_Linear;
-  samplerDesc.minFilter = WGPUFilterMode_Linear;
-  samplerDesc.addressModeU = WGPUAddressMode_ClampToEdge;
-  samplerDesc.addressModeV = WGPUAddressMode_ClampToEdge;
-
-  ctx.sampler = wgpuDeviceCreateSampler(ctx.device, &samplerDesc);
-
   WGPUTextureViewDescriptor viewDesc = {};
   viewDesc.dimension = WGPUTextureViewDimension_2D;
-  viewDesc.format = WGPUTextureFormat_R8Unorm;
   viewDesc.arrayLayerCount = 1;
   viewDesc.mipLevelCount = 1;
   viewDesc.aspect = WGPUTextureAspect_All;
 
-  ctx.curViewY = wgpuTextureCreateView(ctx.curTextureY, &viewDesc);
-  ctx.curViewU = wgpuTextureCreateView(ctx.curTextureU, &viewDesc);
-  ctx.curViewV = wgpuTextureCreateView(ctx.curTextureV, &viewDesc);
-  ctx.prevViewY = wgpuTextureCreateView(ctx.prevTextureY, &viewDesc);
-  ctx.prevViewU = wgpuTextureCreateView(ctx.prevTextureU, &viewDesc);
-  ctx.prevViewV = wgpuTextureCreateView(ctx.prevTextureV, &viewDesc);
-  ctx.nextViewY = wgpuTextureCreateView(ctx.nextTextureY, &viewDesc);
-  ctx.nextViewU = wgpuTextureCreateView(ctx.nextTextureU, &viewDesc);
-  ctx.nextViewV = wgpuTextureCreateView(ctx.nextTextureV, &viewDesc);
-
-  viewDesc.format = WGPUTextureFormat_RGBA8Unorm;
-  ctx.frameView = wgpuTextureCreateView(ctx.frameTexture, &viewDesc);
+  for (int slot = 0; slot < FRAME_SLOT_COUNT; slot++) {
+    for (int plane = 0; plane < tex.planeCount; plane++) {
+      textureDesc.format = planeFormats[plane];
+      textureDesc.size = tex.planeSizes[plane];
+      tex.planeTextures[slot][plane] =
+          wgpuDeviceCreateTexture(ctx.device, &textureDesc);
+      viewDesc.format = planeFormats[plane];
+      tex.planeViews[slot][plane] =
+          wgpuTextureCreateView(tex.planeTextures[slot][plane], &viewDesc);
+    }
+  }
 
-  WGPUBindGroupEntry bgEntries[] = {
+  // binding: 0 sampler, 2以降 cur/prev/nextの順に各プレーン。
+  // 出力(以前のbinding 1)はレンダーグラフの中間テクスチャで、@group(1)で渡す
+  WGPUBindGroupEntry bgEntries[1 + FRAME_SLOT_COUNT * MAX_PLANE_COUNT] = {
       {.binding = 0, .sampler = ctx.sampler},
-      {.binding = 1, .textureView = ctx.frameView},
-      {.binding = 2, .textureView = ctx.curViewY},
-      {.binding = 3, .textureView = ctx.curViewU},
-      {.binding = 4, .textureView = ctx.curViewV},
-      {.binding = 5, .textureView = ctx.prevViewY},
-      {.binding = 6, .textureView = ctx.prevViewU},
-      {.binding = 7, .textureView = ctx.prevViewV},
-      {.binding = 8, .textureView = ctx.nextViewY},
-      {.binding = 9, .textureView = ctx.nextViewU},
-      {.binding = 10, .textureView = ctx.nextViewV},
   };
+  const FrameSlot slotOrder[] = {CUR, PREV, NEXT};
+  uint32_t entryCount = 1;
+  for (FrameSlot slot : slotOrder) {
+    for (int plane = 0; plane < tex.planeCount; plane++) {
+      bgEntries[entryCount].binding = entryCount + 1;
+      bgEntries[entryCount].textureView = tex.planeViews[slot][plane];
+      entryCount++;
+    }
+  }
   WGPUBindGroupDescriptor bgDesc = {};
-  bgDesc.layout = ctx.yadifBindGroupLayout;
-  bgDesc.entryCount = sizeof(bgEntries) / sizeof(bgEntries[0]);
+  bgDesc.layout =
+      nv12 ? ctx.yadifNv12BindGroupLayout : ctx.yadifBindGroupLayout;
+  bgDesc.entryCount = entryCount;
   bgDesc.entries = bgEntries;
 
-  ctx.yadifBindGroup = wgpuDeviceCreateBindGroup(ctx.device, &bgDesc);
+  tex.yadifBindGroup = wgpuDeviceCreateBindGroup(ctx.device, &bgDesc);
+}
 
-  bgDesc.entryCount = 2;
-  bgDesc.layout = ctx.bindGroupLayout;
-  ctx.bindGroup = wgpuDeviceCreateBindGroup(ctx.device, &bgDesc);
+// 一番長く使われていないものから捨てる。表示中のものと、keepは捨てない
+static void evictTextures(const FrameTexturesKey &keep) {
+  while (ctx.texturePool.size() > MAX_TEXTURE_POOL_SIZE) {
+    auto oldest = ctx.texturePool.end();
+    for (auto it = ctx.texturePool.begin(); it != ctx.texturePool.end();
+         ++it) {
+      if (it->first == keep || &it->second == ctx.currentTextures) {
+        continue;
+      }
+      if (oldest == ctx.texturePool.end() ||
+          it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    if (oldest == ctx.texturePool.end()) {
+      return;
+    }
+    spdlog::info("release textures: {}x{} format:{}", oldest->first.width,
+                 oldest->first.height, oldest->first.format);
+    releaseTextures(oldest->second);
+    ctx.texturePool.erase(oldest);
+  }
+}
 
-  ctx.textureWidth = width;
-  ctx.textureHeight = height;
+static FrameTextures &getTextures(int width, int height, int format) {
+  FrameTexturesKey key = {width, height, format};
+  auto it = ctx.texturePool.find(key);
+  if (it != ctx.texturePool.end()) {
+    return it->second;
+  }
+  spdlog::info("create textures: {}x{} format:{}", width, height, format);
+  FrameTextures &tex = ctx.texturePool[key];
+  tex.key = key;
+  tex.lastUsed = ctx.drawCount;
+  createTextures(tex);
+  evictTextures(key);
+  return tex;
 }
 
+// UIのスレッドで設定された値をパスの有効・無効に反映する。
+// パスの登録と同じ描画スレッドから呼ぶので、初期化中の変更も取りこぼさない
+static void syncRenderPasses() {
+  bool deinterlace = ctx.deinterlace;
+  setRenderGraphPassEnabled(ctx.deinterlacePass, deinterlace);
+  setRenderGraphPassEnabled(ctx.convertPass, !deinterlace);
+  setRenderGraphPassEnabled(ctx.sharpenPass, ctx.sharpenStrength > 0.0f);
+}
+
+void prepareWebGpuTextures(int width, int height, int format) {
+  if (!ctx.device || width <= 0 || height <= 0) {
+    return;
+  }
+  getTextures(width, height, format);
+  syncRenderPasses();
+  prepareRenderGraph(width, height);
+}
+
+static void onPipelineCreated() {
+  if (--ctx.pendingPipelines == 0) {
+    markStartup("pipelines-ready");
+  }
+}
+
+static void onRenderPipelineCreated(WGPUCreatePipelineAsyncStatus status,
+                                    WGPURenderPipeline pipeline,
+                                    const char *message, void *userdata) {
+  if (status != WGPUCreatePipelineAsyncStatus_Success) {
+    spdlog::error("failed to create render pipeline: {}",
+                  message ? message : "");
+  }
+  *static_cast<WGPURenderPipeline *>(userdata) = pipeline;
+  onPipelineCreated();
+}
+
+static void onComputePipelineCreated(WGPUCreatePipelineAsyncStatus status,
+                                     WGPUComputePipeline pipeline,
+                                     const char *message, void *userdata) {
+  if (status != WGPUCreatePipelineAsyncStatus_Success) {
+    spdlog::error("failed to create compute pipeline: {}",
+                  message ? message : "");
+  }
+  *static_cast<WGPUComputePipeline *>(userdata) = pipeline;
+  onPipelineCreated();
+}
+
+// シェーダのコンパイルは時間がかかるので、パイプラインは非同期に作る。
+// 完了までの間にデコーダの初期化や最初のフレームのデコードが進み、
+// 描画はisWebGpuReady()がtrueになってから始める
 static void createPipeline() {
+  markStartup("pipelines-requested");
   std::string vertWgsl =
 #include "shaders/simple.vert.wgsl"
       ;
   std::string fragWgsl =
 #include "shaders/simple.frag.wgsl"
       ;
+  // 共通部分とエントリポイント(バインディング)を連結してモジュールにする
   std::string yadifWgsl =
+#include "shaders/yadif.common.wgsl"
 #include "shaders/yadif.frag.wgsl"
       ;
+  std::string yadifNv12Wgsl =
+#include "shaders/yadif.common.wgsl"
+#include "shaders/yadif_nv12.frag.wgsl"
+      ;
+  std::string convertWgsl =
+#include "shaders/yadif.common.wgsl"
+#include "shaders/convert.frag.wgsl"
+      ;
+  std::string convertNv12Wgsl =
+#include "shaders/yadif.common.wgsl"
+#include "shaders/convert_nv12.frag.wgsl"
+      ;
+  std::string sharpenWgsl =
+#include "shaders/sharpen.frag.wgsl"
+      ;
 
   WGPUShaderModule vertMod = createShader(vertWgsl.c_str());
   WGPUShaderModule fragMod = createShader(fragWgsl.c_str());
   WGPUShaderModule yadifMod = createShader(yadifWgsl.c_str());
+  WGPUShaderModule yadifNv12Mod = createShader(yadifNv12Wgsl.c_str());
+  WGPUShaderModule convertMod = createShader(convertWgsl.c_str());
+  WGPUShaderModule convertNv12Mod = createShader(convertNv12Wgsl.c_str());
+  WGPUShaderModule sharpenMod = createShader(sharpenWgsl.c_str());
 
   WGPUSamplerBindingLayout samplerLayout = {};
   samplerLayout.type = WGPUSamplerBindingType_Filtering;
@@ -204,13 +388,11 @@ static void createPipeline() {
   storageTextureLayout.access = WGPUStorageTextureAccess_WriteOnly;
   storageTextureLayout.viewDimension = WGPUTextureViewDimension_2D;
 
+  // yadif/色変換パスの入力(フレームのプレーン)
   WGPUBindGroupLayoutEntry bglEntries[] = {
       {.binding = 0,
-       .visibility = WGPUShaderStage_Fragment | WGPUShaderStage_Compute,
-       .sampler = samplerLayout},
-      {.binding = 1,
        .visibility = WGPUShaderStage_Compute,
-       .storageTexture = storageTextureLayout},
+       .sampler = samplerLayout},
       {.binding = 2,
        .visibility = WGPUShaderStage_Compute,
        .texture = textureLayout},
@@ -246,22 +428,78 @@ static void createPipeline() {
   ctx.yadifBindGroupLayout =
       wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
 
-  bglEntries[1] = {
-      .binding = 1,
+  // NV12はcur/prev/nextそれぞれY,UVの2枚なのでbinding 7まで
+  bglDesc.entryCount = 1 + FRAME_SLOT_COUNT * 2;
+  ctx.yadifNv12BindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
+
+  // レンダーグラフの中間テクスチャを読む側(@group(0))と書く側(@group(1))
+  WGPUBindGroupLayoutEntry inputBglEntries[] = {
+      {.binding = 0,
+       .visibility = WGPUShaderStage_Fragment | WGPUShaderStage_Compute,
+       .sampler = samplerLayout},
+      {.binding = 1,
+       .visibility = WGPUShaderStage_Fragment | WGPUShaderStage_Compute,
+       .texture = textureLayout},
+  };
+  bglDesc.entryCount = sizeof(inputBglEntries) / sizeof(inputBglEntries[0]);
+  bglDesc.entries = inputBglEntries;
+  ctx.inputBindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
+
+  WGPUBindGroupLayoutEntry outputBglEntry = {
+      .binding = 0,
+      .visibility = WGPUShaderStage_Compute,
+      .storageTexture = storageTextureLayout,
+  };
+  bglDesc.entryCount = 1;
+  bglDesc.entries = &outputBglEntry;
+  ctx.outputBindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
+
+  WGPUBufferBindingLayout uniformLayout = {};
+  uniformLayout.type = WGPUBufferBindingType_Uniform;
+  uniformLayout.minBindingSize = sizeof(ScaleParams);
+
+  WGPUBindGroupLayoutEntry paramsBglEntry = {
+      .binding = 0,
       .visibility = WGPUShaderStage_Fragment,
-      .texture = textureLayout,
+      .buffer = uniformLayout,
   };
+  bglDesc.entries = &paramsBglEntry;
+  ctx.scaleParamsBindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
 
-  bglDesc.entryCount = 2;
-  ctx.bindGroupLayout = wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
+  paramsBglEntry.visibility = WGPUShaderStage_Compute;
+  paramsBglEntry.buffer.minBindingSize = sizeof(SharpenParams);
+  ctx.sharpenParamsBindGroupLayout =
+      wgpuDeviceCreateBindGroupLayout(ctx.device, &bglDesc);
 
+  // yadifと色変換は同じレイアウト(入力のプレーン + 出力)
+  WGPUBindGroupLayout yadifLayouts[] = {ctx.yadifBindGroupLayout,
+                                        ctx.outputBindGroupLayout};
   WGPUPipelineLayoutDescriptor layoutDesc = {};
-  layoutDesc.bindGroupLayoutCount = 1;
-  layoutDesc.bindGroupLayouts = &ctx.yadifBindGroupLayout;
+  layoutDesc.bindGroupLayoutCount = 2;
+  layoutDesc.bindGroupLayouts = yadifLayouts;
   WGPUPipelineLayout yadifPipelineLayout =
       wgpuDeviceCreatePipelineLayout(ctx.device, &layoutDesc);
 
-  layoutDesc.bindGroupLayouts = &ctx.bindGroupLayout;
+  yadifLayouts[0] = ctx.yadifNv12BindGroupLayout;
+  WGPUPipelineLayout yadifNv12PipelineLayout =
+      wgpuDeviceCreatePipelineLayout(ctx.device, &layoutDesc);
+
+  WGPUBindGroupLayout sharpenLayouts[] = {ctx.inputBindGroupLayout,
+                                          ctx.outputBindGroupLayout,
+                                          ctx.sharpenParamsBindGroupLayout};
+  layoutDesc.bindGroupLayoutCount = 3;
+  layoutDesc.bindGroupLayouts = sharpenLayouts;
+  WGPUPipelineLayout sharpenPipelineLayout =
+      wgpuDeviceCreatePipelineLayout(ctx.device, &layoutDesc);
+
+  WGPUBindGroupLayout renderLayouts[] = {ctx.inputBindGroupLayout,
+                                         ctx.scaleParamsBindGroupLayout};
+  layoutDesc.bindGroupLayoutCount = 2;
+  layoutDesc.bindGroupLayouts = renderLayouts;
   WGPUPipelineLayout pipelineLayout =
       wgpuDeviceCreatePipelineLayout(ctx.device, &layoutDesc);
 
@@ -302,7 +540,9 @@ static void createPipeline() {
   desc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
   desc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
 
-  ctx.pipeline = wgpuDeviceCreateRenderPipeline(ctx.device, &desc);
+  ctx.pendingPipelines = 6;
+  wgpuDeviceCreateRenderPipelineAsync(ctx.device, &desc,
+                                      onRenderPipelineCreated, &ctx.pipeline);
 
   WGPUProgrammableStageDescriptor compStageDesc = {
       .module = yadifMod,
@@ -310,63 +550,341 @@ static void createPipeline() {
   };
   WGPUComputePipelineDescriptor compDesc = {.layout = yadifPipelineLayout,
                                             .compute = compStageDesc};
-
-  ctx.yadifPipeline = wgpuDeviceCreateComputePipeline(ctx.device, &compDesc);
-
-  // partial clean-up (just move to the end, no?)
+  wgpuDeviceCreateComputePipelineAsync(
+      ctx.device, &compDesc, onComputePipelineCreated, &ctx.yadifPipeline);
+
+  compDesc.compute.module = convertMod;
+  wgpuDeviceCreateComputePipelineAsync(
+      ctx.device, &compDesc, onComputePipelineCreated, &ctx.convertPipeline);
+
+  compDesc.layout = yadifNv12PipelineLayout;
+  compDesc.compute.module = yadifNv12Mod;
+  wgpuDeviceCreateComputePipelineAsync(ctx.device, &compDesc,
+                                       onComputePipelineCreated,
+                                       &ctx.yadifNv12Pipeline);
+
+  compDesc.compute.module = convertNv12Mod;
+  wgpuDeviceCreateComputePipelineAsync(ctx.device, &compDesc,
+                                       onComputePipelineCreated,
+                                       &ctx.convertNv12Pipeline);
+
+  compDesc.layout = sharpenPipelineLayout;
+  compDesc.compute.module = sharpenMod;
+  wgpuDeviceCreateComputePipelineAsync(
+      ctx.device, &compDesc, onComputePipelineCreated, &ctx.sharpenPipeline);
+
+  // 作成中のパイプラインが参照を持つので、ここで解放してよい
   wgpuPipelineLayoutRelease(yadifPipelineLayout);
+  wgpuPipelineLayoutRelease(yadifNv12PipelineLayout);
+  wgpuPipelineLayoutRelease(sharpenPipelineLayout);
   wgpuPipelineLayoutRelease(pipelineLayout);
 
   wgpuShaderModuleRelease(fragMod);
   wgpuShaderModuleRelease(vertMod);
+  wgpuShaderModuleRelease(yadifMod);
+  wgpuShaderModuleRelease(yadifNv12Mod);
+  wgpuShaderModuleRelease(convertMod);
+  wgpuShaderModuleRelease(convertNv12Mod);
+  wgpuShaderModuleRelease(sharpenMod);
 }
 
-void initWebGpu() {
-  ctx.device = emscripten_webgpu_get_device();
+static void configureSwapChain(int width, int height) {
+  if (ctx.swapChain) {
+    wgpuSwapChainRelease(ctx.swapChain);
+  }
 
-  ctx.queue = wgpuDeviceGetQueue(ctx.device);
+  WGPUSwapChainDescriptor swapDesc = {};
+  swapDesc.usage = WGPUTextureUsage_RenderAttachment;
+  swapDesc.format = WGPUTextureFormat_BGRA8Unorm;
+  swapDesc.width = width;
+  swapDesc.height = height;
+  swapDesc.presentMode = WGPUPresentMode_Fifo;
 
-  // pipeline/buffer
-  createPipeline();
+  ctx.swapChain = wgpuDeviceCreateSwapChain(ctx.device, ctx.surface, &swapDesc);
+  ctx.swapChainWidth = width;
+  ctx.swapChainHeight = height;
+  spdlog::info("swapchain configured: {}x{}", width, height);
+}
 
-  // create swapchain?
-  WGPUSurfaceDescriptorFromCanvasHTMLSelector canvasDesc = {};
-  canvasDesc.chain.sType = WGPUSType_SurfaceDescriptorFromCanvasHTMLSelector;
-  canvasDesc.selector = "video";
+// canvasの表示サイズ(CSS px) x devicePixelRatio に描画バッファを合わせる
+static void updateCanvasSize() {
+  double cssWidth, cssHeight;
+  if (emscripten_get_element_css_size("video", &cssWidth, &cssHeight) !=
+      EMSCRIPTEN_RESULT_SUCCESS) {
+    return;
+  }
+  double dpr = emscripten_get_device_pixel_ratio();
+  int width = std::max(1, static_cast<int>(std::lround(cssWidth * dpr)));
+  int height = std::max(1, static_cast<int>(std::lround(cssHeight * dpr)));
+  if (width == ctx.swapChainWidth && height == ctx.swapChainHeight) {
+    return;
+  }
+  emscripten_set_canvas_element_size("video", width, height);
+  configureSwapChain(width, height);
+}
 
-  WGPUSurfaceDescriptor surfaceDesc = {};
-  surfaceDesc.nextInChain = reinterpret_cast<WGPUChainedStruct *>(&canvasDesc);
+static EM_BOOL onCanvasResize(int eventType, const EmscriptenUiEvent *uiEvent,
+                              void *userData) {
+  // devicePixelRatioの変化(ズーム・ディスプレイ移動)もresizeで通知される
+  ctx.canvasResized = true;
+  return EM_FALSE;
+}
 
-  WGPUSurface surface = wgpuInstanceCreateSurface(nullptr, &surfaceDesc);
+// 表示アスペクト比を保ったままswapchainに収まる矩形を求める
+static void getViewportRect(AVFrame *frame, float &x, float &y, float &width,
+                            float &height) {
+  double displayAspect = 16.0 / 9.0;
+  AVRational sar = frame->sample_aspect_ratio;
+  if (sar.num > 0 && sar.den > 0) {
+    displayAspect = av_q2d(sar) * frame->width / frame->height;
+  }
+  width = ctx.swapChainWidth;
+  height = ctx.swapChainHeight;
+  if (width / height > displayAspect) {
+    width = std::round(height * displayAspect);
+  } else {
+    height = std::round(width / displayAspect);
+  }
+  x = std::floor((ctx.swapChainWidth - width) / 2);
+  y = std::floor((ctx.swapChainHeight - height) / 2);
+}
 
-  WGPUSwapChainDescriptor swapDesc = {};
-  swapDesc.usage = WGPUTextureUsage_RenderAttachment;
-  swapDesc.format = WGPUTextureFormat_BGRA8Unorm;
-  swapDesc.width = 1920;
-  swapDesc.height = 1080;
-  swapDesc.presentMode = WGPUPresentMode_Fifo;
+static void updateScaleParams(float width, float height) {
+  ScaleFilter filter = ctx.scaleFilter;
+  if (ctx.scaleParams.outputWidth == width &&
+      ctx.scaleParams.outputHeight == height &&
+      ctx.scaleParams.filter == filter) {
+    return;
+  }
+  ctx.scaleParams.outputWidth = width;
+  ctx.scaleParams.outputHeight = height;
+  ctx.scaleParams.filter = filter;
+  wgpuQueueWriteBuffer(ctx.queue, ctx.scaleParamsBuffer, 0, &ctx.scaleParams,
+                       sizeof(ScaleParams));
+}
 
-  ctx.swapChain = wgpuDeviceCreateSwapChain(ctx.device, surface, &swapDesc);
+static void createTimestampQueries() {
+  ctx.timestampSupported =
+      wgpuDeviceHasFeature(ctx.device, WGPUFeatureName_TimestampQuery);
+  spdlog::info("timestamp-query: {}",
+               ctx.timestampSupported ? "supported" : "not supported");
+  if (!ctx.timestampSupported) {
+    return;
+  }
 
-  // dummy texture.
-  createTextures(1920, 1080);
+  WGPUQuerySetDescriptor querySetDesc = {};
+  querySetDesc.type = WGPUQueryType_Timestamp;
+  querySetDesc.count = TIMESTAMP_COUNT;
+  ctx.timestampQuerySet = wgpuDeviceCreateQuerySet(ctx.device, &querySetDesc);
+
+  WGPUBufferDescriptor bufferDesc = {};
+  bufferDesc.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
+  bufferDesc.size = TIMESTAMP_BUFFER_SIZE;
+  ctx.timestampResolveBuffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+
+  bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+  for (auto &readback : ctx.timestampReadbacks) {
+    readback.buffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+  }
 }
 
-static void (
-    *initDeviceCallback)(); // キャプチャするとコンパイルできなかったのでグローバル変数化・・・
+// map待ちでない読み出し用バッファを探す。無ければこのフレームは計測しない
+static TimestampReadback *acquireTimestampReadback() {
+  if (!ctx.timestampSupported) {
+    return nullptr;
+  }
+  for (auto &readback : ctx.timestampReadbacks) {
+    if (!readback.pending) {
+      return &readback;
+    }
+  }
+  return nullptr;
+}
 
-void drawWebGpu(AVFrame *frame) {
-  if (frame->width != ctx.textureWidth || frame->height != ctx.textureHeight) {
-    releaseTextures();
-    createTextures(frame->width, frame->height);
+static void onTimestampsMapped(WGPUBufferMapAsyncStatus status,
+                               void *userdata) {
+  auto readback = static_cast<TimestampReadback *>(userdata);
+  if (status == WGPUBufferMapAsyncStatus_Success) {
+    auto timestamps =
+        static_cast<const uint64_t *>(wgpuBufferGetConstMappedRange(
+            readback->buffer, 0, TIMESTAMP_BUFFER_SIZE));
+    // 単位はns。量子化やリセットで逆転することがあるので、その場合は捨てる
+    if (timestamps[1] >= timestamps[0]) {
+      pushTiming(ctx.yadifMs, (timestamps[1] - timestamps[0]) / 1000000.0);
+    }
+    if (timestamps[3] >= timestamps[2]) {
+      pushTiming(ctx.renderMs, (timestamps[3] - timestamps[2]) / 1000000.0);
+    }
+    wgpuBufferUnmap(readback->buffer);
   }
+  readback->pending = false;
+}
 
-  WGPUTextureView backBufView =
-      wgpuSwapChainGetCurrentTextureView(ctx.swapChain); // create textureView
+WebGpuTimings getWebGpuTimings() {
+  std::lock_guard<std::mutex> lock(ctx.timingMtx);
+  WebGpuTimings timings;
+  timings.gpuTimestamps = ctx.timestampSupported;
+  timings.uploadMs = ctx.uploadMs.mean();
+  timings.yadifMs = ctx.yadifMs.mean();
+  timings.renderMs = ctx.renderMs.mean();
+  timings.presentMs = ctx.presentMs.mean();
+  return timings;
+}
+
+struct FrameReadback {
+  WGPUBuffer buffer;
+  uint64_t size;
+  uint32_t bytesPerRow;
+  int width;
+  int height;
+  FrameReadbackCallback callback;
+};
+
+static void onFrameReadbackMapped(WGPUBufferMapAsyncStatus status,
+                                  void *userdata) {
+  auto readback = static_cast<FrameReadback *>(userdata);
+  if (status == WGPUBufferMapAsyncStatus_Success) {
+    auto rgba = static_cast<const uint8_t *>(
+        wgpuBufferGetConstMappedRange(readback->buffer, 0, readback->size));
+    readback->callback(rgba, readback->bytesPerRow, readback->width,
+                       readback->height);
+    wgpuBufferUnmap(readback->buffer);
+  } else {
+    spdlog::warn("frame readback failed: {}", static_cast<int>(status));
+  }
+  wgpuBufferRelease(readback->buffer);
+  delete readback;
+}
+
+bool requestWebGpuFrameReadback(FrameReadbackCallback callback) {
+  FrameReadbackCallback expected = nullptr;
+  return ctx.frameReadbackCallback.compare_exchange_strong(expected, callback);
+}
+
+// 要求があれば、パスの出力を読み出し用のバッファにコピーするコマンドを積む。
+// mapはsubmitの後でmapFrameReadback()で行う
+static FrameReadback *encodeFrameReadback(WGPUCommandEncoder encoder,
+                                          RenderGraphTexture *output) {
+  FrameReadbackCallback callback = ctx.frameReadbackCallback.exchange(nullptr);
+  if (callback == nullptr) {
+    return nullptr;
+  }
+  auto readback = new FrameReadback();
+  readback->width = output->width;
+  readback->height = output->height;
+  readback->bytesPerRow =
+      (readback->width * 4 + VIDEO_BUFFER_ROW_ALIGNMENT - 1) /
+      VIDEO_BUFFER_ROW_ALIGNMENT * VIDEO_BUFFER_ROW_ALIGNMENT;
+  readback->size =
+      static_cast<uint64_t>(readback->bytesPerRow) * readback->height;
+  readback->callback = callback;
+
+  WGPUBufferDescriptor bufferDesc = {};
+  bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+  bufferDesc.size = readback->size;
+  readback->buffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+
+  WGPUImageCopyTexture src = {};
+  src.texture = output->texture;
+  src.aspect = WGPUTextureAspect_All;
+  WGPUImageCopyBuffer dst = {};
+  dst.buffer = readback->buffer;
+  dst.layout.bytesPerRow = readback->bytesPerRow;
+  dst.layout.rowsPerImage = readback->height;
+  WGPUExtent3D copySize = {
+      .width = static_cast<uint32_t>(readback->width),
+      .height = static_cast<uint32_t>(readback->height),
+      .depthOrArrayLayers = 1,
+  };
+  wgpuCommandEncoderCopyTextureToBuffer(encoder, &src, &dst, &copySize);
+  return readback;
+}
+
+static void mapFrameReadback(FrameReadback *readback) {
+  wgpuBufferMapAsync(readback->buffer, WGPUMapMode_Read, 0, readback->size,
+                     onFrameReadbackMapped, readback);
+}
+
+// 描画中のフレームで積んだ読み出し。submitの後でmapする
+static FrameReadback *frameReadback = nullptr;
+
+// yadif(無効な場合は色変換だけ)でフレームのプレーンからRGBAを作るパス
+static void runYuvPass(RenderGraphPassContext &pass, bool deinterlace) {
+  FrameTextures &tex = *ctx.currentTextures;
+  bool nv12 = tex.key.format == AV_PIX_FMT_NV12;
+  WGPUComputePipeline pipeline;
+  if (deinterlace) {
+    pipeline = nv12 ? ctx.yadifNv12Pipeline : ctx.yadifPipeline;
+  } else {
+    pipeline = nv12 ? ctx.convertNv12Pipeline : ctx.convertPipeline;
+  }
+
+  WGPUComputePassTimestampWrites timestampWrites = {
+      .querySet = ctx.timestampQuerySet,
+      .beginningOfPassWriteIndex = 0,
+      .endOfPassWriteIndex = 1,
+  };
+  WGPUComputePassDescriptor passDesc = {};
+  if (ctx.frameTimestamps) {
+    passDesc.timestampWrites = &timestampWrites;
+  }
+
+  double start = emscripten_get_now();
+  WGPUComputePassEncoder compPass =
+      wgpuCommandEncoderBeginComputePass(pass.encoder, &passDesc);
+  wgpuComputePassEncoderSetPipeline(compPass, pipeline);
+  wgpuComputePassEncoderSetBindGroup(compPass, 0, tex.yadifBindGroup, 0, 0);
+  wgpuComputePassEncoderSetBindGroup(compPass, 1, pass.output->outputBindGroup,
+                                     0, 0);
+  // 1スレッドで2x2画素を処理する。lowresで幅・高さがワークグループの
+  // 倍数にならない場合も端まで埋まるよう切り上げる(範囲外への書き込みは無視される)
+  wgpuComputePassEncoderDispatchWorkgroups(
+      compPass, (tex.key.width / 2 + 15) / 16, (tex.key.height / 2 + 3) / 4, 1);
+  wgpuComputePassEncoderEnd(compPass);
+  wgpuComputePassEncoderRelease(compPass);
+  if (!ctx.timestampSupported) {
+    pushTiming(ctx.yadifMs, emscripten_get_now() - start);
+  }
+
+  frameReadback = encodeFrameReadback(pass.encoder, pass.output);
+}
+
+static void runSharpenPass(RenderGraphPassContext &pass) {
+  float strength = ctx.sharpenStrength;
+  if (strength != ctx.sharpenParamsStrength) {
+    ctx.sharpenParamsStrength = strength;
+    SharpenParams params = {.strength = strength};
+    wgpuQueueWriteBuffer(ctx.queue, ctx.sharpenParamsBuffer, 0, &params,
+                         sizeof(SharpenParams));
+  }
+
+  WGPUComputePassEncoder compPass =
+      wgpuCommandEncoderBeginComputePass(pass.encoder, nullptr);
+  wgpuComputePassEncoderSetPipeline(compPass, ctx.sharpenPipeline);
+  wgpuComputePassEncoderSetBindGroup(compPass, 0, pass.input->inputBindGroup,
+                                     0, 0);
+  wgpuComputePassEncoderSetBindGroup(compPass, 1, pass.output->outputBindGroup,
+                                     0, 0);
+  wgpuComputePassEncoderSetBindGroup(compPass, 2, ctx.sharpenParamsBindGroup,
+                                     0, 0);
+  wgpuComputePassEncoderDispatchWorkgroups(compPass,
+                                           (pass.output->width + 7) / 8,
+                                           (pass.output->height + 7) / 8, 1);
+  wgpuComputePassEncoderEnd(compPass);
+  wgpuComputePassEncoderRelease(compPass);
+}
+
+// アスペクト比を保ってswapchainに拡大縮小する
+static void runScalePass(RenderGraphPassContext &pass) {
+  WGPURenderPassTimestampWrites timestampWrites = {
+      .querySet = ctx.timestampQuerySet,
+      .beginningOfPassWriteIndex = 2,
+      .endOfPassWriteIndex = 3,
+  };
 
   WGPURenderPassColorAttachment colorDesc = {};
-  colorDesc.view = backBufView;
-  colorDesc.loadOp = WGPULoadOp_Clear;
+  colorDesc.view = pass.swapChainView;
+  colorDesc.loadOp = pass.clearSwapChain ? WGPULoadOp_Clear : WGPULoadOp_Load;
   colorDesc.storeOp = WGPUStoreOp_Store;
   colorDesc.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
   colorDesc.clearValue.r = 0.0f;
@@ -374,123 +892,335 @@ void drawWebGpu(AVFrame *frame) {
   colorDesc.clearValue.b = 0.0f;
   colorDesc.clearValue.a = 1.0f;
 
-  WGPUComputePassDescriptor compPassDesc = {};
+  WGPURenderPassDescriptor renderPassDesc = {};
+  renderPassDesc.colorAttachmentCount = 1;
+  renderPassDesc.colorAttachments = &colorDesc;
+  if (ctx.frameTimestamps) {
+    renderPassDesc.timestampWrites = &timestampWrites;
+  }
+
+  double start = emscripten_get_now();
+  WGPURenderPassEncoder renderPass =
+      wgpuCommandEncoderBeginRenderPass(pass.encoder, &renderPassDesc);
+  wgpuRenderPassEncoderSetPipeline(renderPass, ctx.pipeline);
+  wgpuRenderPassEncoderSetViewport(renderPass, ctx.viewportX, ctx.viewportY,
+                                   ctx.viewportWidth, ctx.viewportHeight, 0.0f,
+                                   1.0f);
+  wgpuRenderPassEncoderSetBindGroup(renderPass, 0, pass.input->inputBindGroup,
+                                    0, 0);
+  wgpuRenderPassEncoderSetBindGroup(renderPass, 1, ctx.scaleParamsBindGroup, 0,
+                                    0);
+  wgpuRenderPassEncoderDraw(renderPass, 6, 1, 0, 0);
+  wgpuRenderPassEncoderEnd(renderPass);
+  wgpuRenderPassEncoderRelease(renderPass);
+  if (!ctx.timestampSupported) {
+    pushTiming(ctx.renderMs, emscripten_get_now() - start);
+  }
+}
+
+// 字幕を拡大縮小後の映像の上に重ねる
+static void runCaptionPass(RenderGraphPassContext &pass) {
+  if (!hasCaptionOverlay()) {
+    return;
+  }
+  WGPURenderPassColorAttachment colorDesc = {};
+  colorDesc.view = pass.swapChainView;
+  colorDesc.loadOp = pass.clearSwapChain ? WGPULoadOp_Clear : WGPULoadOp_Load;
+  colorDesc.storeOp = WGPUStoreOp_Store;
+  colorDesc.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+  colorDesc.clearValue.a = 1.0f;
 
   WGPURenderPassDescriptor renderPassDesc = {};
   renderPassDesc.colorAttachmentCount = 1;
   renderPassDesc.colorAttachments = &colorDesc;
 
-  WGPUCommandEncoder encoder =
-      wgpuDeviceCreateCommandEncoder(ctx.device, nullptr); // create encoder
+  WGPURenderPassEncoder renderPass =
+      wgpuCommandEncoderBeginRenderPass(pass.encoder, &renderPassDesc);
+  drawCaptionOverlay(renderPass, ctx.viewportX, ctx.viewportY,
+                     ctx.viewportWidth, ctx.viewportHeight);
+  wgpuRenderPassEncoderEnd(renderPass);
+  wgpuRenderPassEncoderRelease(renderPass);
+}
 
-  WGPUExtent3D copySize = {
-      .width = static_cast<uint32_t>(frame->width),
-      .height = static_cast<uint32_t>(frame->height),
-      .depthOrArrayLayers = 1,
-  };
+// 描画の順序: yadif/色変換 -> シャープ化 -> 拡大縮小 -> 字幕
+static void registerRenderPasses() {
+  initRenderGraph(ctx.device, ctx.sampler, ctx.inputBindGroupLayout,
+                  ctx.outputBindGroupLayout);
+  bool deinterlace = ctx.deinterlace;
+  ctx.deinterlacePass = addRenderGraphPass(
+      "deinterlace", TARGET_TRANSIENT,
+      [](RenderGraphPassContext &pass) { runYuvPass(pass, true); },
+      deinterlace);
+  ctx.convertPass = addRenderGraphPass(
+      "convert", TARGET_TRANSIENT,
+      [](RenderGraphPassContext &pass) { runYuvPass(pass, false); },
+      !deinterlace);
+  ctx.sharpenPass = addRenderGraphPass("sharpen", TARGET_TRANSIENT,
+                                       runSharpenPass,
+                                       ctx.sharpenStrength > 0.0f);
+  ctx.scalePass = addRenderGraphPass("scale", TARGET_SWAPCHAIN, runScalePass);
+  // 字幕が無い間はパスごと外す
+  ctx.captionPass = addRenderGraphPass("caption", TARGET_SWAPCHAIN,
+                                       runCaptionPass, false);
+}
 
-  WGPUExtent3D copySizeuv = {
-      .width = static_cast<uint32_t>(frame->width / 2),
-      .height = static_cast<uint32_t>(frame->height / 2),
-      .depthOrArrayLayers = 1,
-  };
+void setWebGpuCaptionPage(const CaptionPage &page) {
+  setCaptionOverlayPage(page);
+  setRenderGraphPassEnabled(ctx.captionPass, !page.runs.empty());
+}
 
-  WGPUTextureDataLayout textureDataLayout = {
-      .offset = 0,
-      .bytesPerRow = static_cast<uint32_t>(frame->width),
-      .rowsPerImage = static_cast<uint32_t>(frame->height),
-  };
+void setWebGpuDeinterlace(bool enabled) {
+  //
+  ctx.deinterlace = enabled;
+}
 
-  WGPUTextureDataLayout textureDataLayoutUv = {
-      .offset = 0,
-      .bytesPerRow = static_cast<uint32_t>(frame->width / 2),
-      .rowsPerImage = static_cast<uint32_t>(frame->height / 2),
-  };
+void setSharpness(float strength) {
+  //
+  ctx.sharpenStrength = std::max(strength, 0.0f);
+}
 
-  WGPUOrigin3D origin = {};
+void setScaleFilter(int filter) {
+  //
+  ctx.scaleFilter = (ScaleFilter)filter;
+}
 
-  WGPUImageCopyTexture copyTexture = {
-      .mipLevel = 0,
-      .origin = origin,
-      .aspect = WGPUTextureAspect::WGPUTextureAspect_All,
+bool isWebGpuReady() {
+  return ctx.device && ctx.pendingPipelines == 0 && ctx.pipeline &&
+         ctx.yadifPipeline && ctx.yadifNv12Pipeline && ctx.convertPipeline &&
+         ctx.convertNv12Pipeline && ctx.sharpenPipeline;
+}
+
+void initWebGpu() {
+  ctx.device = emscripten_webgpu_get_device();
+
+  ctx.queue = wgpuDeviceGetQueue(ctx.device);
+
+  // pipeline/buffer
+  createPipeline();
+
+  WGPUBufferDescriptor bufferDesc = {};
+  bufferDesc.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst;
+  bufferDesc.size = sizeof(ScaleParams);
+  ctx.scaleParamsBuffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+  bufferDesc.size = sizeof(SharpenParams);
+  ctx.sharpenParamsBuffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+
+  WGPUBindGroupEntry paramsEntry = {
+      .binding = 0,
+      .buffer = ctx.scaleParamsBuffer,
+      .size = sizeof(ScaleParams),
   };
+  WGPUBindGroupDescriptor bgDesc = {};
+  bgDesc.layout = ctx.scaleParamsBindGroupLayout;
+  bgDesc.entryCount = 1;
+  bgDesc.entries = &paramsEntry;
+  ctx.scaleParamsBindGroup = wgpuDeviceCreateBindGroup(ctx.device, &bgDesc);
 
-  copyTexture.texture = ctx.nextTextureY;
-  wgpuQueueWriteTexture(ctx.queue, &copyTexture, frame->data[0],
-                        frame->height * frame->linesize[0], &textureDataLayout,
-                        &copySize);
+  paramsEntry.buffer = ctx.sharpenParamsBuffer;
+  paramsEntry.size = sizeof(SharpenParams);
+  bgDesc.layout = ctx.sharpenParamsBindGroupLayout;
+  ctx.sharpenParamsBindGroup = wgpuDeviceCreateBindGroup(ctx.device, &bgDesc);
 
-  copyTexture.texture = ctx.nextTextureU;
-  wgpuQueueWriteTexture(ctx.queue, &copyTexture, frame->data[1],
-                        frame->height * frame->linesize[1],
-                        &textureDataLayoutUv, &copySizeuv);
+  WGPUSamplerDescriptor samplerDesc = {};
+  samplerDesc.magFilter = WGPUFilterMode_Linear;
+  samplerDesc.minFilter = WGPUFilterMode_Linear;
+  samplerDesc.addressModeU = WGPUAddressMode_ClampToEdge;
+  samplerDesc.addressModeV = WGPUAddressMode_ClampToEdge;
+  ctx.sampler = wgpuDeviceCreateSampler(ctx.device, &samplerDesc);
 
-  copyTexture.texture = ctx.nextTextureV;
-  wgpuQueueWriteTexture(ctx.queue, &copyTexture, frame->data[2],
-                        frame->height * frame->linesize[2],
-                        &textureDataLayoutUv, &copySizeuv);
+  initCaptionOverlay(ctx.device, ctx.queue, ctx.sampler);
+  registerRenderPasses();
 
-  WGPUComputePassEncoder compPass =
-      wgpuCommandEncoderBeginComputePass(encoder, &compPassDesc);
-  wgpuComputePassEncoderSetPipeline(compPass, ctx.yadifPipeline);
-  wgpuComputePassEncoderSetBindGroup(compPass, 0, ctx.yadifBindGroup, 0, 0);
-  wgpuComputePassEncoderDispatchWorkgroups(compPass, ctx.textureWidth / 16 / 2,
-                                           ctx.textureHeight / 4 / 2, 1);
-  wgpuComputePassEncoderEnd(compPass);
-  wgpuComputePassEncoderRelease(compPass);
+  // create swapchain?
+  WGPUSurfaceDescriptorFromCanvasHTMLSelector canvasDesc = {};
+  canvasDesc.chain.sType = WGPUSType_SurfaceDescriptorFromCanvasHTMLSelector;
+  // 表示用のスレッドではGL.offscreenCanvasesからidで引かれる
+  canvasDesc.selector = "video";
+
+  WGPUSurfaceDescriptor surfaceDesc = {};
+  surfaceDesc.nextInChain = reinterpret_cast<WGPUChainedStruct *>(&canvasDesc);
+
+  ctx.surface = wgpuInstanceCreateSurface(nullptr, &surfaceDesc);
+
+  createTimestampQueries();
+
+  configureSwapChain(1920, 1080);
+  emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, nullptr,
+                                 EM_FALSE, onCanvasResize);
+
+  // 放送でよく使われる解像度は最初のフレームより前に作っておく
+  prepareWebGpuTextures(1440, 1080, AV_PIX_FMT_YUV420P);
+  prepareWebGpuTextures(1920, 1080, AV_PIX_FMT_YUV420P);
+}
+
+static void (
+    *initDeviceCallback)(); // キャプチャするとコンパイルできなかったのでグローバル変数化・・・
+
+// framepool.cppで確保したフレームのように、全プレーンが1つのバッファに
+// 256バイト境界の行ピッチで入っているか
+static bool isBufferUploadable(AVFrame *frame) {
+  AVBufferRef *buf = frame->buf[0];
+  if (frame->format != AV_PIX_FMT_YUV420P || buf == nullptr ||
+      frame->buf[1] != nullptr || buf->size % 4 != 0) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (frame->linesize[i] <= 0 ||
+        frame->linesize[i] % VIDEO_BUFFER_ROW_ALIGNMENT != 0 ||
+        frame->data[i] < buf->data || frame->data[i] >= buf->data + buf->size) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  WGPURenderPassEncoder pass = wgpuCommandEncoderBeginRenderPass(
-      encoder, &renderPassDesc); // create pass
-  wgpuRenderPassEncoderSetPipeline(pass, ctx.pipeline);
-  wgpuRenderPassEncoderSetBindGroup(pass, 0, ctx.bindGroup, 0, 0);
-  wgpuRenderPassEncoderDraw(pass, 6, 1, 0, 0);
+// フレーム全体を1回のwriteBufferで送り、プレーンごとにテクスチャへコピーする。
+// 行ピッチが揃っているのでブラウザ側で行の詰め直しが発生しない
+static void uploadPlanesByBuffer(WGPUCommandEncoder encoder,
+                                 FrameTextures &tex, AVFrame *frame) {
+  AVBufferRef *buf = frame->buf[0];
+  if (tex.stagingBufferSize < buf->size) {
+    if (tex.stagingBuffer) {
+      wgpuBufferRelease(tex.stagingBuffer);
+    }
+    WGPUBufferDescriptor bufferDesc = {};
+    bufferDesc.usage = WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+    bufferDesc.size = buf->size;
+    tex.stagingBuffer = wgpuDeviceCreateBuffer(ctx.device, &bufferDesc);
+    tex.stagingBufferSize = buf->size;
+  }
+  wgpuQueueWriteBuffer(ctx.queue, tex.stagingBuffer, 0, buf->data, buf->size);
+
+  for (int i = 0; i < tex.planeCount; i++) {
+    const WGPUExtent3D &copySize = tex.planeSizes[i];
+    WGPUImageCopyBuffer src = {};
+    src.buffer = tex.stagingBuffer;
+    src.layout.offset = frame->data[i] - buf->data;
+    src.layout.bytesPerRow = frame->linesize[i];
+    src.layout.rowsPerImage = copySize.height;
+    WGPUImageCopyTexture dst = {};
+    dst.texture = tex.planeTextures[NEXT][i];
+    dst.aspect = WGPUTextureAspect_All;
+    wgpuCommandEncoderCopyBufferToTexture(encoder, &src, &dst, &copySize);
+  }
+}
 
-  wgpuRenderPassEncoderEnd(pass);
-  wgpuRenderPassEncoderRelease(pass); // release pass
+// 既定のget_buffer2で確保されたフレームやNV12にパックしたフレーム用。
+// linesizeをそのまま行ピッチにする
+static void uploadPlanesByWriteTexture(FrameTextures &tex, AVFrame *frame) {
+  for (int i = 0; i < tex.planeCount; i++) {
+    const WGPUExtent3D &copySize = tex.planeSizes[i];
+    WGPUTextureDataLayout layout = {
+        .offset = 0,
+        .bytesPerRow = static_cast<uint32_t>(frame->linesize[i]),
+        .rowsPerImage = copySize.height,
+    };
+    WGPUImageCopyTexture dst = {};
+    dst.texture = tex.planeTextures[NEXT][i];
+    dst.aspect = WGPUTextureAspect_All;
+    wgpuQueueWriteTexture(ctx.queue, &dst, frame->data[i],
+                          static_cast<size_t>(frame->linesize[i]) *
+                              copySize.height,
+                          &layout, &copySize);
+  }
+}
 
-  // current => prev
+// 全プレーンをfromスロットからtoスロットへコピーする
+static void copyFrameSlot(WGPUCommandEncoder encoder, FrameTextures &tex,
+                          FrameSlot from, FrameSlot to) {
   WGPUImageCopyTexture copySrc = {
       .mipLevel = 0,
-      .origin = origin,
-      .aspect = WGPUTextureAspect::WGPUTextureAspect_All,
-  };
-  WGPUImageCopyTexture copyDst = {
-      .mipLevel = 0,
-      .origin = origin,
+      .origin = {},
       .aspect = WGPUTextureAspect::WGPUTextureAspect_All,
   };
+  WGPUImageCopyTexture copyDst = copySrc;
+  for (int i = 0; i < tex.planeCount; i++) {
+    copySrc.texture = tex.planeTextures[from][i];
+    copyDst.texture = tex.planeTextures[to][i];
+    wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
+                                           &tex.planeSizes[i]);
+  }
+}
+
+void drawWebGpu(AVFrame *frame) {
+  FrameTextures &tex = getTextures(frame->width, frame->height, frame->format);
+  if (&tex != ctx.currentTextures) {
+    tex.primed = false;
+    ctx.currentTextures = &tex;
+  }
+  tex.lastUsed = ++ctx.drawCount;
+  if (ctx.canvasResized) {
+    ctx.canvasResized = false;
+    updateCanvasSize();
+  }
 
-  copySrc.texture = ctx.curTextureY;
-  copyDst.texture = ctx.prevTextureY;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySize);
-  copySrc.texture = ctx.curTextureU;
-  copyDst.texture = ctx.prevTextureU;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySizeuv);
-  copySrc.texture = ctx.curTextureV;
-  copyDst.texture = ctx.prevTextureV;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySizeuv);
-
-  copySrc.texture = ctx.nextTextureY;
-  copyDst.texture = ctx.curTextureY;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySize);
-  copySrc.texture = ctx.nextTextureU;
-  copyDst.texture = ctx.curTextureU;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySizeuv);
-  copySrc.texture = ctx.nextTextureV;
-  copyDst.texture = ctx.curTextureV;
-  wgpuCommandEncoderCopyTextureToTexture(encoder, &copySrc, &copyDst,
-                                         &copySizeuv);
+  getViewportRect(frame, ctx.viewportX, ctx.viewportY, ctx.viewportWidth,
+                  ctx.viewportHeight);
+  updateScaleParams(ctx.viewportWidth, ctx.viewportHeight);
+
+  double presentStart = emscripten_get_now();
+  WGPUTextureView backBufView =
+      wgpuSwapChainGetCurrentTextureView(ctx.swapChain); // create textureView
+  double presentTime = emscripten_get_now() - presentStart;
+
+  // timestamp-queryが使えない場合はCPU側でのエンコード時間で代用する
+  TimestampReadback *readback = acquireTimestampReadback();
+  ctx.frameTimestamps = readback;
+
+  WGPUCommandEncoder encoder =
+      wgpuDeviceCreateCommandEncoder(ctx.device, nullptr); // create encoder
+
+  double uploadStart = emscripten_get_now();
+  if (isBufferUploadable(frame)) {
+    uploadPlanesByBuffer(encoder, tex, frame);
+  } else {
+    uploadPlanesByWriteTexture(tex, frame);
+  }
+  pushTiming(ctx.uploadMs, emscripten_get_now() - uploadStart);
+
+  // 解像度切り替え直後はprev/curに古いフレームが残っているので、
+  // 今回のフレームで埋めてから使う
+  if (!tex.primed) {
+    copyFrameSlot(encoder, tex, NEXT, PREV);
+    copyFrameSlot(encoder, tex, NEXT, CUR);
+    tex.primed = true;
+  }
+
+  syncRenderPasses();
+  executeRenderGraph(encoder, frame, backBufView);
+
+  // current => prev, next => current
+  copyFrameSlot(encoder, tex, CUR, PREV);
+  copyFrameSlot(encoder, tex, NEXT, CUR);
+
+  if (readback) {
+    wgpuCommandEncoderResolveQuerySet(encoder, ctx.timestampQuerySet, 0,
+                                      TIMESTAMP_COUNT,
+                                      ctx.timestampResolveBuffer, 0);
+    wgpuCommandEncoderCopyBufferToBuffer(encoder, ctx.timestampResolveBuffer,
+                                         0, readback->buffer, 0,
+                                         TIMESTAMP_BUFFER_SIZE);
+  }
 
   WGPUCommandBuffer commands =
       wgpuCommandEncoderFinish(encoder, nullptr); // create commands
   wgpuCommandEncoderRelease(encoder);             // release encoder
 
+  presentStart = emscripten_get_now();
   wgpuQueueSubmit(ctx.queue, 1, &commands);
+  presentTime += emscripten_get_now() - presentStart;
+  pushTiming(ctx.presentMs, presentTime);
   wgpuCommandBufferRelease(commands);  // release commands
   wgpuTextureViewRelease(backBufView); // release textureView
+
+  if (readback) {
+    readback->pending = true;
+    wgpuBufferMapAsync(readback->buffer, WGPUMapMode_Read, 0,
+                       TIMESTAMP_BUFFER_SIZE, onTimestampsMapped, readback);
+  }
+  ctx.frameTimestamps = nullptr;
+  if (frameReadback) {
+    mapFrameReadback(frameReadback);
+    frameReadback = nullptr;
+  }
 }
@@ -1,8 +1,42 @@
 #pragma once
 
+#include <cstdint>
+
+struct CaptionPage;
+
 extern "C" {
 #include <libavutil/frame.h>
 }
 
+// 各パスの所要時間(ms)の直近の平均値。
+// gpuTimestampsがfalseの場合、yadif/renderはCPU側でのエンコード時間。
+struct WebGpuTimings {
+  bool gpuTimestamps;
+  double uploadMs;
+  double yadifMs;
+  double renderMs;
+  double presentMs;
+};
+
 void initWebGpu();
+// パイプラインの非同期作成が終わって描画できるようになったか
+bool isWebGpuReady();
 void drawWebGpu(AVFrame *);
+// 指定の解像度・フォーマット用のテクスチャを描画前に用意しておく
+void prepareWebGpuTextures(int width, int height, int format);
+void setScaleFilter(int filter);
+// インターレース解除(yadif)の有無。無効にすると色変換だけのパスになる
+void setWebGpuDeinterlace(bool enabled);
+// 0で無効(パスごと外す)
+void setSharpness(float strength);
+WebGpuTimings getWebGpuTimings();
+// 次に描画するフレームから重ねる字幕を差し替える。runsが空なら消す
+void setWebGpuCaptionPage(const CaptionPage &page);
+
+// 次に描画するフレームのyadif・色変換後のRGBA(シャープ化などの前)を読み出す。
+// 読み出しは非同期で、callbackには行ピッチ(256の倍数)付きで渡される。
+// 前の要求がまだ処理されていなければfalseを返す
+using FrameReadbackCallback = void (*)(const uint8_t *rgba,
+                                       uint32_t bytesPerRow, int width,
+                                       int height);
+bool requestWebGpuFrameReadback(FrameReadbackCallback callback);